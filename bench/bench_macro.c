@@ -0,0 +1,417 @@
+/*
+ * bench_macro.c - End-to-end conversion benchmark with a regression baseline
+ *
+ * Generates a fixed set of banks with sf2_gen, converts each one through
+ * the sf2wfb command line (the full process_file path) and records wall
+ * time, CPU time, peak RSS and output size. --record writes the results
+ * as a baseline; --compare checks a new run against one and exits 1 when
+ * any workload regressed beyond the threshold. Each workload gets one
+ * untimed warm-up conversion, and a time only counts as a regression when
+ * it also grew by more than the noise floor, since the small banks finish
+ * in tens of milliseconds.
+ *
+ * Usage: sf2wfb_macro [--record FILE | --compare FILE] [options]
+ */
+
+#define _DEFAULT_SOURCE                  /* wait4() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MACRO_BASELINE_VERSION 1
+#define MACRO_MAX_ARGS 24
+#define MACRO_MAX_RUNS 32
+
+/* One generated bank and how to convert it */
+struct Workload {
+    const char *name;
+    const char *gen_args[MACRO_MAX_ARGS];   /* sf2_gen options, NULL-terminated */
+};
+
+static const struct Workload workloads[] = {
+    { "small_gm",
+      { "-n", "128", "-z", "4", "--length", "200:2000", "--rates", "22050,44100", NULL } },
+    { "large_multibank",
+      { "-n", "1024", "-z", "8", "--length", "1000:12000", "--share", "0.4", NULL } },
+    { "hires_stereo",
+      { "-n", "64", "-z", "8", "--stereo", "0.9", "--rates", "96000",
+        "--length", "20000:80000", "--dup", "0.1", NULL } },
+    { "drum_heavy",
+      { "-n", "8", "-z", "2", "--kits", "16", "--drum-length", "4000:20000", NULL } }
+};
+
+#define WORKLOAD_COUNT ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+struct MacroResult {
+    char name[64];
+    double wall_ms;                  /* Median over runs */
+    double cpu_ms;                   /* Median user+system */
+    long long peak_rss_kb;           /* Largest over runs */
+    long long output_bytes;
+};
+
+struct MacroOptions {
+    const char *sf2wfb;
+    const char *gen;
+    const char *workdir;
+    const char *record;
+    const char *compare;
+    const char *extra;               /* Extra sf2wfb arguments, space-separated */
+    double threshold;                /* Percent */
+    double noise_ms;                 /* Time changes below this are never regressions */
+    int runs;
+};
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double timeval_ms(const struct timeval *tv) {
+    return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+/* Run argv with output discarded; fills wall time and the child's rusage */
+static int run_child(char *const argv[], long long *wall_ns, struct rusage *usage) {
+    long long start = now_ns();
+    int status;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        fprintf(stderr, "Error: fork failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    if (wait4(pid, &status, 0, usage) < 0) {
+        fprintf(stderr, "Error: wait failed: %s\n", strerror(errno));
+        return -1;
+    }
+    *wall_ns = now_ns() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: '%s' failed (status %d)\n", argv[0],
+                WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *values, int count) {
+    qsort(values, (size_t)count, sizeof(*values), compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2.0;
+}
+
+static int run_workload(const struct Workload *w, const struct MacroOptions *opts,
+                        struct MacroResult *result) {
+    char sf2_path[512];
+    char wfb_path[512];
+    char *argv[MACRO_MAX_ARGS * 2 + 8];
+    char *extra_copy = NULL;
+    double wall[MACRO_MAX_RUNS];
+    double cpu[MACRO_MAX_RUNS];
+    struct rusage usage;
+    struct stat st;
+    long long wall_ns;
+    int argc = 0;
+
+    snprintf(sf2_path, sizeof(sf2_path), "%s/%s.sf2", opts->workdir, w->name);
+    snprintf(wfb_path, sizeof(wfb_path), "%s/%s.wfb", opts->workdir, w->name);
+
+    /* Generate the bank (deterministic, so identical on every run) */
+    argv[argc++] = (char *)opts->gen;
+    for (int i = 0; w->gen_args[i]; i++) {
+        argv[argc++] = (char *)w->gen_args[i];
+    }
+    argv[argc++] = "-o";
+    argv[argc++] = sf2_path;
+    argv[argc] = NULL;
+    if (run_child(argv, &wall_ns, &usage) != 0) {
+        return -1;
+    }
+
+    /* Convert it */
+    argc = 0;
+    argv[argc++] = (char *)opts->sf2wfb;
+    argv[argc++] = "-y";
+    if (opts->extra) {
+        size_t len = strlen(opts->extra) + 1;
+        extra_copy = malloc(len);
+        if (!extra_copy) {
+            return -1;
+        }
+        memcpy(extra_copy, opts->extra, len);
+        for (char *tok = strtok(extra_copy, " "); tok && argc < MACRO_MAX_ARGS;
+             tok = strtok(NULL, " ")) {
+            argv[argc++] = tok;
+        }
+    }
+    argv[argc++] = "-o";
+    argv[argc++] = wfb_path;
+    argv[argc++] = sf2_path;
+    argv[argc] = NULL;
+
+    memset(result, 0, sizeof(*result));
+    snprintf(result->name, sizeof(result->name), "%s", w->name);
+
+    /* Warm-up: fault in the binary and the bank so the first timed run is not an outlier */
+    unlink(wfb_path);
+    if (run_child(argv, &wall_ns, &usage) != 0) {
+        free(extra_copy);
+        return -1;
+    }
+    for (int r = 0; r < opts->runs; r++) {
+        unlink(wfb_path);
+        if (run_child(argv, &wall_ns, &usage) != 0) {
+            free(extra_copy);
+            return -1;
+        }
+        wall[r] = wall_ns / 1e6;
+        cpu[r] = timeval_ms(&usage.ru_utime) + timeval_ms(&usage.ru_stime);
+#ifdef __APPLE__
+        usage.ru_maxrss /= 1024;     /* Bytes on macOS */
+#endif
+        if (usage.ru_maxrss > result->peak_rss_kb) {
+            result->peak_rss_kb = usage.ru_maxrss;
+        }
+    }
+    free(extra_copy);
+
+    result->wall_ms = median(wall, opts->runs);
+    result->cpu_ms = median(cpu, opts->runs);
+    result->output_bytes = stat(wfb_path, &st) == 0 ? (long long)st.st_size : -1;
+    return 0;
+}
+
+/* Baseline format: one JSON object per workload line, written by save_baseline() */
+static int save_baseline(const char *path, const struct MacroResult *results, int count) {
+    FILE *f = fopen(path, "w");
+    int ok;
+
+    if (!f) {
+        fprintf(stderr, "Error: Cannot create baseline '%s'\n", path);
+        return -1;
+    }
+    fprintf(f, "{\"version\": %d, \"workloads\": [\n", MACRO_BASELINE_VERSION);
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "  {\"name\": \"%s\", \"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+                   "\"peak_rss_kb\": %lld, \"output_bytes\": %lld}%s\n",
+                results[i].name, results[i].wall_ms, results[i].cpu_ms,
+                results[i].peak_rss_kb, results[i].output_bytes, i + 1 < count ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write baseline '%s'\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int load_baseline(const char *path, struct MacroResult *results, int max, int *count) {
+    FILE *f = fopen(path, "r");
+    char line[512];
+    int version = 0;
+
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open baseline '%s'\n", path);
+        return -1;
+    }
+    *count = 0;
+    while (fgets(line, sizeof(line), f)) {
+        struct MacroResult *r = &results[*count];
+
+        if (sscanf(line, "{\"version\": %d", &version) == 1) {
+            continue;
+        }
+        if (*count < max &&
+            sscanf(line, " {\"name\": \"%63[^\"]\", \"wall_ms\": %lf, \"cpu_ms\": %lf, "
+                         "\"peak_rss_kb\": %lld, \"output_bytes\": %lld}",
+                   r->name, &r->wall_ms, &r->cpu_ms, &r->peak_rss_kb, &r->output_bytes) == 5) {
+            (*count)++;
+        }
+    }
+    fclose(f);
+
+    if (version != MACRO_BASELINE_VERSION) {
+        fprintf(stderr, "Error: '%s' is not a version %d baseline\n", path,
+                MACRO_BASELINE_VERSION);
+        return -1;
+    }
+    return 0;
+}
+
+/* Print one metric's change; returns 1 when it grew beyond both threshold and floor */
+static int compare_metric(const char *label, double base, double now, double threshold,
+                          double floor) {
+    double change = base > 0 ? 100.0 * (now - base) / base : 0.0;
+    int regressed = change > threshold && now - base > floor;
+
+    printf("  %-13s %12.1f -> %12.1f  %+7.1f%%%s\n", label, base, now, change,
+           regressed ? "  REGRESSION" : "");
+    return regressed;
+}
+
+static int compare_results(const struct MacroResult *base, int base_count,
+                           const struct MacroResult *now, int now_count,
+                           const struct MacroOptions *opts) {
+    int regressions = 0;
+
+    for (int i = 0; i < now_count; i++) {
+        const struct MacroResult *b = NULL;
+
+        for (int j = 0; j < base_count; j++) {
+            if (strcmp(base[j].name, now[i].name) == 0) {
+                b = &base[j];
+            }
+        }
+        printf("%s\n", now[i].name);
+        if (!b) {
+            printf("  (not in baseline)\n");
+            continue;
+        }
+        regressions += compare_metric("wall ms", b->wall_ms, now[i].wall_ms,
+                                      opts->threshold, opts->noise_ms);
+        regressions += compare_metric("cpu ms", b->cpu_ms, now[i].cpu_ms,
+                                      opts->threshold, opts->noise_ms);
+        regressions += compare_metric("peak RSS KiB", (double)b->peak_rss_kb,
+                                      (double)now[i].peak_rss_kb, opts->threshold, 0.0);
+        if (b->output_bytes != now[i].output_bytes) {
+            printf("  %-13s %12lld -> %12lld  CHANGED\n", "output bytes",
+                   b->output_bytes, now[i].output_bytes);
+            regressions++;
+        }
+    }
+
+    printf("\n%d regression(s) beyond %.1f%% (times also beyond %.1f ms)\n", regressions,
+           opts->threshold, opts->noise_ms);
+    return regressions;
+}
+
+static void print_usage(const char *prog_name) {
+    printf("Usage: %s [--record FILE | --compare FILE] [options]\n\n", prog_name);
+    printf("Options:\n");
+    printf("      --record <file>      Write results as a new baseline\n");
+    printf("      --compare <file>     Compare results against a baseline\n");
+    printf("      --threshold <pct>    Allowed slowdown/growth (default: 10)\n");
+    printf("      --noise-ms <ms>      Ignore time changes up to this size (default: 5)\n");
+    printf("  -r, --runs <n>           Timed conversions per workload (default: 9)\n");
+    printf("      --sf2wfb <path>      Converter binary (default: ./sf2wfb)\n");
+    printf("      --gen <path>         Generator binary (default: ./sf2_gen)\n");
+    printf("      --workdir <dir>      Where banks are generated (default: macro_work)\n");
+    printf("      --args \"<args>\"      Extra sf2wfb arguments, e.g. \"-t 4\"\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct MacroOptions opts;
+    struct MacroResult results[WORKLOAD_COUNT];
+    struct MacroResult baseline[64];
+    int baseline_count = 0;
+    int opt;
+
+    static struct option long_options[] = {
+        {"record",    required_argument, 0, 1000},
+        {"compare",   required_argument, 0, 1001},
+        {"threshold", required_argument, 0, 1002},
+        {"sf2wfb",    required_argument, 0, 1003},
+        {"gen",       required_argument, 0, 1004},
+        {"workdir",   required_argument, 0, 1005},
+        {"args",      required_argument, 0, 1006},
+        {"noise-ms",  required_argument, 0, 1007},
+        {"runs",      required_argument, 0, 'r'},
+        {"help",      no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    memset(&opts, 0, sizeof(opts));
+    opts.sf2wfb = "./sf2wfb";
+    opts.gen = "./sf2_gen";
+    opts.workdir = "macro_work";
+    opts.threshold = 10.0;
+    opts.noise_ms = 5.0;
+    opts.runs = 9;
+
+    while ((opt = getopt_long(argc, argv, "r:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 1000: opts.record = optarg; break;
+            case 1001: opts.compare = optarg; break;
+            case 1002: opts.threshold = atof(optarg); break;
+            case 1003: opts.sf2wfb = optarg; break;
+            case 1004: opts.gen = optarg; break;
+            case 1005: opts.workdir = optarg; break;
+            case 1006: opts.extra = optarg; break;
+            case 1007: opts.noise_ms = atof(optarg); break;
+            case 'r': opts.runs = atoi(optarg); break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (opts.runs < 1 || opts.runs > MACRO_MAX_RUNS || opts.threshold < 0 ||
+        opts.noise_ms < 0) {
+        fprintf(stderr, "Error: --runs must be 1-%d, --threshold and --noise-ms non-negative\n",
+                MACRO_MAX_RUNS);
+        return 1;
+    }
+
+    /* Load the baseline first so a bad path fails before the long run */
+    if (opts.compare &&
+        load_baseline(opts.compare, baseline, 64, &baseline_count) != 0) {
+        return 1;
+    }
+    if (mkdir(opts.workdir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Cannot create '%s': %s\n", opts.workdir, strerror(errno));
+        return 1;
+    }
+
+    printf("%-18s %10s %10s %12s %12s\n", "Workload", "wall ms", "cpu ms",
+           "peak RSS KiB", "output bytes");
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        if (run_workload(&workloads[i], &opts, &results[i]) != 0) {
+            fprintf(stderr, "Error: Workload '%s' failed\n", workloads[i].name);
+            return 1;
+        }
+        printf("%-18s %10.1f %10.1f %12lld %12lld\n", results[i].name, results[i].wall_ms,
+               results[i].cpu_ms, results[i].peak_rss_kb, results[i].output_bytes);
+        fflush(stdout);
+    }
+
+    if (opts.record && save_baseline(opts.record, results, WORKLOAD_COUNT) != 0) {
+        return 1;
+    }
+    if (opts.compare) {
+        printf("\n");
+        return compare_results(baseline, baseline_count, results, WORKLOAD_COUNT,
+                               &opts) ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,415 @@
+/*
+ * bench_micro.c - Micro-benchmarks for the converter's hot kernels
+ *
+ * Most kernels are static to converter.c, so this file includes it
+ * directly and links against every other object but converter.o and
+ * main.o. Inputs are generated from fixed seeds, so runs on different
+ * commits time exactly the same work.
+ *
+ * Usage: sf2wfb_bench [-r reps] [-m min_ms] [kernel...]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/converter.c"
+#include <unistd.h>
+
+#define BENCH_PCM_FRAMES     (512 * 1024)
+#define BENCH_RESAMPLE_FRAMES 65536
+#define BENCH_STORED_SAMPLES 256
+#define BENCH_STORED_FRAMES  4096
+#define BENCH_STATES         64
+#define BENCH_TIMES          1024
+#define BENCH_TABLES         64
+
+/* One benchmark: op(i) runs one iteration; bytes_per_op feeds the MB/s column */
+struct Bench {
+    const char *name;
+    int (*setup)(void);
+    void (*op)(long i);
+    void (*teardown)(void);
+    double bytes_per_op;
+};
+
+static volatile uint64_t bench_sink;     /* Keeps results live */
+static double bench_bytes;               /* Bytes per op; setup may override */
+static uint64_t bench_rng;
+
+static uint64_t bench_next(void) {
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return bench_rng * 2685821657736338717ULL;
+}
+
+static void bench_seed(uint64_t seed) {
+    bench_rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+/* Deterministic PCM: sawtooth plus noise, like sf2_gen */
+static void bench_fill_pcm(int16_t *pcm, uint32_t frames) {
+    for (uint32_t i = 0; i < frames; i++) {
+        pcm[i] = (int16_t)((int)((i * 37) % 16000) - 8000 + (int)(bench_next() % 101) - 50);
+    }
+}
+
+/* ---- hash_pcm_data ---- */
+
+static int16_t *hash_input;
+
+static int hash_setup(void) {
+    hash_input = malloc(BENCH_PCM_FRAMES * sizeof(int16_t));
+    if (!hash_input) {
+        return -1;
+    }
+    bench_seed(1);
+    bench_fill_pcm(hash_input, BENCH_PCM_FRAMES);
+    return 0;
+}
+
+static void hash_op(long i) {
+    (void)i;
+    bench_sink += hash_pcm_data(hash_input, BENCH_PCM_FRAMES);
+}
+
+static void hash_teardown(void) {
+    free(hash_input);
+}
+
+/* ---- resample_linear ---- */
+
+static int16_t *resample_input;
+
+static int resample_setup(void) {
+    resample_input = malloc(BENCH_RESAMPLE_FRAMES * sizeof(int16_t));
+    if (!resample_input) {
+        return -1;
+    }
+    bench_seed(2);
+    bench_fill_pcm(resample_input, BENCH_RESAMPLE_FRAMES);
+    return 0;
+}
+
+static void resample_op(long i) {
+    uint32_t frames;
+    int16_t *out;
+
+    (void)i;
+    out = resample_linear(resample_input, BENCH_RESAMPLE_FRAMES, 96000, 44100, &frames);
+    bench_sink += out ? (uint64_t)out[frames / 2] : 0;
+    mem_free(out);
+}
+
+static void resample_teardown(void) {
+    free(resample_input);
+}
+
+/* ---- materialise_sample dedup scan ---- */
+
+static struct WFBBank *dedup_bank;
+static struct PlanSlot dedup_slot;
+static int16_t *dedup_unique;            /* Same shape as the stored samples, new PCM */
+
+static int dedup_setup(void) {
+    dedup_bank = calloc(1, sizeof(*dedup_bank));
+    dedup_unique = mem_alloc(STAT_MEM_CONVERTED_PCM, BENCH_STORED_FRAMES * sizeof(int16_t));
+    if (!dedup_bank || !dedup_unique) {
+        return -1;
+    }
+    /* One spare slot for the entry dedup_miss_op stores and pops */
+    if (init_wfb_bank(dedup_bank, "Maui", WF_MAX_PROGRAMS, WF_MAX_PATCHES,
+                      BENCH_STORED_SAMPLES + 1) != 0) {
+        return -1;
+    }
+
+    memset(&dedup_slot, 0, sizeof(dedup_slot));
+    dedup_slot.kind = PLAN_SLOT_SAMPLE;
+    dedup_slot.source_rate = dedup_slot.rate = 44100;
+    dedup_slot.source_samples = dedup_slot.samples = BENCH_STORED_FRAMES;
+    dedup_slot.channel = WF_CH_MONO;
+    safe_string_copy(dedup_slot.name, "bench", NAME_LENGTH);
+
+    /* A bank of same-shaped samples, so every entry passes the metadata checks */
+    bench_seed(3);
+    for (int s = 0; s < BENCH_STORED_SAMPLES; s++) {
+        struct PreparedSample prepared;
+
+        prepared.pcm = mem_alloc(STAT_MEM_CONVERTED_PCM, BENCH_STORED_FRAMES * sizeof(int16_t));
+        if (!prepared.pcm) {
+            return -1;
+        }
+        bench_fill_pcm(prepared.pcm, BENCH_STORED_FRAMES);
+        prepared.hash = hash_pcm_data(prepared.pcm, BENCH_STORED_FRAMES);
+        if (materialise_sample(dedup_bank, &dedup_slot, &prepared) < 0) {
+            return -1;
+        }
+    }
+    bench_fill_pcm(dedup_unique, BENCH_STORED_FRAMES);
+    return 0;
+}
+
+/* Miss: scan every stored sample, then store; the new entry is popped again */
+static void dedup_miss_op(long i) {
+    struct PreparedSample prepared;
+    int idx;
+
+    prepared.pcm = dedup_unique;
+    prepared.hash = (uint64_t)i * 2 + 1;    /* Never matches a stored hash */
+    idx = materialise_sample(dedup_bank, &dedup_slot, &prepared);
+    dedup_bank->sample_count--;
+    dedup_bank->total_sample_memory -= dedup_bank->samples[idx].info.dwSizeInBytes;
+    dedup_bank->samples[idx].pcm_data = NULL;
+    bench_sink += (uint64_t)idx;
+}
+
+/* Hit: scan to the last stored sample, memcmp it and alias (includes a PCM copy) */
+static void dedup_hit_op(long i) {
+    struct PreparedSample prepared;
+    int last = BENCH_STORED_SAMPLES - 1;
+    int idx;
+
+    (void)i;
+    prepared.pcm = mem_alloc(STAT_MEM_CONVERTED_PCM, BENCH_STORED_FRAMES * sizeof(int16_t));
+    if (!prepared.pcm) {
+        return;
+    }
+    memcpy(prepared.pcm, dedup_bank->samples[last].pcm_data,
+           BENCH_STORED_FRAMES * sizeof(int16_t));
+    prepared.hash = dedup_bank->sample_keys[last].data_hash;
+    idx = materialise_sample(dedup_bank, &dedup_slot, &prepared);
+    dedup_bank->sample_count--;
+    dedup_bank->alias_count--;
+    bench_sink += (uint64_t)idx;
+}
+
+static void dedup_teardown(void) {
+    if (dedup_bank) {
+        free_wfb_bank(dedup_bank);
+    }
+    free(dedup_bank);
+    dedup_bank = NULL;
+    mem_free(dedup_unique);
+}
+
+/* ---- apply_sf2_state_to_patch ---- */
+
+static struct Sf2GenState patch_states[BENCH_STATES];
+
+static int patch_setup(void) {
+    bench_seed(4);
+    for (int s = 0; s < BENCH_STATES; s++) {
+        struct Sf2GenState *state = &patch_states[s];
+
+        sf2_gen_defaults(state);
+        state->attack_vol_env = (int16_t)(-(int)(bench_next() % 8000));
+        state->decay_vol_env = (int16_t)(bench_next() % 4000);
+        state->release_vol_env = (int16_t)(bench_next() % 6000) - 2000;
+        state->sustain_vol_env = (int16_t)(bench_next() % 1000);
+        state->attack_mod_env = (int16_t)(-(int)(bench_next() % 8000));
+        state->freq_mod_lfo = (int16_t)(bench_next() % 2000) - 1000;
+        state->initial_filter_fc = (int16_t)(6000 + bench_next() % 7500);
+        state->mod_env_to_filter_fc = (int16_t)(bench_next() % 2400);
+        state->initial_attenuation = (int16_t)(bench_next() % 400);
+        state->coarse_tune = (int16_t)(bench_next() % 5) - 2;
+    }
+    return 0;
+}
+
+static void patch_op(long i) {
+    struct PATCH patch;
+
+    memset(&patch, 0, sizeof(patch));
+    apply_sf2_state_to_patch(&patch, &patch_states[i % BENCH_STATES]);
+    bench_sink += (uint64_t)patch.nFreqBias + patch.fAmpBias;
+}
+
+/* ---- wf_time_from_seconds ---- */
+
+static float time_inputs[BENCH_TIMES];
+
+static int time_setup(void) {
+    /* Log-spaced from 1 ms to 30 s */
+    for (int t = 0; t < BENCH_TIMES; t++) {
+        time_inputs[t] = 0.001f * powf(30000.0f, (float)t / (BENCH_TIMES - 1));
+    }
+    return 0;
+}
+
+static void time_op(long i) {
+    bench_sink += wf_time_from_seconds(time_inputs[i % BENCH_TIMES]);
+}
+
+/* ---- count_unique_samples ---- */
+
+static int16_t unique_tables[BENCH_TABLES][NUM_MIDIKEYS];
+
+static int unique_setup(void) {
+    bench_seed(5);
+    for (int t = 0; t < BENCH_TABLES; t++) {
+        int splits = 1 + (int)(bench_next() % 16);
+
+        for (int k = 0; k < NUM_MIDIKEYS; k++) {
+            unique_tables[t][k] = (int16_t)(t * 7 + k * splits / NUM_MIDIKEYS);
+        }
+    }
+    return 0;
+}
+
+static void unique_op(long i) {
+    bench_sink += (uint64_t)count_unique_samples(unique_tables[i % BENCH_TABLES]);
+}
+
+/* ---- wfb_write ---- */
+
+static char write_path[64];
+
+static int write_setup(void) {
+    int fd;
+
+    /* Reuse the dedup bank: 256 stored 4096-frame samples, ~2 MB of PCM */
+    if (dedup_setup() != 0) {
+        return -1;
+    }
+    dedup_bank->program_count = WF_MAX_PROGRAMS;
+    dedup_bank->patch_count = WF_MAX_PATCHES;
+
+    snprintf(write_path, sizeof(write_path), "/tmp/sf2wfb_bench_XXXXXX");
+    fd = mkstemp(write_path);
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+    if (wfb_write(write_path, dedup_bank) != 0) {
+        return -1;
+    }
+    {
+        FILE *f = fopen(write_path, "rb");
+        if (!f) {
+            return -1;
+        }
+        fseek(f, 0, SEEK_END);
+        bench_bytes = (double)ftell(f);
+        fclose(f);
+    }
+    return 0;
+}
+
+static void write_op(long i) {
+    (void)i;
+    bench_sink += (uint64_t)wfb_write(write_path, dedup_bank);
+}
+
+static void write_teardown(void) {
+    unlink(write_path);
+    dedup_teardown();
+}
+
+static struct Bench benches[] = {
+    { "hash_pcm_data",      hash_setup,     hash_op,       hash_teardown,     BENCH_PCM_FRAMES * 2.0 },
+    { "resample_linear",    resample_setup, resample_op,   resample_teardown, BENCH_RESAMPLE_FRAMES * 2.0 },
+    { "dedup_miss",         dedup_setup,    dedup_miss_op, dedup_teardown,    0 },
+    { "dedup_hit",          dedup_setup,    dedup_hit_op,  dedup_teardown,    BENCH_STORED_FRAMES * 2.0 },
+    { "apply_state_to_patch", patch_setup,  patch_op,      NULL,              0 },
+    { "wf_time_from_seconds", time_setup,   time_op,       NULL,              0 },
+    { "count_unique_samples", unique_setup, unique_op,     NULL,              0 },
+    { "wfb_write",          write_setup,    write_op,      write_teardown,    0 }
+};
+
+#define BENCH_COUNT ((int)(sizeof(benches) / sizeof(benches[0])))
+
+/* Time `iterations` ops */
+static long long time_ops(const struct Bench *b, long iterations) {
+    long long start = stats_now_ns();
+    for (long i = 0; i < iterations; i++) {
+        b->op(i);
+    }
+    return stats_now_ns() - start;
+}
+
+static void run_bench(const struct Bench *b, int reps, long long min_ns) {
+    long iterations = 1;
+    double per_op[64] = { 0 };
+    double mean = 0.0;
+    double var = 0.0;
+    double best;
+
+    bench_bytes = b->bytes_per_op;
+    if (b->setup && b->setup() != 0) {
+        printf("%-22s setup failed\n", b->name);
+        if (b->teardown) {
+            b->teardown();
+        }
+        return;
+    }
+    /* Grow the iteration count until one repetition takes at least min_ns */
+    while (time_ops(b, iterations) < min_ns && iterations < (1L << 30)) {
+        iterations *= 2;
+    }
+
+    for (int r = 0; r < reps; r++) {
+        per_op[r] = (double)time_ops(b, iterations) / iterations;
+        mean += per_op[r];
+    }
+    mean /= reps;
+    best = per_op[0];
+    for (int r = 0; r < reps; r++) {
+        var += (per_op[r] - mean) * (per_op[r] - mean);
+        if (per_op[r] < best) {
+            best = per_op[r];
+        }
+    }
+    var /= reps > 1 ? reps - 1 : 1;
+
+    printf("%-22s %12.1f %12.1f %7.2f%%", b->name, mean, best,
+           mean > 0 ? 100.0 * sqrt(var) / mean : 0.0);
+    if (bench_bytes > 0) {
+        printf(" %10.1f", bench_bytes / mean * 1e9 / (1024.0 * 1024.0));
+    } else {
+        printf(" %10s", "-");
+    }
+    printf(" %10ld\n", iterations);
+
+    if (b->teardown) {
+        b->teardown();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int reps = 9;
+    long long min_ns = 50 * 1000000LL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:m:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 'm':
+                min_ns = atoll(optarg) * 1000000LL;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r reps] [-m min_ms] [kernel...]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (reps < 1 || reps > 64 || min_ns <= 0) {
+        fprintf(stderr, "Error: -r must be 1-64 and -m positive\n");
+        return 1;
+    }
+
+    printf("%-22s %12s %12s %8s %10s %10s\n", "Kernel", "ns/op", "best ns/op",
+           "stddev", "MB/s", "iters/rep");
+    for (int b = 0; b < BENCH_COUNT; b++) {
+        int selected = optind == argc;
+
+        for (int a = optind; a < argc; a++) {
+            if (strcmp(argv[a], benches[b].name) == 0) {
+                selected = 1;
+            }
+        }
+        if (selected) {
+            run_bench(&benches[b], reps, min_ns);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * arena.h - Bump allocator for per-conversion data
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include "stats.h"
+
+/* Default block size; larger requests get a block of their own */
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+struct ArenaBlock;
+
+/*
+ * Allocations are carved from large blocks and released all at once by
+ * arena_reset(), which keeps the standard-size blocks for the next
+ * conversion. Not thread-safe: use one arena per thread.
+ */
+struct Arena {
+    struct ArenaBlock *blocks;       /* Newest first */
+    size_t block_size;
+    struct ConversionStats *stats;   /* Stats the live allocations are charged to */
+    long long charged[STAT_MEM_COUNT];
+};
+
+void arena_init(struct Arena *arena, size_t block_size);
+
+/* Allocate size bytes charged to category; freed only by reset/destroy */
+void *arena_alloc(struct Arena *arena, enum StatMemory category, size_t size);
+void *arena_calloc(struct Arena *arena, enum StatMemory category, size_t count, size_t size);
+
+/* Release every allocation, keeping standard blocks for reuse */
+void arena_reset(struct Arena *arena);
+void arena_destroy(struct Arena *arena);
+
+/* The calling thread's conversion arena, created on first use */
+struct Arena *arena_thread(void);
+
+#endif /* ARENA_H */
@@ -9,6 +9,26 @@
 #include "sf2_types.h"
 #include <stdio.h>
 
+struct Arena;
+struct WFBVerifySummary;
+
+/* Totals of one conversion (or of its plan, for a dry run) */
+struct ConversionResult {
+    int program_count;
+    int patch_count;
+    int sample_count;
+    int alias_count;                 /* Deduplicated samples */
+    int multisample_count;
+    int resampled_count;
+    int samples_refused;             /* Left out at the 512 limit (dry run) */
+    int has_drumkit;
+    uint32_t memory_required;        /* Sample RAM the bank needs */
+    uint32_t file_size;              /* Planned WFB size (dry run), else 0 */
+};
+
+/* Bump whenever a change alters converted output; invalidates build manifests */
+#define SF2WFB_CONVERTER_VERSION 2
+
 /* Conversion options */
 struct ConversionOptions {
     const char *device_name;        /* Target device: Maui, Rio, Tropez, TropezPlus */
@@ -16,35 +36,134 @@ struct ConversionOptions {
     const char *output_file;        /* Explicit output filename */
     int patch_count;                /* Number of patches to apply */
     int verbose;                    /* Verbose logging */
+    int dry_run;                    /* Plan only, do not write output */
+    int threads;                    /* Worker threads; <= 1 runs serially */
+    const char *cache_dir;          /* Converted-sample cache, or NULL */
+    int stats_format;               /* STATS_* report after each file */
+    int output_format;              /* FORMAT_* of per-file results */
+    int write_index;                /* Keep a .idx record index beside each WFB */
+    struct WFBVerifySummary *verify; /* Deep-verify .wfb inputs into this, or NULL */
+    struct ConversionResult *result; /* Filled in by a conversion/preview, or NULL */
     struct {
         const char *file;           /* SF2 file for patch */
         int program_id;             /* Program ID to replace (0-127) */
     } patches[128];                 /* Max patches */
 };
 
-/* WFB Bank structure (in-memory representation) */
+/*
+ * Fields the dedup scan compares for every stored sample, kept apart from
+ * the sample records so the scan walks a small packed array
+ */
+struct WFBSampleKey {
+    uint64_t data_hash;              /* Hash of PCM data for dedup */
+    uint32_t rate;
+    uint32_t frames;
+    uint16_t type;                   /* WF_ST_* */
+    uint16_t channel;
+};
+
+/* One sample record as written to the file, plus its PCM */
+struct WFBSample {
+    struct WaveFrontExtendedSampleInfo info;
+    union {
+        struct SAMPLE sample;
+        struct MULTISAMPLE multisample;
+        struct ALIAS alias;
+    } data;
+    int16_t *pcm_data;               /* Raw sample data; a view into the mapping when read */
+};
+
+/*
+ * WFB Bank structure (in-memory representation). The tables are heap
+ * allocated by init_wfb_bank() with room for the counts given there and
+ * released, PCM included, by free_wfb_bank(). Banks from wfb_read() also
+ * hold the file mapping their pcm_data points into.
+ */
 struct WFBBank {
     struct WaveFrontFileHeader header;
-    struct WaveFrontProgram programs[WF_MAX_PROGRAMS];
+    struct WaveFrontProgram *programs;
     struct WaveFrontDrumkit drumkit;
-    struct WaveFrontPatch patches[WF_MAX_PATCHES];
-    struct {
-        struct WaveFrontExtendedSampleInfo info;
-        union {
-            struct SAMPLE sample;
-            struct MULTISAMPLE multisample;
-            struct ALIAS alias;
-        } data;
-        int16_t *pcm_data;           /* Raw sample data */
-        uint64_t data_hash;          /* Hash of PCM data for dedup */
-        char filespec[MAX_PATH_LENGTH];
-    } samples[WF_MAX_SAMPLES];
+    struct WaveFrontPatch *patches;
+    struct WFBSampleKey *sample_keys;    /* Parallel to samples */
+    struct WFBSample *samples;
 
+    int program_capacity;
+    int patch_capacity;
+    int sample_capacity;
     int program_count;
     int patch_count;
     int sample_count;
     int has_drumkit;
+    int alias_count;                 /* Samples stored as dedup aliases */
     uint32_t total_sample_memory;
+    void *map;                       /* File mapping from wfb_read(), or NULL */
+    size_t map_size;
+};
+
+/* Conversion plan slot kinds */
+#define PLAN_SLOT_SAMPLE      0      /* PCM sample drawn from the SF2 */
+#define PLAN_SLOT_MULTISAMPLE 1      /* Key-to-sample table */
+
+/* One WFB sample slot, decided without touching PCM */
+struct PlanSlot {
+    int kind;                        /* PLAN_SLOT_* */
+    int sf2_sample_idx;              /* Source sample (PLAN_SLOT_SAMPLE) */
+    int source;                      /* 0: the SF2 itself, n: plan overlay n-1 */
+    uint32_t source_rate;            /* Rate in the SF2 */
+    uint32_t source_samples;         /* Length in the SF2 */
+    uint32_t rate;                   /* Rate after resampling */
+    uint32_t samples;                /* Length after resampling */
+    uint32_t channel;                /* WF_CH_MONO/LEFT/RIGHT */
+    char name[NAME_LENGTH];
+    union {
+        struct SAMPLE sample;        /* Offsets scaled to planned length */
+        struct MULTISAMPLE multisample;
+    } data;
+};
+
+/* Layer usage of one planned program */
+struct PlanProgramStats {
+    int layers_wanted;               /* Layers its zone groups need */
+    int layers_used;                 /* Layers it got (4-layer/patch limits) */
+};
+
+/*
+ * Conversion plan: everything that goes into the bank (programs, drum kit,
+ * patches and sample slots) produced from the SF2 hydra alone. Materialising
+ * the plan copies/resamples PCM and resolves duplicate samples to aliases.
+ */
+#define PLAN_MAX_OVERLAYS (128 + 1)   /* -p files plus the -D drum kit */
+
+struct ConversionPlan {
+    struct WaveFrontProgram programs[WF_MAX_PROGRAMS];
+    struct WaveFrontDrumkit drumkit;
+    struct WaveFrontPatch patches[WF_MAX_PATCHES];
+    struct PlanSlot slots[WF_MAX_SAMPLES];
+    struct PlanProgramStats program_stats[WF_MAX_PROGRAMS];
+
+    int program_count;
+    int patch_count;
+    int slot_count;
+    int has_drumkit;
+    int resample_count;              /* Sample slots needing resampling */
+    int slots_refused;               /* Slots not planned: 512 limit hit */
+
+    /* Distinct -p/-D source files, hydra only; see plan_release_sources() */
+    struct SF2Bank *overlays[PLAN_MAX_OVERLAYS];
+    const char *overlay_paths[PLAN_MAX_OVERLAYS];
+    int overlay_count;
+};
+
+/* Exact output totals of a plan, resolved without materialising it */
+struct PlanEstimate {
+    int program_count;
+    int patch_count;
+    int sample_count;                /* All sample records */
+    int stored_samples;              /* Records carrying PCM */
+    int alias_count;                 /* Duplicates stored as aliases */
+    int multisample_count;
+    uint32_t memory_required;        /* Header dwMemoryRequired */
+    uint32_t file_size;              /* Size of the written WFB */
 };
 
 /* SF2 Bank structure (in-memory representation) */
@@ -71,33 +190,63 @@ struct SF2Bank {
     int inst_gen_count;
     int sample_count;
 
-    /* Sample data */
+    /* Sample data (NULL when opened with sf2_open_hydra) */
     int16_t *sample_data;
     uint32_t sample_data_size;
+    long sample_data_offset;         /* File offset of the smpl chunk data */
 
     /* File handle */
     FILE *file;
+
+    /* Arena holding the tables above and conversion scratch, or NULL */
+    struct Arena *arena;
 };
 
 /* Function prototypes */
 
 /* SF2 parsing */
 int sf2_open(const char *filename, struct SF2Bank *bank);
+int sf2_open_hydra(const char *filename, struct SF2Bank *bank);
+int sf2_open_stream(FILE *file, struct SF2Bank *bank, struct Arena *arena,
+                    int load_samples);
+int sf2_open_arena(const char *filename, struct SF2Bank *bank, struct Arena *arena,
+                   int load_samples);
 void sf2_close(struct SF2Bank *bank);
+int sf2_read_sample_pcm(struct SF2Bank *bank, int sample_idx, int16_t *dest);
 
 /* Conversion */
 int convert_sf2_to_wfb(const char *input_file, const char *output_file,
                        struct ConversionOptions *opts);
+int convert_sf2_to_bank(const char *input_file, const struct ConversionOptions *opts,
+                        struct WFBBank *wfb, int *resampled_count);
+int convert_sf2_stream_to_bank(FILE *input, const struct ConversionOptions *opts,
+                               struct WFBBank *wfb, int *resampled_count);
+int preview_sf2_conversion(const char *input_file, struct ConversionOptions *opts);
+int plan_conversion(struct SF2Bank *sf2, const struct ConversionOptions *opts,
+                    struct ConversionPlan *plan);
+void plan_release_sources(struct ConversionPlan *plan, struct SF2Bank *sf2);
+int materialise_plan(const struct ConversionPlan *plan, struct SF2Bank *sf2,
+                     struct WFBBank *wfb, const struct ConversionOptions *opts);
+int estimate_plan(const struct ConversionPlan *plan, struct SF2Bank *sf2,
+                  struct PlanEstimate *est);
 
 /* WFB file I/O */
 int wfb_write(const char *filename, struct WFBBank *bank);
+int wfb_write_stream(FILE *f, struct WFBBank *bank);
 int wfb_read(const char *filename, struct WFBBank *bank);
+void wfb_unmap(struct WFBBank *bank);
+uint32_t wfb_sample_struct_size(int16_t type);
+void wfb_update_header(struct WFBBank *bank);
 void wfb_print_info(struct WFBBank *bank);
 
 /* Resampling */
 int16_t *resample_linear(int16_t *input, uint32_t input_samples,
                          uint32_t input_rate, uint32_t output_rate,
                          uint32_t *output_samples);
+uint32_t resample_output_count(uint32_t input_samples, uint32_t input_rate,
+                               uint32_t output_rate);
+uint32_t resample_target_rate(uint32_t sample_rate);
+void resample_report_downsample(uint32_t sample_rate);
 void resample_set_sample_offset(struct SAMPLE_OFFSET *offset, double pos,
                                 uint32_t max_samples);
 void resample_scale_loop_points(uint32_t input_rate, uint32_t output_rate,
@@ -107,11 +256,16 @@ void resample_scale_loop_points(uint32_t input_rate, uint32_t output_rate,
                                 struct SAMPLE_OFFSET *out_end);
 int add_multisample_entry(struct WFBBank *wfb, const int16_t *sample_numbers,
                           int16_t sample_count, const char *name);
+int add_stored_sample(struct WFBBank *wfb, const struct WFBSample *sample);
+int get_patch_sample(const struct PATCH *patch);
+void set_patch_sample(struct PATCH *patch, int sample);
 
 /* Utility */
-const char *get_auto_increment_filename(const char *base_path);
+const char *get_auto_increment_filename(const char *base_path, char *buf, size_t buf_size);
 uint32_t get_device_memory_limit(const char *device_name);
 int is_valid_device_name(const char *name);
-void init_wfb_bank(struct WFBBank *bank, const char *device_name);
+int init_wfb_bank(struct WFBBank *bank, const char *device_name,
+                  int programs, int patches, int samples);
+void free_wfb_bank(struct WFBBank *bank);
 
 #endif /* CONVERTER_H */
@@ -0,0 +1,61 @@
+/*
+ * logging.h - Console output with optional per-thread capture
+ */
+
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Output captured from one thread, replayed later in one piece */
+struct LogCapture {
+    FILE *out_stream;
+    FILE *err_stream;
+    char *out;                       /* Captured stdout text */
+    size_t out_len;
+    char *err;                       /* Captured stderr text */
+    size_t err_len;
+    struct LogCapture *prev;         /* Capture this one nests inside, if any */
+};
+
+/* printf()/fprintf(stderr) replacements honouring the calling thread's capture */
+int log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int log_errorf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*
+ * Escape s for the inside of a JSON string into dest, stopping before an
+ * escape that would not fit. Bytes above 0x7F are taken as Latin-1, as SF2
+ * names are, and written as \u00XX. Returns the length written.
+ */
+size_t log_json_escape(const char *s, char *dest, size_t dest_size);
+
+/* Write s as a quoted, escaped JSON string through log_printf() */
+void log_json_string(const char *s);
+
+/*
+ * Route the calling thread's log_printf()/log_errorf() output into cap
+ * until log_capture_end(), which hands output back to any enclosing
+ * capture. Returns -1 (output stays uncaptured) on failure.
+ */
+int log_capture_begin(struct LogCapture *cap);
+void log_capture_end(struct LogCapture *cap);
+
+/*
+ * The calling thread's capture (NULL: none), and adopting one on another
+ * thread, so pool workers log into their submitter's capture
+ */
+struct LogCapture *log_capture_current(void);
+void log_capture_set_current(struct LogCapture *cap);
+
+/* Write captured text to stdout/stderr and release it */
+void log_capture_flush(struct LogCapture *cap);
+
+/*
+ * Copy the last captured line starting with prefix (stderr text first,
+ * then stdout) into dest. Returns 0 when there is none.
+ */
+int log_capture_last_line(const struct LogCapture *cap, const char *prefix,
+                          char *dest, size_t dest_size);
+
+#endif /* LOGGING_H */
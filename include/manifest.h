@@ -0,0 +1,57 @@
+/*
+ * manifest.h - Build manifest for incremental rebuilds
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct ConversionOptions;
+
+/* One file a conversion read, as it was when the output was written */
+struct ManifestInput {
+    char *path;
+    long long size;
+    long long mtime_ns;
+    uint64_t hash;                   /* Content hash, checked when size/mtime moved */
+};
+
+/* How one output WFB was produced */
+struct ManifestEntry {
+    char *output;
+    int version;                     /* SF2WFB_CONVERTER_VERSION at the time */
+    uint64_t options_hash;           /* Output-affecting options */
+    struct ManifestInput *inputs;    /* Main SF2, then -D and -p sources */
+    int input_count;
+};
+
+/* Manifest file contents; safe to query and update from several threads */
+struct Manifest {
+    const char *path;
+    struct ManifestEntry *entries;
+    int entry_count;
+    int entry_capacity;
+    int dirty;
+    pthread_mutex_t lock;
+};
+
+/* Load a manifest; a missing file gives an empty one */
+int manifest_load(struct Manifest *m, const char *path);
+int manifest_save(struct Manifest *m);
+void manifest_free(struct Manifest *m);
+
+/*
+ * Whether output exists and was built from these exact inputs and options
+ * by this converter version. Inputs whose size or mtime changed are
+ * re-hashed, so a touched but unchanged file does not force a rebuild.
+ */
+int manifest_is_current(struct Manifest *m, const char *output, const char *input,
+                        const struct ConversionOptions *opts);
+
+/* Record that output was just built from input with opts */
+int manifest_record(struct Manifest *m, const char *output, const char *input,
+                    const struct ConversionOptions *opts);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,23 @@
+/*
+ * memtrack.h - Allocation wrappers that account memory by category
+ */
+
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <stddef.h>
+#include "stats.h"
+
+/*
+ * Allocate size bytes charged to category in the calling thread's current
+ * stats (see stats_set_current()). Blocks must be released with mem_free(),
+ * never free(); the charge goes back to the stats it was made against.
+ */
+void *mem_alloc(enum StatMemory category, size_t size);
+void *mem_calloc(enum StatMemory category, size_t count, size_t size);
+void mem_free(void *ptr);
+
+/* Move a block's charge to another category, e.g. when PCM is kept as-is */
+void mem_retag(void *ptr, enum StatMemory category);
+
+#endif /* MEMTRACK_H */
@@ -0,0 +1,34 @@
+/*
+ * merge.h - Combine programs from several banks into one WFB
+ */
+
+#ifndef MERGE_H
+#define MERGE_H
+
+#include "converter.h"
+
+/* One merge input and what to take from it */
+struct MergeSource {
+    char path[1024];                 /* .wfb, or .sf2 converted on the fly */
+    uint8_t programs[WF_MAX_PROGRAMS];   /* Nonzero: take this program number */
+    int drums;                       /* Take the drum kit */
+};
+
+/*
+ * Parse "path[:selection]". The selection is a comma list of program
+ * numbers, ranges (0-7) and "drums"; without one, everything is taken.
+ */
+int merge_parse_source(const char *arg, struct MergeSource *source);
+
+/*
+ * Write one bank holding the selected programs and drum kit. A program
+ * number taken from several sources comes from the last. Only patches and
+ * samples those programs use are copied, renumbered, and samples identical
+ * across sources are stored once. .wfb sources are read through their
+ * record index, so only those records are read; opts->write_index keeps
+ * the .idx sidecar for later merges.
+ */
+int merge_banks(const struct MergeSource *sources, int count, const char *output,
+                const struct ConversionOptions *opts);
+
+#endif /* MERGE_H */
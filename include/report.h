@@ -0,0 +1,32 @@
+/*
+ * report.h - Machine-readable per-file results (--format json)
+ */
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "converter.h"
+#include "stats.h"
+#include "viability.h"
+
+/* Output formats */
+#define FORMAT_TEXT 0
+#define FORMAT_JSON 1
+
+/* Everything known about one input once it has been processed */
+struct FileReport {
+    const char *file;
+    char output[512];                /* Output path, or "" */
+    const char *status;              /* converted, planned, up_to_date, ok, failed */
+    char error[256];                 /* Last error line, or "" */
+    int assessed;                    /* viability holds a report */
+    struct ViabilityReport viability;
+    int has_result;                  /* result holds conversion totals */
+    struct ConversionResult result;
+    struct ConversionStats stats;
+};
+
+/* Write report as one line of JSON (a JSON Lines record) */
+void file_report_print_json(const struct FileReport *report);
+
+#endif /* REPORT_H */
@@ -0,0 +1,51 @@
+/*
+ * sample_cache.h - Persistent cache of converted sample PCM
+ */
+
+#ifndef SAMPLE_CACHE_H
+#define SAMPLE_CACHE_H
+
+#include "wfb_types.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Only 16-bit linear PCM is produced today */
+#define SAMPLE_CACHE_ENCODING_PCM16 0
+
+/*
+ * Everything a converted sample depends on. Entries are content-addressed
+ * by a hash of this key, so a changed source or setting simply misses.
+ * Zero the key before filling it: it is hashed and compared bytewise.
+ */
+struct SampleCacheKey {
+    uint64_t source_hash;            /* Hash of the source PCM */
+    uint32_t source_rate;
+    uint32_t source_samples;
+    uint32_t rate;                   /* Target rate */
+    uint32_t samples;                /* Target length */
+    uint32_t encoding;               /* SAMPLE_CACHE_ENCODING_* */
+    struct SAMPLE sample;            /* Trim and loop offsets */
+};
+
+/* A cache directory shared by every thread of a run */
+struct SampleCache {
+    const char *dir;
+    atomic_int hits;
+    atomic_int misses;
+    atomic_int stores;
+};
+
+int sample_cache_open(struct SampleCache *cache, const char *dir);
+
+/*
+ * Look up a converted sample. On a hit returns 0 with *pcm (key->samples
+ * frames, caller mem_frees) and its output hash; returns -1 on a miss.
+ */
+int sample_cache_load(struct SampleCache *cache, const struct SampleCacheKey *key,
+                      int16_t **pcm, uint64_t *pcm_hash);
+
+/* Store a converted sample; failures only cost a later miss */
+void sample_cache_store(struct SampleCache *cache, const struct SampleCacheKey *key,
+                        const int16_t *pcm, uint64_t pcm_hash);
+
+#endif /* SAMPLE_CACHE_H */
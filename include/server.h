@@ -0,0 +1,27 @@
+/*
+ * server.h - Conversion daemon on a local UNIX socket
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "converter.h"
+
+/*
+ * Serve conversion requests on socket_path until SIGINT/SIGTERM, with
+ * `workers` conversions in flight. One request per connection: a line of
+ * tab-separated fields
+ *
+ *     convert<TAB>input=PATH<TAB>output=PATH[<TAB>device=NAME][<TAB>threads=N]
+ *
+ * answered by "ok key=value ...\n" or "error code=N message\n". The input
+ * may instead arrive as a descriptor passed with the request (SCM_RIGHTS,
+ * no input= field), and output=- sends the WFB back after the "ok" line,
+ * its length given by bytes=. defaults supplies device, threads and the
+ * sample cache directory, which stays warm across requests. A client that
+ * sends no request within 10 seconds is dropped. An existing socket_path is
+ * replaced only if it is a stale socket.
+ */
+int server_run(const char *socket_path, const struct ConversionOptions *defaults, int workers);
+
+#endif /* SERVER_H */
@@ -0,0 +1,83 @@
+/*
+ * sf2wfb.h - Embeddable SF2 to WFB conversion (libsf2wfb)
+ *
+ * Every call is reentrant: concurrent conversions on different threads
+ * share no state. Nothing is printed; failures come back as SF2WFB_E_*
+ * codes with the converter's message in SF2WFBResult.message.
+ */
+
+#ifndef SF2WFB_H
+#define SF2WFB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Exported from the shared library, which hides everything else */
+#if defined(__GNUC__)
+#define SF2WFB_API __attribute__((visibility("default")))
+#else
+#define SF2WFB_API
+#endif
+
+/* Status codes returned by every conversion call */
+#define SF2WFB_OK              0
+#define SF2WFB_E_INVALID      -1    /* Bad argument or device name */
+#define SF2WFB_E_NOMEM        -2    /* Out of memory */
+#define SF2WFB_E_IO           -3    /* Input unreadable or sink refused output */
+#define SF2WFB_E_FORMAT       -4    /* Input is not a usable SF2 */
+#define SF2WFB_E_CONVERT      -5    /* Conversion failed */
+
+/* Conversion settings; a NULL options pointer means all defaults */
+struct SF2WFBOptions {
+    const char *device;             /* Maui (default), Rio, Tropez, TBS-2001 */
+    int threads;                    /* Worker threads; <= 1 runs serially */
+    const char *cache_dir;          /* Converted-sample cache, or NULL */
+};
+
+/* What a conversion produced */
+struct SF2WFBResult {
+    int program_count;
+    int patch_count;
+    int sample_count;
+    int alias_count;                /* Deduplicated samples */
+    int resampled_count;
+    int has_drumkit;
+    uint32_t memory_required;       /* Sample RAM the bank needs */
+    uint32_t memory_limit;          /* Sample RAM of the target device */
+    size_t wfb_size;                /* Bytes of WFB output */
+    char message[256];              /* Last error/warning text, or "" */
+};
+
+/* Receives WFB output in order; return non-zero to abort the conversion */
+typedef int (*SF2WFBSink)(void *user, const void *data, size_t size);
+
+/*
+ * Convert an SF2 held in memory. The WFB is returned in a buffer the
+ * caller releases with sf2wfb_free(). result may be NULL.
+ */
+SF2WFB_API int sf2wfb_convert_buffer(const void *sf2_data, size_t sf2_size,
+                                     const struct SF2WFBOptions *opts,
+                                     void **wfb_data, size_t *wfb_size,
+                                     struct SF2WFBResult *result);
+
+/* Convert an SF2 held in memory, streaming the WFB to sink */
+SF2WFB_API int sf2wfb_convert_buffer_to_sink(const void *sf2_data, size_t sf2_size,
+                                             const struct SF2WFBOptions *opts,
+                                             SF2WFBSink sink, void *user,
+                                             struct SF2WFBResult *result);
+
+/* As above, reading the SF2 from a seekable descriptor (left open) */
+SF2WFB_API int sf2wfb_convert_fd(int fd, const struct SF2WFBOptions *opts,
+                                 void **wfb_data, size_t *wfb_size,
+                                 struct SF2WFBResult *result);
+SF2WFB_API int sf2wfb_convert_fd_to_sink(int fd, const struct SF2WFBOptions *opts,
+                                         SF2WFBSink sink, void *user,
+                                         struct SF2WFBResult *result);
+
+/* Release a buffer returned by sf2wfb_convert_buffer()/sf2wfb_convert_fd() */
+SF2WFB_API void sf2wfb_free(void *wfb_data);
+
+/* Short description of a status code */
+SF2WFB_API const char *sf2wfb_strerror(int status);
+
+#endif /* SF2WFB_H */
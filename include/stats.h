@@ -0,0 +1,95 @@
+/*
+ * stats.h - Phase timings and counters for --stats
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Report formats */
+#define STATS_NONE  0
+#define STATS_TABLE 1
+#define STATS_JSON  2
+
+/* Timed phases */
+enum StatPhase {
+    STAT_PARSE_SAMPLES,              /* parse_sample_data() */
+    STAT_PARSE_HYDRA,                /* parse_hydra() */
+    STAT_ASSESS,                     /* Viability assessment */
+    STAT_PLAN_PRESETS,               /* Melodic preset planning */
+    STAT_PLAN_DRUMKIT,               /* Drum kit planning */
+    STAT_SAMPLE_COPY,                /* Source PCM extraction */
+    STAT_SAMPLE_CACHE,               /* Sample cache lookups/stores */
+    STAT_SAMPLE_RESAMPLE,            /* Rate conversion */
+    STAT_SAMPLE_HASH,                /* PCM hashing */
+    STAT_SAMPLE_DEDUP,               /* Duplicate search and aliasing */
+    STAT_WRITE,                      /* wfb_write() */
+    STAT_PHASE_COUNT
+};
+
+/* Event counters */
+enum StatCounter {
+    STAT_BYTES_READ,
+    STAT_BYTES_WRITTEN,
+    STAT_DEDUP_HITS,                 /* Samples stored as aliases */
+    STAT_MEMCMP_CALLS,               /* Full PCM comparisons during dedup */
+    STAT_RESAMPLE_FRAMES,            /* Frames produced by resampling */
+    STAT_COUNTER_COUNT
+};
+
+/* Memory categories charged by the memtrack.h wrappers */
+enum StatMemory {
+    STAT_MEM_HYDRA,                  /* Parsed preset/instrument/sample tables */
+    STAT_MEM_SOURCE_PCM,             /* smpl chunk and per-sample source copies */
+    STAT_MEM_CONVERTED_PCM,          /* PCM at its output rate, bound for the bank */
+    STAT_MEM_TABLES,                 /* Plans, maps and per-job scratch tables */
+    STAT_MEM_COUNT
+};
+
+/*
+ * Statistics of one conversion. Phase times are summed over every thread
+ * that worked on it, so with -t they can exceed the wall time.
+ */
+struct ConversionStats {
+    atomic_llong phase_ns[STAT_PHASE_COUNT];
+    atomic_llong phase_calls[STAT_PHASE_COUNT];
+    atomic_llong counters[STAT_COUNTER_COUNT];
+    atomic_llong mem_current[STAT_MEM_COUNT];
+    atomic_llong mem_peak[STAT_MEM_COUNT];
+    atomic_llong mem_total;          /* All categories together */
+    atomic_llong mem_total_peak;
+    long long wall_ns;               /* Whole file, set by the caller */
+    long long peak_rss;              /* Process high-water mark, set by the caller */
+};
+
+void stats_init(struct ConversionStats *stats);
+
+/*
+ * Statistics collection is per thread: instrumented code records into the
+ * calling thread's current stats, and does nothing while there are none.
+ * Pool jobs adopt the submitting thread's stats explicitly.
+ */
+void stats_set_current(struct ConversionStats *stats);
+struct ConversionStats *stats_current(void);
+
+/* Monotonic clock in nanoseconds */
+long long stats_now_ns(void);
+
+/* Bracket a phase: start = stats_phase_begin(); ...; stats_phase_end(phase, start) */
+long long stats_phase_begin(void);
+void stats_phase_end(enum StatPhase phase, long long start);
+void stats_count(enum StatCounter counter, long long amount);
+
+/* Charge (or with a negative delta, release) tracked memory; stats may be NULL */
+void stats_mem_change(struct ConversionStats *stats, enum StatMemory category,
+                      long long delta);
+
+/* Peak resident set size of the whole process so far, in bytes */
+long long stats_peak_rss(void);
+
+void stats_print(const struct ConversionStats *stats, const char *label, int format);
+void stats_print_json_fields(const struct ConversionStats *stats);
+
+#endif /* STATS_H */
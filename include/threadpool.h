@@ -0,0 +1,32 @@
+/*
+ * threadpool.h - Fixed-size worker pool for data-parallel loops
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+struct ThreadPool;
+
+/* Loop body: called once per index, from any thread */
+typedef void (*parallel_fn)(void *arg, int index);
+
+/*
+ * Create a pool running `threads` loops in parallel (the calling thread
+ * counts as one). threads <= 1 gives a pool that runs everything inline.
+ */
+struct ThreadPool *threadpool_create(int threads);
+void threadpool_destroy(struct ThreadPool *pool);
+int threadpool_size(const struct ThreadPool *pool);
+
+/*
+ * Run fn(arg, i) for i in [0, count). Idle threads claim the next index as
+ * they finish, so uneven items balance out. Returns when all are done.
+ * A NULL pool runs the loop serially.
+ */
+void threadpool_parallel_for(struct ThreadPool *pool, int count,
+                             parallel_fn fn, void *arg);
+
+/* Resolve a thread-count option: 0 means one per online CPU */
+int threadpool_resolve_count(int requested);
+
+#endif /* THREADPOOL_H */
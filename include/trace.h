@@ -0,0 +1,21 @@
+/*
+ * trace.h - Chrome/Perfetto trace-event output for --trace
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Start recording spans from every thread; written out by trace_close() */
+int trace_open(const char *path);
+int trace_close(void);
+
+/*
+ * Bracket a span: start = trace_begin(); ...; trace_end(start, name, fmt, ...)
+ * While tracing is off, trace_begin() returns 0 and trace_end() returns at
+ * once without formatting its detail.
+ */
+long long trace_begin(void);
+void trace_end(long long start, const char *name, const char *detail_fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif /* TRACE_H */
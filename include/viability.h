@@ -37,9 +37,18 @@ struct ViabilityReport {
     /* Sample budget (ONLY samples used by Bank 0/128 after truncation) */
     int total_samples_in_sf2;
     int samples_referenced_by_gm;       /* Before truncation */
-    int samples_after_truncation;       /* After 4-layer limit */
+    int samples_after_truncation;       /* WFB sample records needed */
     int samples_unused;                 /* Never referenced */
 
+    /* Exact output of the converter's plan (grouping + dedup) */
+    int planned_patches;
+    int planned_samples;                /* Records that fit (<= 512) */
+    int planned_stored_samples;         /* Records carrying PCM */
+    int planned_aliases;                /* Duplicates stored as aliases */
+    int planned_multisamples;
+    int samples_over_limit;             /* Not converted: 512 limit */
+    uint32_t memory_required;           /* Output dwMemoryRequired */
+
     /* Layer truncation analysis */
     int total_programs;                 /* Should be 128 melodic + 1 drum */
     int programs_with_truncation;       /* Programs losing layers */
@@ -70,11 +79,14 @@ struct ViabilityReport {
     int suggestion_count;
 };
 
+struct ConversionOptions;
+
 /* Assessment configuration */
 struct ViabilityConfig {
     int verbose;        /* 0=summary, 1=detailed */
     int interactive;    /* Prompt user if warnings */
     int auto_yes;       /* Skip prompt, always proceed */
+    const struct ConversionOptions *conversion;  /* Options to plan with (may be NULL) */
 };
 
 /* Function prototypes */
@@ -0,0 +1,23 @@
+/*
+ * watch.h - Convert files dropped into a directory (--watch)
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+/* How long a file must stay unwritten before it is converted */
+#define WATCH_DEBOUNCE_MS 500
+
+/* Receives each set of settled files, oldest first; paths are freed afterwards */
+typedef void (*watch_fn)(void *arg, char **paths, int count);
+
+/*
+ * Watch dir until SIGINT/SIGTERM. A file whose name ends in ext (any case)
+ * is handed to fn once a write to it has closed, or it was renamed into
+ * dir, and nothing touched it for WATCH_DEBOUNCE_MS; rewrites within that
+ * window restart the wait, so a file is converted once per burst. Needs
+ * inotify (Linux).
+ */
+int watch_directory(const char *dir, const char *ext, watch_fn fn, void *arg);
+
+#endif /* WATCH_H */
@@ -0,0 +1,54 @@
+/*
+ * wfb_index.h - Record offset index for WFB files
+ */
+
+#ifndef WFB_INDEX_H
+#define WFB_INDEX_H
+
+#include "converter.h"
+#include <stdio.h>
+
+/*
+ * Where every record of a WFB file starts. Programs and patches are fixed
+ * size tables; samples are variable length, so their offsets are stored.
+ */
+struct WFBIndex {
+    struct WaveFrontFileHeader header;
+    uint32_t *sample_offsets;        /* File offset of each sample record */
+    int sample_count;
+    long long source_size;           /* WFB file as it was when indexed */
+    long long source_mtime_ns;
+};
+
+/* Walk the file's sample records (headers only) and index them */
+int wfb_index_build(const char *filename, struct WFBIndex *index);
+
+/*
+ * Sidecar index "<filename>.idx". Loading fails, quietly, when the sidecar
+ * is missing or the WFB changed since it was written.
+ */
+int wfb_index_load(const char *filename, struct WFBIndex *index);
+int wfb_index_save(const char *filename, const struct WFBIndex *index);
+
+/* Load the sidecar if current, else build the index (and save it if asked) */
+int wfb_index_open(const char *filename, struct WFBIndex *index, int save_sidecar);
+void wfb_index_free(struct WFBIndex *index);
+
+/* File offsets of record n, or 0 when out of range */
+uint32_t wfb_index_program_offset(const struct WFBIndex *index, int n);
+uint32_t wfb_index_patch_offset(const struct WFBIndex *index, int n);
+uint32_t wfb_index_sample_offset(const struct WFBIndex *index, int n);
+
+/* Read single records from an open WFB file with one seek each */
+int wfb_index_read_program(FILE *f, const struct WFBIndex *index, int n,
+                           struct WaveFrontProgram *program);
+int wfb_index_read_patch(FILE *f, const struct WFBIndex *index, int n,
+                         struct WaveFrontPatch *patch);
+int wfb_index_read_drumkit(FILE *f, const struct WFBIndex *index,
+                           struct WaveFrontDrumkit *drumkit);
+
+/* Read sample n; embedded PCM is loaded into pcm_data (caller mem_frees) */
+int wfb_index_read_sample(FILE *f, const struct WFBIndex *index, int n,
+                          struct WFBSample *sample);
+
+#endif /* WFB_INDEX_H */
@@ -0,0 +1,51 @@
+/*
+ * wfb_verify.h - Deep consistency check of WFB files
+ */
+
+#ifndef WFB_VERIFY_H
+#define WFB_VERIFY_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+/* What wfb_verify() found in one file */
+struct WFBVerifyReport {
+    int readable;                    /* 0 when the file could not be loaded at all */
+    int errors;                      /* Broken references, layout or totals */
+    int warnings;                    /* Suspicious but loadable */
+    int program_count;
+    int patch_count;
+    int sample_count;
+    uint32_t memory_required;        /* Recomputed from the stored samples */
+};
+
+/*
+ * Check every cross-reference (program layers and drums to patches,
+ * patches to samples, multisample tables, alias targets), the record
+ * layout and dwSize chain, and dwMemoryRequired. Errors are always
+ * logged, warnings only when verbose. Returns 0 when there are no errors.
+ */
+int wfb_verify(const char *filename, struct WFBVerifyReport *report, int verbose);
+
+/* Per-file results of a run, shared by the threads verifying files */
+struct WFBVerifyResult {
+    char *path;
+    struct WFBVerifyReport report;
+};
+
+struct WFBVerifySummary {
+    struct WFBVerifyResult *results;
+    int count;
+    int capacity;
+    pthread_mutex_t lock;
+};
+
+void wfb_verify_summary_init(struct WFBVerifySummary *summary);
+void wfb_verify_summary_add(struct WFBVerifySummary *summary, const char *path,
+                            const struct WFBVerifyReport *report);
+
+/* Print the summary table: every file when verbose, else only files with problems */
+void wfb_verify_summary_print(struct WFBVerifySummary *summary, int verbose);
+void wfb_verify_summary_free(struct WFBVerifySummary *summary);
+
+#endif /* WFB_VERIFY_H */
@@ -0,0 +1,151 @@
+/*
+ * arena.c - Bump allocator for per-conversion data
+ *
+ * A batch converts many files in one process; drawing each file's hydra,
+ * sample data and tables from a reused arena avoids a malloc/free per
+ * table and keeps the heap from fragmenting between files.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/arena.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+};
+
+/* Payload alignment, and the offset of the first payload byte in a block */
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(struct ArenaBlock))
+
+void arena_init(struct Arena *arena, size_t block_size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+static struct ArenaBlock *arena_new_block(struct Arena *arena, size_t size) {
+    struct ArenaBlock *block = malloc(ARENA_HEADER + size);
+
+    if (!block) {
+        return NULL;
+    }
+    block->size = size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return block;
+}
+
+void *arena_alloc(struct Arena *arena, enum StatMemory category, size_t size) {
+    struct ArenaBlock *block;
+    size_t rounded;
+
+    if (size > (size_t)-1 - ARENA_HEADER - ARENA_ALIGN) {
+        return NULL;
+    }
+    rounded = ARENA_ROUND(size ? size : 1);
+
+    /* Look for room in a kept block before growing */
+    for (block = arena->blocks; block; block = block->next) {
+        if (block->size - block->used >= rounded) {
+            break;
+        }
+    }
+    if (!block) {
+        block = arena_new_block(arena, rounded > arena->block_size ? rounded : arena->block_size);
+        if (!block) {
+            return NULL;
+        }
+    }
+
+    void *ptr = (char *)block + ARENA_HEADER + block->used;
+    block->used += rounded;
+
+    if (!arena->stats) {
+        arena->stats = stats_current();
+    }
+    arena->charged[category] += (long long)size;
+    stats_mem_change(arena->stats, category, (long long)size);
+    return ptr;
+}
+
+void *arena_calloc(struct Arena *arena, enum StatMemory category, size_t count, size_t size) {
+    void *ptr;
+
+    if (size != 0 && count > (size_t)-1 / size) {
+        return NULL;
+    }
+    ptr = arena_alloc(arena, category, count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void arena_reset(struct Arena *arena) {
+    struct ArenaBlock **link = &arena->blocks;
+
+    for (int i = 0; i < STAT_MEM_COUNT; i++) {
+        stats_mem_change(arena->stats, (enum StatMemory)i, -arena->charged[i]);
+        arena->charged[i] = 0;
+    }
+    arena->stats = NULL;
+
+    /* Oversized blocks held one large table each; give them back */
+    while (*link) {
+        struct ArenaBlock *block = *link;
+        if (block->size > arena->block_size) {
+            *link = block->next;
+            free(block);
+        } else {
+            block->used = 0;
+            link = &block->next;
+        }
+    }
+}
+
+void arena_destroy(struct Arena *arena) {
+    arena_reset(arena);
+    while (arena->blocks) {
+        struct ArenaBlock *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+}
+
+static pthread_key_t thread_arena_key;
+static pthread_once_t thread_arena_once = PTHREAD_ONCE_INIT;
+
+static void thread_arena_free(void *ptr) {
+    arena_destroy(ptr);
+    free(ptr);
+}
+
+static void thread_arena_key_init(void) {
+    pthread_key_create(&thread_arena_key, thread_arena_free);
+}
+
+struct Arena *arena_thread(void) {
+    struct Arena *arena;
+
+    pthread_once(&thread_arena_once, thread_arena_key_init);
+    arena = pthread_getspecific(thread_arena_key);
+    if (!arena) {
+        arena = malloc(sizeof(*arena));
+        if (!arena) {
+            return NULL;
+        }
+        arena_init(arena, ARENA_BLOCK_SIZE);
+        if (pthread_setspecific(thread_arena_key, arena) != 0) {
+            free(arena);
+            return NULL;
+        }
+    }
+    return arena;
+}
@@ -2,7 +2,14 @@
  * converter.c - SF2 to WFB conversion logic
  */
 
+#include "../include/arena.h"
 #include "../include/converter.h"
+#include "../include/logging.h"
+#include "../include/memtrack.h"
+#include "../include/sample_cache.h"
+#include "../include/stats.h"
+#include "../include/trace.h"
+#include "../include/threadpool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,8 +18,6 @@
 /* Forward declarations */
 extern uint16_t swap16(uint16_t val);
 extern void safe_string_copy(char *dest, const char *src, size_t dest_size);
-extern int resample_to_44100_if_needed(int16_t **data, uint32_t *sample_count,
-                                       uint32_t *sample_rate);
 extern struct sfPresetHeader *sf2_get_preset(struct SF2Bank *bank, int bank_num, int preset_num);
 extern struct sfPresetHeader *sf2_get_first_preset(struct SF2Bank *bank);
 
@@ -20,10 +25,12 @@ static uint64_t hash_pcm_data(const int16_t *data, uint32_t samples) {
     const uint8_t *bytes = (const uint8_t *)data;
     uint64_t hash = 1469598103934665603ULL;
     uint32_t total_bytes = samples * sizeof(int16_t);
+    long long start = stats_phase_begin();
     for (uint32_t i = 0; i < total_bytes; i++) {
         hash ^= bytes[i];
         hash *= 1099511628211ULL;
     }
+    stats_phase_end(STAT_SAMPLE_HASH, start);
     return hash;
 }
 
@@ -31,9 +38,30 @@ static int sample_offsets_equal(const struct SAMPLE_OFFSET *a, const struct SAMP
     return a->fInteger == b->fInteger && a->fFraction == b->fFraction;
 }
 
+/*
+ * Per-conversion tables come from the source bank's arena when it has one
+ * (released together by arena_reset), otherwise from the tracked heap
+ */
+static void *conv_alloc(struct SF2Bank *sf2, size_t size) {
+    return sf2->arena ? arena_alloc(sf2->arena, STAT_MEM_TABLES, size) :
+                        mem_alloc(STAT_MEM_TABLES, size);
+}
+
+static void *conv_calloc(struct SF2Bank *sf2, size_t count, size_t size) {
+    return sf2->arena ? arena_calloc(sf2->arena, STAT_MEM_TABLES, count, size) :
+                        mem_calloc(STAT_MEM_TABLES, count, size);
+}
+
+static void conv_free(struct SF2Bank *sf2, void *ptr) {
+    if (!sf2->arena) {
+        mem_free(ptr);
+    }
+}
+
 /* Conversion context to avoid global state */
 struct ConversionContext {
-    int dedupe_alias_count;
+    struct SF2Bank *sf2;
+    int source;                 /* PlanSlot.source of the slots it plans */
     int patch_reserve;
     int *sf2_sample_map;
     int sf2_sample_map_count;
@@ -41,13 +69,16 @@ struct ConversionContext {
 };
 
 /* Initialize conversion context */
-static void init_conversion_context(struct ConversionContext *ctx, int sample_count, int verbose) {
-    ctx->dedupe_alias_count = 0;
+static void init_conversion_context(struct ConversionContext *ctx, struct SF2Bank *sf2, int verbose) {
+    int sample_count = sf2->sample_count;
+
+    ctx->sf2 = sf2;
+    ctx->source = 0;
     ctx->patch_reserve = 0;
     ctx->verbose = verbose;
     ctx->sf2_sample_map_count = sample_count;
     if (sample_count > 0) {
-        ctx->sf2_sample_map = malloc((size_t)sample_count * sizeof(int));
+        ctx->sf2_sample_map = conv_alloc(sf2, (size_t)sample_count * sizeof(int));
         if (ctx->sf2_sample_map) {
             for (int i = 0; i < sample_count; i++) {
                 ctx->sf2_sample_map[i] = -1;
@@ -60,11 +91,22 @@ static void init_conversion_context(struct ConversionContext *ctx, int sample_co
 
 /* Free conversion context resources */
 static void free_conversion_context(struct ConversionContext *ctx) {
-    free(ctx->sf2_sample_map);
+    conv_free(ctx->sf2, ctx->sf2_sample_map);
     ctx->sf2_sample_map = NULL;
     ctx->sf2_sample_map_count = 0;
 }
 
+/* A patch's sample number; numbers above 255 carry their ninth bit in fSampleMSB */
+int get_patch_sample(const struct PATCH *patch) {
+    return patch->bySampleNumber | (patch->fSampleMSB << 8);
+}
+
+/* Point a patch at a sample */
+void set_patch_sample(struct PATCH *patch, int sample) {
+    patch->bySampleNumber = (uint8_t)(sample & 0xFF);
+    patch->fSampleMSB = (sample >> 8) & 1;
+}
+
 static int patch_base_equal(const struct PATCH *a, const struct PATCH *b) {
     return memcmp(a, b, sizeof(*a)) == 0;
 }
@@ -738,19 +780,22 @@ static int sf2_find_stereo_pair(struct SF2Bank *sf2, int sample_idx, int *left_i
     return 1;
 }
 
-/* Add a sample to the WFB bank */
-static int add_sample(struct WFBBank *wfb, struct SF2Bank *sf2, int sf2_sample_idx,
-                      int *resampled_count, struct ConversionContext *ctx) {
+/* Plan a sample slot for an SF2 sample (PCM is not touched) */
+static int plan_sample(struct ConversionPlan *plan, struct SF2Bank *sf2,
+                       int sf2_sample_idx, struct ConversionContext *ctx) {
     struct sfSample *sf2_samp;
-    struct WaveFrontExtendedSampleInfo *info;
-    struct SAMPLE temp_sample;
-    struct ALIAS temp_alias;
-    int16_t *sample_data;
-    uint32_t sample_count, sample_rate;
-    int wfb_idx;
-
-    if (wfb->sample_count >= WF_MAX_SAMPLES) {
-        return -1;  /* Sample limit reached */
+    struct PlanSlot *slot;
+    int slot_idx;
+
+    if (plan->slot_count >= WF_MAX_SAMPLES) {
+        /* Sample limit reached; count each source sample left out once */
+        if (ctx->sf2_sample_map && sf2_sample_idx >= 0 &&
+            sf2_sample_idx < ctx->sf2_sample_map_count &&
+            ctx->sf2_sample_map[sf2_sample_idx] == -1) {
+            ctx->sf2_sample_map[sf2_sample_idx] = -2;
+            plan->slots_refused++;
+        }
+        return -1;
     }
 
     if (sf2_sample_idx < 0 || sf2_sample_idx >= sf2->sample_count) {
@@ -765,25 +810,28 @@ static int add_sample(struct WFBBank *wfb, struct SF2Bank *sf2, int sf2_sample_i
 
     sf2_samp = &sf2->samples[sf2_sample_idx];
 
-    sample_rate = sf2_samp->dwSampleRate;
-    sample_count = sf2_samp->dwEnd - sf2_samp->dwStart;
-
-    /* Extract sample data */
-    sample_data = malloc(sample_count * sizeof(int16_t));
-    if (!sample_data) {
+    /* Reject samples that do not lie inside the smpl chunk */
+    if (sf2_samp->dwEnd < sf2_samp->dwStart ||
+        sf2_samp->dwEnd > sf2->sample_data_size / sizeof(int16_t)) {
         return -1;
     }
 
-    memcpy(sample_data, &sf2->sample_data[sf2_samp->dwStart], sample_count * sizeof(int16_t));
+    slot_idx = plan->slot_count;
+    slot = &plan->slots[slot_idx];
+    memset(slot, 0, sizeof(*slot));
+    slot->kind = PLAN_SLOT_SAMPLE;
+    slot->sf2_sample_idx = sf2_sample_idx;
+    slot->source = ctx->source;
+    slot->source_rate = sf2_samp->dwSampleRate;
+    slot->source_samples = sf2_samp->dwEnd - sf2_samp->dwStart;
+    slot->rate = resample_target_rate(slot->source_rate);
+    slot->samples = resample_output_count(slot->source_samples, slot->source_rate,
+                                          slot->rate);
+    safe_string_copy(slot->name, sf2_samp->achSampleName, NAME_LENGTH);
 
-    /* Resample if needed */
-    if (resample_to_44100_if_needed(&sample_data, &sample_count, &sample_rate) > 0) {
-        (*resampled_count)++;
-    }
-
-    memset(&temp_sample, 0, sizeof(temp_sample));
-    resample_set_sample_offset(&temp_sample.sampleStartOffset, 0.0, sample_count);
-    resample_set_sample_offset(&temp_sample.sampleEndOffset, (double)sample_count, sample_count);
+    resample_set_sample_offset(&slot->data.sample.sampleStartOffset, 0.0, slot->samples);
+    resample_set_sample_offset(&slot->data.sample.sampleEndOffset, (double)slot->samples,
+                               slot->samples);
 
     /* Set loop points if present */
     if (sf2_samp->dwStartloop < sf2_samp->dwEndloop &&
@@ -793,65 +841,227 @@ static int add_sample(struct WFBBank *wfb, struct SF2Bank *sf2, int sf2_sample_i
         uint32_t loop_start = sf2_samp->dwStartloop - sf2_samp->dwStart;
         uint32_t loop_end = sf2_samp->dwEndloop - sf2_samp->dwStart;
 
-        resample_scale_loop_points(sf2_samp->dwSampleRate, sample_rate,
-                                   loop_start, loop_end, sample_count,
-                                   &temp_sample.loopStartOffset,
-                                   &temp_sample.loopEndOffset);
-        temp_sample.fLoop = 1;
+        resample_scale_loop_points(slot->source_rate, slot->rate,
+                                   loop_start, loop_end, slot->samples,
+                                   &slot->data.sample.loopStartOffset,
+                                   &slot->data.sample.loopEndOffset);
+        slot->data.sample.fLoop = 1;
     }
 
     /* nFrequencyBias must be big-endian for WaveFront hardware (Motorola 68000 based) */
-    temp_sample.nFrequencyBias = swap16(cents_to_freq_bias(sf2_samp->chPitchCorrection));
-    temp_sample.fSampleResolution = LINEAR_16BIT;
+    slot->data.sample.nFrequencyBias = swap16(cents_to_freq_bias(sf2_samp->chPitchCorrection));
+    slot->data.sample.fSampleResolution = LINEAR_16BIT;
 
-    uint32_t channel = WF_CH_MONO;
+    slot->channel = WF_CH_MONO;
     if (sf2_samp->sfSampleType == LEFT_SAMPLE) {
-        channel = WF_CH_LEFT;
+        slot->channel = WF_CH_LEFT;
     } else if (sf2_samp->sfSampleType == RIGHT_SAMPLE) {
-        channel = WF_CH_RIGHT;
+        slot->channel = WF_CH_RIGHT;
     }
 
-    uint64_t data_hash = hash_pcm_data(sample_data, sample_count);
+    if (slot->rate != slot->source_rate) {
+        plan->resample_count++;
+    }
+    plan->slot_count++;
 
-    for (int i = 0; i < wfb->sample_count; i++) {
-        struct WaveFrontExtendedSampleInfo *existing_info = &wfb->samples[i].info;
-        struct SAMPLE *existing_sample = &wfb->samples[i].data.sample;
+    if (ctx->sf2_sample_map && sf2_sample_idx < ctx->sf2_sample_map_count) {
+        ctx->sf2_sample_map[sf2_sample_idx] = slot_idx;
+    }
 
-        if (existing_info->nSampleType != WF_ST_SAMPLE) {
-            continue;
-        }
-        if (existing_info->dwSampleRate != sample_rate ||
-            existing_info->dwSizeInSamples != sample_count ||
-            existing_info->nChannel != channel) {
-            continue;
+    return slot_idx;
+}
+
+/* Plan a multisample slot mapping MIDI keys to sample slots */
+static int plan_multisample(struct ConversionPlan *plan, const int16_t *sample_numbers,
+                            int16_t sample_count, const char *name) {
+    if (plan->slot_count >= WF_MAX_SAMPLES) {
+        plan->slots_refused++;
+        return -1;
+    }
+
+    int slot_idx = plan->slot_count;
+    struct PlanSlot *slot = &plan->slots[slot_idx];
+
+    memset(slot, 0, sizeof(*slot));
+    slot->kind = PLAN_SLOT_MULTISAMPLE;
+    slot->sf2_sample_idx = -1;
+    slot->data.multisample.nNumberOfSamples = sample_count;
+    for (int i = 0; i < NUM_MIDIKEYS; i++) {
+        slot->data.multisample.nSampleNumber[i] = sample_numbers[i];
+    }
+    safe_string_copy(slot->name, name, NAME_LENGTH);
+
+    plan->slot_count++;
+    return slot_idx;
+}
+
+/* Read a planned sample's source PCM (caller mem_frees) */
+static int16_t *read_slot_source(struct SF2Bank *sf2, const struct PlanSlot *slot) {
+    int16_t *sample_data;
+    long long start = stats_phase_begin();
+
+    /* Extract sample data */
+    sample_data = mem_alloc(STAT_MEM_SOURCE_PCM, slot->source_samples * sizeof(int16_t));
+    if (sample_data && sf2_read_sample_pcm(sf2, slot->sf2_sample_idx, sample_data) != 0) {
+        mem_free(sample_data);
+        sample_data = NULL;
+    }
+
+    stats_phase_end(STAT_SAMPLE_COPY, start);
+    return sample_data;
+}
+
+/* Bring source PCM to the planned rate; takes ownership of sample_data */
+static int16_t *convert_slot_source(const struct PlanSlot *slot, int16_t *sample_data) {
+    if (!sample_data) {
+        return NULL;
+    }
+
+    /* Resample if needed */
+    if (slot->rate != slot->source_rate) {
+        uint32_t sample_count;
+        long long start = stats_phase_begin();
+        long long span = trace_begin();
+        int16_t *resampled = resample_linear(sample_data, slot->source_samples,
+                                             slot->source_rate, slot->rate,
+                                             &sample_count);
+        trace_end(span, "resample", "%.32s %u->%u Hz", slot->name,
+                  slot->source_rate, slot->rate);
+        stats_phase_end(STAT_SAMPLE_RESAMPLE, start);
+        stats_count(STAT_RESAMPLE_FRAMES, resampled ? sample_count : 0);
+        mem_free(sample_data);
+        if (resampled && sample_count != slot->samples) {
+            mem_free(resampled);
+            resampled = NULL;
         }
-        if (wfb->samples[i].data_hash != data_hash) {
+        sample_data = resampled;
+    }
+
+    /* Either way the buffer now holds output-rate PCM */
+    mem_retag(sample_data, STAT_MEM_CONVERTED_PCM);
+    return sample_data;
+}
+
+/* Produce a planned sample's PCM at its target rate (caller mem_frees) */
+static int16_t *load_slot_pcm(struct SF2Bank *sf2, const struct PlanSlot *slot) {
+    return convert_slot_source(slot, read_slot_source(sf2, slot));
+}
+
+/* A sample slot's PCM, ready to be stored or aliased */
+struct PreparedSample {
+    int16_t *pcm;
+    uint64_t hash;
+};
+
+/*
+ * Copy, resample and hash one sample slot; independent of every other slot.
+ * Resampled slots go through the sample cache when one is given; slots kept
+ * at their source rate are only a copy and are not worth caching.
+ */
+static void prepare_sample_data(struct SF2Bank *sf2, const struct PlanSlot *slot,
+                                struct SampleCache *cache, struct PreparedSample *out) {
+    struct SampleCacheKey key;
+    int16_t *source;
+
+    if (!cache || slot->rate == slot->source_rate) {
+        out->pcm = load_slot_pcm(sf2, slot);
+        out->hash = out->pcm ? hash_pcm_data(out->pcm, slot->samples) : 0;
+        return;
+    }
+
+    source = read_slot_source(sf2, slot);
+    if (!source) {
+        out->pcm = NULL;
+        out->hash = 0;
+        return;
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.source_hash = hash_pcm_data(source, slot->source_samples);
+    key.source_rate = slot->source_rate;
+    key.source_samples = slot->source_samples;
+    key.rate = slot->rate;
+    key.samples = slot->samples;
+    key.encoding = SAMPLE_CACHE_ENCODING_PCM16;
+    key.sample = slot->data.sample;
+
+    long long start = stats_phase_begin();
+    int hit = sample_cache_load(cache, &key, &out->pcm, &out->hash) == 0;
+    stats_phase_end(STAT_SAMPLE_CACHE, start);
+    if (hit) {
+        mem_free(source);
+        return;
+    }
+
+    out->pcm = convert_slot_source(slot, source);
+    out->hash = out->pcm ? hash_pcm_data(out->pcm, slot->samples) : 0;
+    if (out->pcm) {
+        start = stats_phase_begin();
+        sample_cache_store(cache, &key, out->pcm, out->hash);
+        stats_phase_end(STAT_SAMPLE_CACHE, start);
+    }
+}
+
+/* Prepare one sample slot, traced as a span */
+static void prepare_sample(struct SF2Bank *sf2, const struct PlanSlot *slot,
+                           struct SampleCache *cache, struct PreparedSample *out) {
+    long long span = trace_begin();
+    prepare_sample_data(sf2, slot, cache, out);
+    trace_end(span, "prepare_sample", "%.32s (%u frames)", slot->name, slot->samples);
+}
+
+/* Store a prepared sample, or alias it to an identical earlier one */
+static int materialise_sample(struct WFBBank *wfb, const struct PlanSlot *slot,
+                              struct PreparedSample *prepared) {
+    const struct SAMPLE *planned = &slot->data.sample;
+    struct WaveFrontExtendedSampleInfo *info;
+    struct ALIAS temp_alias;
+    int16_t *sample_data = prepared->pcm;
+    uint32_t sample_count = slot->samples;
+    uint32_t sample_rate = slot->rate;
+    uint64_t data_hash = prepared->hash;
+    int wfb_idx;
+
+    if (wfb->sample_count >= wfb->sample_capacity || !sample_data) {
+        return -1;
+    }
+    prepared->pcm = NULL;  /* Ownership passes to the bank (or is freed) */
+
+    if (slot->rate != slot->source_rate) {
+        resample_report_downsample(slot->source_rate);
+    }
+
+    long long dedup_start = stats_phase_begin();
+    for (int i = 0; i < wfb->sample_count; i++) {
+        const struct WFBSampleKey *key = &wfb->sample_keys[i];
+        struct SAMPLE *existing_sample;
+
+        if (key->data_hash != data_hash || key->type != WF_ST_SAMPLE ||
+            key->rate != sample_rate || key->frames != sample_count ||
+            key->channel != slot->channel) {
             continue;
         }
-        if (!sample_offsets_equal(&existing_sample->loopStartOffset, &temp_sample.loopStartOffset) ||
-            !sample_offsets_equal(&existing_sample->loopEndOffset, &temp_sample.loopEndOffset) ||
-            !sample_offsets_equal(&existing_sample->sampleStartOffset, &temp_sample.sampleStartOffset) ||
-            !sample_offsets_equal(&existing_sample->sampleEndOffset, &temp_sample.sampleEndOffset) ||
-            existing_sample->fLoop != temp_sample.fLoop ||
-            existing_sample->nFrequencyBias != temp_sample.nFrequencyBias ||
-            existing_sample->fSampleResolution != temp_sample.fSampleResolution) {
+        existing_sample = &wfb->samples[i].data.sample;
+        if (!sample_offsets_equal(&existing_sample->loopStartOffset, &planned->loopStartOffset) ||
+            !sample_offsets_equal(&existing_sample->loopEndOffset, &planned->loopEndOffset) ||
+            !sample_offsets_equal(&existing_sample->sampleStartOffset, &planned->sampleStartOffset) ||
+            !sample_offsets_equal(&existing_sample->sampleEndOffset, &planned->sampleEndOffset) ||
+            existing_sample->fLoop != planned->fLoop ||
+            existing_sample->nFrequencyBias != planned->nFrequencyBias ||
+            existing_sample->fSampleResolution != planned->fSampleResolution) {
             continue;
         }
+        stats_count(STAT_MEMCMP_CALLS, 1);
         if (memcmp(wfb->samples[i].pcm_data, sample_data,
                    sample_count * sizeof(int16_t)) != 0) {
             continue;
         }
 
-        if (wfb->sample_count >= WF_MAX_SAMPLES) {
-            free(sample_data);
-            return -1;
-        }
-
         wfb_idx = wfb->sample_count;
         info = &wfb->samples[wfb_idx].info;
         info->nSampleType = WF_ST_ALIAS;
         info->nNumber = wfb_idx;
-        safe_string_copy(info->szName, sf2_samp->achSampleName, NAME_LENGTH);
+        safe_string_copy(info->szName, slot->name, NAME_LENGTH);
         info->dwSampleRate = 0;
         info->dwSizeInSamples = 0;
         info->dwSizeInBytes = 0;
@@ -871,14 +1081,14 @@ static int add_sample(struct WFBBank *wfb, struct SF2Bank *sf2, int sf2_sample_i
 
         wfb->samples[wfb_idx].data.alias = temp_alias;
         wfb->samples[wfb_idx].pcm_data = NULL;
-        wfb->samples[wfb_idx].data_hash = 0;
+        memset(&wfb->sample_keys[wfb_idx], 0, sizeof(wfb->sample_keys[wfb_idx]));
+        wfb->sample_keys[wfb_idx].type = WF_ST_ALIAS;
 
         wfb->sample_count++;
-        ctx->dedupe_alias_count++;
-        if (ctx->sf2_sample_map && sf2_sample_idx < ctx->sf2_sample_map_count) {
-            ctx->sf2_sample_map[sf2_sample_idx] = wfb_idx;
-        }
-        free(sample_data);
+        wfb->alias_count++;
+        stats_count(STAT_DEDUP_HITS, 1);
+        stats_phase_end(STAT_SAMPLE_DEDUP, dedup_start);
+        mem_free(sample_data);
         return wfb_idx;
     }
 
@@ -886,27 +1096,60 @@ static int add_sample(struct WFBBank *wfb, struct SF2Bank *sf2, int sf2_sample_i
     info = &wfb->samples[wfb_idx].info;
     info->nSampleType = WF_ST_SAMPLE;
     info->nNumber = wfb_idx;
-    safe_string_copy(info->szName, sf2_samp->achSampleName, NAME_LENGTH);
+    safe_string_copy(info->szName, slot->name, NAME_LENGTH);
     info->dwSampleRate = sample_rate;
     info->dwSizeInSamples = sample_count;
     info->dwSizeInBytes = sample_count * sizeof(int16_t);
-    info->nChannel = channel;
+    info->nChannel = slot->channel;
 
-    wfb->samples[wfb_idx].data.sample = temp_sample;
+    wfb->samples[wfb_idx].data.sample = *planned;
 
     /* Store PCM data */
     wfb->samples[wfb_idx].pcm_data = sample_data;
-    wfb->samples[wfb_idx].data_hash = data_hash;
+    wfb->sample_keys[wfb_idx].data_hash = data_hash;
+    wfb->sample_keys[wfb_idx].rate = sample_rate;
+    wfb->sample_keys[wfb_idx].frames = sample_count;
+    wfb->sample_keys[wfb_idx].type = WF_ST_SAMPLE;
+    wfb->sample_keys[wfb_idx].channel = (uint16_t)slot->channel;
 
     /* Update totals */
     wfb->total_sample_memory += info->dwSizeInBytes;
     wfb->sample_count++;
 
-    if (ctx->sf2_sample_map && sf2_sample_idx < ctx->sf2_sample_map_count) {
-        ctx->sf2_sample_map[sf2_sample_idx] = wfb_idx;
+    stats_phase_end(STAT_SAMPLE_DEDUP, dedup_start);
+    return wfb_idx;
+}
+
+/*
+ * Copy a stored sample (record and PCM) from another bank into wfb, aliasing
+ * it to an identical sample already there. Returns the new sample number.
+ */
+int add_stored_sample(struct WFBBank *wfb, const struct WFBSample *sample) {
+    const struct WaveFrontExtendedSampleInfo *info = &sample->info;
+    struct PlanSlot slot;
+    struct PreparedSample prepared;
+
+    if (info->nSampleType != WF_ST_SAMPLE || !sample->pcm_data ||
+        info->dwSizeInBytes < info->dwSizeInSamples * sizeof(int16_t)) {
+        return -1;
     }
 
-    return wfb_idx;
+    memset(&slot, 0, sizeof(slot));
+    slot.kind = PLAN_SLOT_SAMPLE;
+    slot.sf2_sample_idx = -1;
+    slot.source_rate = slot.rate = info->dwSampleRate;
+    slot.source_samples = slot.samples = info->dwSizeInSamples;
+    slot.channel = info->nChannel;
+    slot.data.sample = sample->data.sample;
+    safe_string_copy(slot.name, info->szName, NAME_LENGTH);
+
+    prepared.pcm = mem_alloc(STAT_MEM_CONVERTED_PCM, slot.samples * sizeof(int16_t));
+    if (!prepared.pcm) {
+        return -1;
+    }
+    memcpy(prepared.pcm, sample->pcm_data, slot.samples * sizeof(int16_t));
+    prepared.hash = hash_pcm_data(prepared.pcm, slot.samples);
+    return materialise_sample(wfb, &slot, &prepared);
 }
 
 int add_multisample_entry(struct WFBBank *wfb, const int16_t *sample_numbers,
@@ -915,7 +1158,7 @@ int add_multisample_entry(struct WFBBank *wfb, const int16_t *sample_numbers,
         return -1;
     }
 
-    if (wfb->sample_count >= WF_MAX_SAMPLES) {
+    if (wfb->sample_count >= wfb->sample_capacity) {
         return -1;
     }
 
@@ -942,20 +1185,45 @@ int add_multisample_entry(struct WFBBank *wfb, const int16_t *sample_numbers,
     info->nChannel = 0;
 
     wfb->samples[wfb_idx].pcm_data = NULL;
-    wfb->samples[wfb_idx].data_hash = 0;
+    memset(&wfb->sample_keys[wfb_idx], 0, sizeof(wfb->sample_keys[wfb_idx]));
+    wfb->sample_keys[wfb_idx].type = WF_ST_MULTISAMPLE;
 
     wfb->sample_count++;
     return wfb_idx;
 }
 
-/* Convert a single SF2 preset to WFB program */
-static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
-                         struct sfPresetHeader *preset, int prog_num,
-                         int *resampled_count, struct ConversionContext *ctx) {
-    struct WaveFrontProgram *wf_prog;
-    struct WaveFrontPatch *wf_patch;
+/* Zones sharing articulation, merged into one layer candidate */
+struct ZoneGroup {
+    struct PATCH patch_base;
+    uint8_t pan;
+    uint8_t vel_lo;
+    uint8_t vel_hi;
+    int inst_mod_start;
+    int inst_mod_end;
+    int preset_mod_start;
+    int preset_mod_end;
+    int16_t sample_idx[NUM_MIDIKEYS];
+    int16_t sample_idx_r[NUM_MIDIKEYS];
+    int has_stereo;
+};
+
+/* Zone grouping of one preset, computed from the hydra alone */
+struct PresetAnalysis {
+    struct ZoneGroup groups[16];
+    int group_count;
+    int layers_wanted;               /* Layers the groups need */
+    int16_t chorus_max;              /* Largest zone chorus send */
+    int16_t reverb_max;              /* Largest zone reverb send */
+};
+
+/*
+ * Group a preset's zones into layer candidates. Reads the hydra only and
+ * touches no shared state, so presets can be analysed concurrently.
+ */
+static void analyse_preset(struct SF2Bank *sf2, struct sfPresetHeader *preset,
+                           struct PresetAnalysis *an) {
+    struct ZoneGroup *groups = an->groups;
     int bag_start, bag_end;
-    int layer_idx = 0;
     int i;
     int preset_global_gen_start = -1;
     int preset_global_gen_end = -1;
@@ -979,33 +1247,10 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
         struct PATCH patch_base;
     } zones[32];
     int zone_count = 0;
-    struct GroupDef {
-        struct PATCH patch_base;
-        uint8_t pan;
-        uint8_t vel_lo;
-        uint8_t vel_hi;
-        int inst_mod_start;
-        int inst_mod_end;
-        int preset_mod_start;
-        int preset_mod_end;
-        int16_t sample_idx[NUM_MIDIKEYS];
-        int16_t sample_idx_r[NUM_MIDIKEYS];
-        int has_stereo;
-    } groups[16];
     int group_count = 0;
     int16_t preset_chorus_max = 0;
     int16_t preset_reverb_max = 0;
 
-    if (wfb->program_count >= WF_MAX_PROGRAMS) {
-        return -1;
-    }
-
-    wf_prog = &wfb->programs[wfb->program_count];
-    memset(wf_prog, 0, sizeof(*wf_prog));
-
-    wf_prog->nNumber = prog_num;
-    safe_string_copy(wf_prog->szName, preset->achPresetName, NAME_LENGTH);
-
     /* Parse preset bags (zones) */
     bag_start = preset->wPresetBagNdx;
     bag_end = (preset < &sf2->presets[sf2->preset_count - 1]) ?
@@ -1108,8 +1353,7 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
 
                 init_default_patch(&temp_patch);
                 apply_sf2_state_to_patch(&temp_patch, &gen_state);
-                temp_patch.bySampleNumber = 0;
-                temp_patch.fSampleMSB = 0;
+                set_patch_sample(&temp_patch, 0);
 
                 zones[zone_count].pan = sf2_pan_to_wf(gen_state.pan);
                 zones[zone_count].patch_base = temp_patch;
@@ -1166,7 +1410,7 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
         }
 
         if (group_idx < 0) {
-            if (group_count >= (int)(sizeof(groups) / sizeof(groups[0]))) {
+            if (group_count >= (int)(sizeof(an->groups) / sizeof(an->groups[0]))) {
                 continue;
             }
             group_idx = group_count++;
@@ -1194,6 +1438,49 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
         }
     }
 
+    an->layers_wanted = 0;
+    for (int g = 0; g < group_count; g++) {
+        int stereo_complete = groups[g].has_stereo;
+        for (int k = 0; stereo_complete && k < NUM_MIDIKEYS; k++) {
+            if (groups[g].sample_idx[k] >= 0 && groups[g].sample_idx_r[k] < 0) {
+                stereo_complete = 0;
+            }
+        }
+        an->layers_wanted += stereo_complete ? 2 : 1;
+    }
+
+    an->group_count = group_count;
+    an->chorus_max = preset_chorus_max;
+    an->reverb_max = preset_reverb_max;
+}
+
+/* Plan a single SF2 preset as a WFB program from its zone analysis */
+static int plan_preset(struct ConversionPlan *plan, struct SF2Bank *sf2,
+                       struct sfPresetHeader *preset, int prog_num,
+                       const struct PresetAnalysis *an,
+                       struct ConversionContext *ctx) {
+    const struct ZoneGroup *groups = an->groups;
+    int group_count = an->group_count;
+    struct WaveFrontProgram *wf_prog;
+    struct WaveFrontPatch *wf_patch;
+    int layer_idx = 0;
+
+    if (plan->program_count >= WF_MAX_PROGRAMS) {
+        return -1;
+    }
+    if (group_count > (int)(sizeof(an->groups) / sizeof(an->groups[0]))) {
+        group_count = (int)(sizeof(an->groups) / sizeof(an->groups[0]));
+    }
+
+    wf_prog = &plan->programs[plan->program_count];
+    memset(wf_prog, 0, sizeof(*wf_prog));
+
+    wf_prog->nNumber = prog_num;
+    safe_string_copy(wf_prog->szName, preset->achPresetName, NAME_LENGTH);
+
+    struct PlanProgramStats *stats = &plan->program_stats[plan->program_count];
+    stats->layers_wanted = an->layers_wanted;
+
     int dropped_groups = 0;
     int drop_reason = 0;
     for (int g = 0; g < group_count; g++) {
@@ -1206,7 +1493,7 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
         if (patch_limit < 0) {
             patch_limit = 0;
         }
-        if (wfb->patch_count >= patch_limit) {
+        if (plan->patch_count >= patch_limit) {
             dropped_groups = group_count - g;
             drop_reason = 2;
             break;
@@ -1231,16 +1518,16 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
             ms_numbers[k] = -1;
             ms_numbers_r[k] = -1;
             if (groups[g].sample_idx[k] >= 0) {
-                int wfb_idx = add_sample(wfb, sf2, groups[g].sample_idx[k], resampled_count, ctx);
-                if (wfb_idx >= 0) {
-                    ms_numbers[k] = (int16_t)wfb_idx;
+                int slot_idx = plan_sample(plan, sf2, groups[g].sample_idx[k], ctx);
+                if (slot_idx >= 0) {
+                    ms_numbers[k] = (int16_t)slot_idx;
                     mapped_keys++;
                 }
             }
             if (has_right && groups[g].sample_idx_r[k] >= 0) {
-                int wfb_idx = add_sample(wfb, sf2, groups[g].sample_idx_r[k], resampled_count, ctx);
-                if (wfb_idx >= 0) {
-                    ms_numbers_r[k] = (int16_t)wfb_idx;
+                int slot_idx = plan_sample(plan, sf2, groups[g].sample_idx_r[k], ctx);
+                if (slot_idx >= 0) {
+                    ms_numbers_r[k] = (int16_t)slot_idx;
                     mapped_keys_r++;
                 }
             }
@@ -1256,7 +1543,7 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
         if (need_multisample) {
             char ms_name[NAME_LENGTH];
             snprintf(ms_name, NAME_LENGTH, "%s_MS%d", preset->achPresetName, g);
-            sample_ref = add_multisample_entry(wfb, ms_numbers, (int16_t)unique, ms_name);
+            sample_ref = plan_multisample(plan, ms_numbers, (int16_t)unique, ms_name);
         } else {
             for (int k = 0; k < NUM_MIDIKEYS; k++) {
                 if (ms_numbers[k] >= 0) {
@@ -1270,9 +1557,9 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
             continue;
         }
 
-        wf_patch = &wfb->patches[wfb->patch_count];
+        wf_patch = &plan->patches[plan->patch_count];
         memset(wf_patch, 0, sizeof(*wf_patch));
-        wf_patch->nNumber = wfb->patch_count;
+        wf_patch->nNumber = plan->patch_count;
         snprintf(wf_patch->szName, NAME_LENGTH, "%s_G%d",
                  preset->achPresetName, g);
         wf_patch->base = groups[g].patch_base;
@@ -1282,26 +1569,26 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
         apply_modulator_list_to_patch(&wf_patch->base,
                                       sf2->preset_mods,
                                       groups[g].preset_mod_start, groups[g].preset_mod_end);
-        wf_patch->base.bySampleNumber = (uint8_t)sample_ref;
+        set_patch_sample(&wf_patch->base, sample_ref);
 
         struct LAYER *layer = &wf_prog->base.layer[layer_idx];
-        layer->byPatchNumber = wfb->patch_count;
+        layer->byPatchNumber = plan->patch_count;
         layer->fMixLevel = 127;
         layer->fUnmute = 1;
         /* For stereo pairs, left channel gets hard-left (0); mono uses zone pan */
         layer->fPan = has_right ? 0 : groups[g].pan;
         apply_layer_split(layer, 0, 127, groups[g].vel_lo, groups[g].vel_hi);
-        wfb->patch_count++;
+        plan->patch_count++;
         layer_idx++;
 
-        if (has_right && layer_idx < NUM_LAYERS && wfb->patch_count < patch_limit) {
+        if (has_right && layer_idx < NUM_LAYERS && plan->patch_count < patch_limit) {
             int unique_r = count_unique_samples(ms_numbers_r);
             int need_multisample_r = (unique_r > 1) || (mapped_keys_r < NUM_MIDIKEYS);
             int16_t sample_ref_r = -1;
             if (need_multisample_r) {
                 char ms_name_r[NAME_LENGTH];
                 snprintf(ms_name_r, NAME_LENGTH, "%s_MS%dR", preset->achPresetName, g);
-                sample_ref_r = add_multisample_entry(wfb, ms_numbers_r, (int16_t)unique_r, ms_name_r);
+                sample_ref_r = plan_multisample(plan, ms_numbers_r, (int16_t)unique_r, ms_name_r);
             } else {
                 for (int k = 0; k < NUM_MIDIKEYS; k++) {
                     if (ms_numbers_r[k] >= 0) {
@@ -1312,9 +1599,9 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
             }
 
             if (sample_ref_r >= 0) {
-                struct WaveFrontPatch *wf_patch_r = &wfb->patches[wfb->patch_count];
+                struct WaveFrontPatch *wf_patch_r = &plan->patches[plan->patch_count];
                 memset(wf_patch_r, 0, sizeof(*wf_patch_r));
-                wf_patch_r->nNumber = wfb->patch_count;
+                wf_patch_r->nNumber = plan->patch_count;
                 snprintf(wf_patch_r->szName, NAME_LENGTH, "%s_G%dR",
                          preset->achPresetName, g);
                 wf_patch_r->base = groups[g].patch_base;
@@ -1324,15 +1611,15 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
                 apply_modulator_list_to_patch(&wf_patch_r->base,
                                               sf2->preset_mods,
                                               groups[g].preset_mod_start, groups[g].preset_mod_end);
-                wf_patch_r->base.bySampleNumber = (uint8_t)sample_ref_r;
+                set_patch_sample(&wf_patch_r->base, sample_ref_r);
 
                 struct LAYER *layer_r = &wf_prog->base.layer[layer_idx];
-                layer_r->byPatchNumber = wfb->patch_count;
+                layer_r->byPatchNumber = plan->patch_count;
                 layer_r->fMixLevel = 127;
                 layer_r->fUnmute = 1;
                 layer_r->fPan = 7;
                 apply_layer_split(layer_r, 0, 127, groups[g].vel_lo, groups[g].vel_hi);
-                wfb->patch_count++;
+                plan->patch_count++;
                 layer_idx++;
             }
         }
@@ -1340,53 +1627,53 @@ static int convert_preset(struct WFBBank *wfb, struct SF2Bank *sf2,
 
     if (ctx->verbose && dropped_groups > 0) {
         if (drop_reason == 1) {
-            fprintf(stderr,
-                    "Warning: Program %d (\"%s\") has %d zone groups; only %d layers available. %d group(s) dropped.\n",
-                    prog_num, preset->achPresetName, group_count, NUM_LAYERS, dropped_groups);
+            log_errorf(
+                       "Warning: Program %d (\"%s\") has %d zone groups; only %d layers available. %d group(s) dropped.\n",
+                       prog_num, preset->achPresetName, group_count, NUM_LAYERS, dropped_groups);
         } else if (drop_reason == 2) {
-            fprintf(stderr,
-                    "Warning: Program %d (\"%s\") dropped %d zone group(s) due to patch limit (%d).\n",
-                    prog_num, preset->achPresetName, dropped_groups, WF_MAX_PATCHES - ctx->patch_reserve);
+            log_errorf(
+                       "Warning: Program %d (\"%s\") dropped %d zone group(s) due to patch limit (%d).\n",
+                       prog_num, preset->achPresetName, dropped_groups, WF_MAX_PATCHES - ctx->patch_reserve);
         }
     }
 
     if (ctx->verbose) {
-        if (preset_chorus_max > 0) {
-            fprintf(stderr,
-                    "Notice: Program %d (\"%s\") chorus send up to %.1f%% (SF2).\n",
-                    prog_num, preset->achPresetName, preset_chorus_max / 10.0f);
+        if (an->chorus_max > 0) {
+            log_errorf(
+                       "Notice: Program %d (\"%s\") chorus send up to %.1f%% (SF2).\n",
+                       prog_num, preset->achPresetName, an->chorus_max / 10.0f);
         }
-        if (preset_reverb_max > 0) {
-            fprintf(stderr,
-                    "Notice: Program %d (\"%s\") reverb send up to %.1f%% (SF2).\n",
-                    prog_num, preset->achPresetName, preset_reverb_max / 10.0f);
+        if (an->reverb_max > 0) {
+            log_errorf(
+                       "Notice: Program %d (\"%s\") reverb send up to %.1f%% (SF2).\n",
+                       prog_num, preset->achPresetName, an->reverb_max / 10.0f);
         }
     }
 
-    wfb->program_count++;
+    stats->layers_used = layer_idx;
+    plan->program_count++;
     return 0;
 }
 
-static int convert_drumkit(struct WFBBank *wfb, struct SF2Bank *sf2,
-                           struct sfPresetHeader *preset, int *resampled_count,
-                           struct ConversionContext *ctx) {
+static int plan_drumkit(struct ConversionPlan *plan, struct SF2Bank *sf2,
+                        struct sfPresetHeader *preset, struct ConversionContext *ctx) {
     int bag_start, bag_end;
     int preset_global_gen_start = -1;
     int preset_global_gen_end = -1;
 
-    if (wfb->has_drumkit) {
+    if (plan->has_drumkit) {
         return 0;
     }
 
-    memset(&wfb->drumkit, 0, sizeof(wfb->drumkit));
+    memset(&plan->drumkit, 0, sizeof(plan->drumkit));
     for (int i = 0; i < NUM_MIDIKEYS; i++) {
-        wfb->drumkit.base.drum[i].byPatchNumber = 0;
-        wfb->drumkit.base.drum[i].fMixLevel = 0;
-        wfb->drumkit.base.drum[i].fUnmute = 0;
-        wfb->drumkit.base.drum[i].fGroup = 0;
-        wfb->drumkit.base.drum[i].fPanModSource = 0;
-        wfb->drumkit.base.drum[i].fPanModulated = 0;
-        wfb->drumkit.base.drum[i].fPanAmount = 4;
+        plan->drumkit.base.drum[i].byPatchNumber = 0;
+        plan->drumkit.base.drum[i].fMixLevel = 0;
+        plan->drumkit.base.drum[i].fUnmute = 0;
+        plan->drumkit.base.drum[i].fGroup = 0;
+        plan->drumkit.base.drum[i].fPanModSource = 0;
+        plan->drumkit.base.drum[i].fPanModulated = 0;
+        plan->drumkit.base.drum[i].fPanAmount = 4;
     }
 
     bag_start = preset->wPresetBagNdx;
@@ -1475,13 +1762,13 @@ static int convert_drumkit(struct WFBBank *wfb, struct SF2Bank *sf2,
                 }
             }
 
-            if (wfb->patch_count >= WF_MAX_PATCHES) {
+            if (plan->patch_count >= WF_MAX_PATCHES) {
                 return -1;
             }
 
-            struct WaveFrontPatch *wf_patch = &wfb->patches[wfb->patch_count];
+            struct WaveFrontPatch *wf_patch = &plan->patches[plan->patch_count];
             memset(wf_patch, 0, sizeof(*wf_patch));
-            wf_patch->nNumber = wfb->patch_count;
+            wf_patch->nNumber = plan->patch_count;
             snprintf(wf_patch->szName, NAME_LENGTH, "Drum_%d", key);
             init_default_patch(&wf_patch->base);
 
@@ -1507,13 +1794,13 @@ static int convert_drumkit(struct WFBBank *wfb, struct SF2Bank *sf2,
                 wf_patch->base.fReuse = 1;
             }
 
-            int wfb_sample_idx = add_sample(wfb, sf2, sample_idx, resampled_count, ctx);
-            if (wfb_sample_idx >= 0) {
-                wf_patch->base.bySampleNumber = wfb_sample_idx;
+            int slot_idx = plan_sample(plan, sf2, sample_idx, ctx);
+            if (slot_idx >= 0) {
+                set_patch_sample(&wf_patch->base, slot_idx);
             }
 
-            struct DRUM *drum = &wfb->drumkit.base.drum[key];
-            drum->byPatchNumber = wfb->patch_count;
+            struct DRUM *drum = &plan->drumkit.base.drum[key];
+            drum->byPatchNumber = plan->patch_count;
             drum->fMixLevel = sf2_atten_to_mixlevel(gen_state.initial_attenuation);
             drum->fUnmute = 1;
             if (gen_state.exclusive_class > 0) {
@@ -1527,46 +1814,208 @@ static int convert_drumkit(struct WFBBank *wfb, struct SF2Bank *sf2,
             drum->fPanModulated = 0;
             drum->fPanAmount = sf2_pan_to_wf(gen_state.pan);
 
-            wfb->patch_count++;
+            plan->patch_count++;
             matched = 1;
             break;
         }
 
         if (!matched) {
-            wfb->drumkit.base.drum[key].fUnmute = 0;
+            plan->drumkit.base.drum[key].fUnmute = 0;
         }
     }
 
-    wfb->has_drumkit = 1;
+    plan->has_drumkit = 1;
     return 0;
 }
 
-/* Main conversion function */
-int convert_sf2_to_wfb(const char *input_file, const char *output_file,
-                       struct ConversionOptions *opts) {
-    struct SF2Bank sf2;
-    struct WFBBank wfb;
+/* Free the per-overlay planning contexts */
+static void free_overlay_contexts(struct SF2Bank *sf2, struct ConversionContext *contexts,
+                                  int count) {
+    if (!contexts) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        free_conversion_context(&contexts[i]);
+    }
+    conv_free(sf2, contexts);
+}
+
+/* Bank 0 presets awaiting analysis, indexed in program order */
+struct PresetJobs {
+    struct SF2Bank *sources[128];
+    struct ConversionContext *contexts[128];
+    struct sfPresetHeader *presets[128];
+    int prog_nums[128];
+    struct PresetAnalysis *analyses;
+    int count;
+    struct LogCapture *log;          /* Submitter's log capture, adopted by workers */
+};
+
+static void analyse_preset_job(void *arg, int index) {
+    struct PresetJobs *jobs = arg;
+    struct LogCapture *prev_log = log_capture_current();
+    long long span = trace_begin();
+
+    log_capture_set_current(jobs->log);
+    analyse_preset(jobs->sources[index], jobs->presets[index], &jobs->analyses[index]);
+    trace_end(span, "analyse_preset", "%d %.20s", jobs->prog_nums[index],
+              jobs->presets[index]->achPresetName);
+    log_capture_set_current(prev_log);
+}
+
+/*
+ * Plan overlay index of a -p/-D source file, opening it on first use.
+ * Only the hydra is read; sample PCM stays on disk until a slot needs it.
+ */
+static int open_overlay(struct SF2Bank *sf2, struct ConversionPlan *plan, const char *file) {
+    struct SF2Bank *bank;
+
+    for (int i = 0; i < plan->overlay_count; i++) {
+        if (strcmp(plan->overlay_paths[i], file) == 0) {
+            return i;
+        }
+    }
+    if (plan->overlay_count >= PLAN_MAX_OVERLAYS) {
+        log_errorf("Error: Too many source files\n");
+        return -1;
+    }
+
+    bank = conv_alloc(sf2, sizeof(*bank));
+    if (!bank) {
+        log_errorf("Error: Failed to allocate overlay '%s'\n", file);
+        return -1;
+    }
+    if (sf2_open_arena(file, bank, sf2->arena, 0) != 0) {
+        conv_free(sf2, bank);
+        return -1;
+    }
+    plan->overlays[plan->overlay_count] = bank;
+    plan->overlay_paths[plan->overlay_count] = file;
+    return plan->overlay_count++;
+}
+
+/*
+ * Drum kit preset of a -D file: bank 128 preset 0, bank 0 preset 128, or
+ * failing both the file's first preset. Multi-kit files keep the rest of
+ * their kits on disk; only the chosen kit's samples are ever read.
+ */
+static struct sfPresetHeader *find_external_drumkit(struct SF2Bank *bank, const char *file) {
+    struct sfPresetHeader *drums = sf2_get_preset(bank, 128, 0);
+
+    if (!drums) {
+        drums = sf2_get_preset(bank, 0, 128);
+    }
+    if (!drums) {
+        drums = sf2_get_first_preset(bank);
+        if (drums) {
+            log_printf("Warning: No drum bank in '%s'; using preset '%.20s' as Drum Kit\n",
+                       file, drums->achPresetName);
+        } else {
+            log_printf("Warning: '%s' has no presets; no drum kit converted\n", file);
+        }
+    }
+    return drums;
+}
+
+/*
+ * Open every distinct -p file once and pick the preset each overlaid
+ * program takes: the one at the same program number, else the file's
+ * first. overlay_of[program] is the plan overlay index, or -1.
+ */
+static int open_overlays(struct SF2Bank *sf2, const struct ConversionOptions *opts,
+                         struct ConversionPlan *plan, int overlay_of[128],
+                         struct sfPresetHeader *overlay_preset[128]) {
+    for (int i = 0; i < 128; i++) {
+        overlay_of[i] = -1;
+        overlay_preset[i] = NULL;
+    }
+
+    for (int i = 0; i < opts->patch_count; i++) {
+        const char *file = opts->patches[i].file;
+        int program = opts->patches[i].program_id;
+        int n = open_overlay(sf2, plan, file);
+
+        if (n < 0) {
+            return -1;
+        }
+
+        struct sfPresetHeader *preset = sf2_get_preset(plan->overlays[n], 0, program);
+        if (!preset) {
+            preset = sf2_get_first_preset(plan->overlays[n]);
+        }
+        if (!preset) {
+            log_printf("Warning: '%s' has no presets; program %d left unchanged\n",
+                       file, program);
+            continue;
+        }
+        overlay_of[program] = n;
+        overlay_preset[program] = preset;
+        if (opts->verbose) {
+            log_printf("Program %d: preset '%.20s' from '%s'\n",
+                       program, preset->achPresetName, file);
+        }
+    }
+
+    return 0;
+}
+
+/* Close the overlay files a plan opened; call once the plan is done with */
+void plan_release_sources(struct ConversionPlan *plan, struct SF2Bank *sf2) {
+    for (int i = 0; i < plan->overlay_count; i++) {
+        sf2_close(plan->overlays[i]);
+        conv_free(sf2, plan->overlays[i]);
+        plan->overlays[i] = NULL;
+    }
+    plan->overlay_count = 0;
+}
+
+/* The SF2 a planned slot reads its PCM from */
+static struct SF2Bank *slot_source(const struct ConversionPlan *plan, struct SF2Bank *sf2,
+                                   const struct PlanSlot *slot) {
+    return slot->source > 0 ? plan->overlays[slot->source - 1] : sf2;
+}
+
+/*
+ * Planning pass: decide programs, drum kit, patches and sample slots from
+ * the hydra alone. sf2 may have been opened with sf2_open_hydra(). Programs
+ * named by -p are planned from their overlay file instead, sharing the
+ * bank's patch and sample budget; the caller releases the overlays with
+ * plan_release_sources(), even on failure.
+ */
+int plan_conversion(struct SF2Bank *sf2, const struct ConversionOptions *opts,
+                    struct ConversionPlan *plan) {
     struct ConversionContext ctx;
-    int i, resampled_count = 0;
-    int discarded_samples = 0;
-    uint32_t memory_limit;
+    struct ConversionContext *overlay_ctx = NULL;
+    int overlay_of[128];
+    struct sfPresetHeader *overlay_preset[128];
+    struct sfPresetHeader *external_drums = NULL;
+    int drums_overlay = -1;
+    int i;
 
-    /* Open SF2 file */
-    if (sf2_open(input_file, &sf2) != 0) {
+    memset(plan, 0, sizeof(*plan));
+
+    if (open_overlays(sf2, opts, plan, overlay_of, overlay_preset) != 0) {
         return -1;
     }
 
-    /* Initialize conversion context */
-    init_conversion_context(&ctx, sf2.sample_count, opts && opts->verbose);
+    /* An external kit is planned from its own file, like a -p overlay */
+    if (opts->drums_file) {
+        drums_overlay = open_overlay(sf2, plan, opts->drums_file);
+        if (drums_overlay < 0) {
+            return -1;
+        }
+        external_drums = find_external_drumkit(plan->overlays[drums_overlay],
+                                               opts->drums_file);
+    }
 
-    /* Initialize WFB bank */
-    init_wfb_bank(&wfb, opts->device_name ? opts->device_name : "Maui");
+    /* Initialize conversion context */
+    init_conversion_context(&ctx, sf2, opts && opts->verbose);
 
     /* Convert Bank 0 (melodic programs 0-127) */
     if (!opts->drums_file) {
-        struct sfPresetHeader *drums_probe = sf2_get_preset(&sf2, 128, 0);
+        struct sfPresetHeader *drums_probe = sf2_get_preset(sf2, 128, 0);
         if (!drums_probe) {
-            drums_probe = sf2_get_preset(&sf2, 0, 128);
+            drums_probe = sf2_get_preset(sf2, 0, 128);
         }
         if (drums_probe) {
             ctx.patch_reserve = 47; /* Reserve for Drumkit keys 35-81 */
@@ -1574,85 +2023,598 @@ int convert_sf2_to_wfb(const char *input_file, const char *output_file,
             ctx.patch_reserve = 0;
         }
     } else {
-        ctx.patch_reserve = 0;
+        ctx.patch_reserve = external_drums ? 47 : 0;
+    }
+
+    /* Each overlay maps its own sample indices to slots */
+    if (plan->overlay_count > 0) {
+        overlay_ctx = conv_alloc(sf2, (size_t)plan->overlay_count * sizeof(*overlay_ctx));
+        if (!overlay_ctx) {
+            log_errorf("Error: Failed to allocate overlay contexts\n");
+            free_conversion_context(&ctx);
+            return -1;
+        }
+        for (i = 0; i < plan->overlay_count; i++) {
+            init_conversion_context(&overlay_ctx[i], plan->overlays[i], ctx.verbose);
+            overlay_ctx[i].source = i + 1;
+            overlay_ctx[i].patch_reserve = ctx.patch_reserve;
+        }
     }
+
+    /* Analyse presets (in parallel if asked), then plan them in program order */
+    long long phase_start = stats_phase_begin();
+    struct PresetJobs jobs;
+    jobs.count = 0;
+    jobs.log = log_capture_current();
     for (i = 0; i < 128; i++) {
-        struct sfPresetHeader *preset = sf2_get_preset(&sf2, 0, i);
+        struct SF2Bank *source = sf2;
+        struct ConversionContext *source_ctx = &ctx;
+        struct sfPresetHeader *preset;
+
+        if (overlay_of[i] >= 0) {
+            source = plan->overlays[overlay_of[i]];
+            source_ctx = &overlay_ctx[overlay_of[i]];
+            preset = overlay_preset[i];
+        } else {
+            preset = sf2_get_preset(sf2, 0, i);
+        }
         if (preset) {
-            if (convert_preset(&wfb, &sf2, preset, i, &resampled_count, &ctx) != 0) {
-                fprintf(stderr, "Warning: Failed to convert preset %d\n", i);
-            }
+            jobs.sources[jobs.count] = source;
+            jobs.contexts[jobs.count] = source_ctx;
+            jobs.presets[jobs.count] = preset;
+            jobs.prog_nums[jobs.count] = i;
+            jobs.count++;
+        }
+    }
+
+    jobs.analyses = conv_alloc(sf2, (size_t)(jobs.count > 0 ? jobs.count : 1) * sizeof(*jobs.analyses));
+    if (!jobs.analyses) {
+        log_errorf("Error: Failed to allocate preset analysis\n");
+        free_overlay_contexts(sf2, overlay_ctx, plan->overlay_count);
+        free_conversion_context(&ctx);
+        return -1;
+    }
+
+    if (opts && opts->threads > 1 && jobs.count > 1) {
+        struct ThreadPool *pool = threadpool_create(opts->threads);
+        threadpool_parallel_for(pool, jobs.count, analyse_preset_job, &jobs);
+        threadpool_destroy(pool);
+    } else {
+        threadpool_parallel_for(NULL, jobs.count, analyse_preset_job, &jobs);
+    }
+
+    for (i = 0; i < jobs.count; i++) {
+        long long span = trace_begin();
+        if (plan_preset(plan, jobs.sources[i], jobs.presets[i], jobs.prog_nums[i],
+                        &jobs.analyses[i], jobs.contexts[i]) != 0) {
+            log_errorf("Warning: Failed to convert preset %d\n", jobs.prog_nums[i]);
         }
+        trace_end(span, "plan_preset", "%d %.20s", jobs.prog_nums[i],
+                  jobs.presets[i]->achPresetName);
     }
+    conv_free(sf2, jobs.analyses);
+    stats_phase_end(STAT_PLAN_PRESETS, phase_start);
 
     /* Convert drums (Bank 128) if not using separate drum file */
     if (!opts->drums_file) {
-        struct sfPresetHeader *drums = sf2_get_preset(&sf2, 128, 0);
+        struct sfPresetHeader *drums = sf2_get_preset(sf2, 128, 0);
         if (!drums) {
             /* Try bank 0 preset 128 */
-            drums = sf2_get_preset(&sf2, 0, 128);
+            drums = sf2_get_preset(sf2, 0, 128);
             if (drums) {
-                printf("Warning: Using Bank 0 as Drum Kit. "
-                       "Verify that key mappings align with GM percussion (Key 35-81).\n");
+                log_printf("Warning: Using Bank 0 as Drum Kit. "
+                           "Verify that key mappings align with GM percussion (Key 35-81).\n");
             }
         }
 
         if (drums) {
-            if (convert_drumkit(&wfb, &sf2, drums, &resampled_count, &ctx) != 0) {
-                fprintf(stderr, "Warning: Failed to convert drumkit\n");
+            phase_start = stats_phase_begin();
+            long long span = trace_begin();
+            if (plan_drumkit(plan, sf2, drums, &ctx) != 0) {
+                log_errorf("Warning: Failed to convert drumkit\n");
             }
+            trace_end(span, "plan_drumkit", "%.20s", drums->achPresetName);
+            stats_phase_end(STAT_PLAN_DRUMKIT, phase_start);
         }
+    } else if (external_drums) {
+        phase_start = stats_phase_begin();
+        long long span = trace_begin();
+        if (plan_drumkit(plan, plan->overlays[drums_overlay], external_drums,
+                         &overlay_ctx[drums_overlay]) != 0) {
+            log_errorf("Warning: Failed to convert drumkit from '%s'\n", opts->drums_file);
+        }
+        trace_end(span, "plan_drumkit", "%.20s", external_drums->achPresetName);
+        stats_phase_end(STAT_PLAN_DRUMKIT, phase_start);
     }
 
+    free_overlay_contexts(sf2, overlay_ctx, plan->overlay_count);
+    free_conversion_context(&ctx);
+    return 0;
+}
+
+/* Sample slots prepared concurrently ahead of the in-order merge */
+struct SampleJobs {
+    const struct ConversionPlan *plan;
+    struct SF2Bank *sf2;
+    struct SampleCache *cache;
+    struct PreparedSample *prepared;
+    struct ConversionStats *stats;   /* Submitter's stats, adopted by workers */
+    struct LogCapture *log;          /* Submitter's log capture, likewise */
+};
+
+static void prepare_sample_job(void *arg, int index) {
+    struct SampleJobs *jobs = arg;
+    const struct PlanSlot *slot = &jobs->plan->slots[index];
+    struct ConversionStats *prev_stats = stats_current();
+    struct LogCapture *prev_log = log_capture_current();
+
+    stats_set_current(jobs->stats);
+    log_capture_set_current(jobs->log);
+    if (slot->kind == PLAN_SLOT_SAMPLE) {
+        prepare_sample(slot_source(jobs->plan, jobs->sf2, slot), slot, jobs->cache,
+                       &jobs->prepared[index]);
+    }
+    log_capture_set_current(prev_log);
+    stats_set_current(prev_stats);
+}
+
+/*
+ * Materialisation pass: execute a plan against the loaded SF2 sample data,
+ * filling the bank tables and PCM. Sample slots land at their planned index;
+ * duplicates of earlier samples become aliases.
+ *
+ * With threads > 1, every sample slot is copied, resampled and hashed on a
+ * pool first; dedup and index assignment then run serially in slot order,
+ * so the bank is identical to the serial one. With a cache directory,
+ * resampled PCM is reused from earlier runs and stored for later ones.
+ */
+int materialise_plan(const struct ConversionPlan *plan, struct SF2Bank *sf2,
+                     struct WFBBank *wfb, const struct ConversionOptions *opts) {
+    struct SampleJobs jobs;
+    struct SampleCache cache;
+    int threads = opts ? opts->threads : 1;
+    int result = 0;
+    int i;
+
+    if (plan->program_count > wfb->program_capacity ||
+        plan->patch_count > wfb->patch_capacity) {
+        log_errorf("Error: WFB bank too small for the conversion plan\n");
+        return -1;
+    }
+
+    memcpy(wfb->programs, plan->programs,
+           (size_t)plan->program_count * sizeof(struct WaveFrontProgram));
+    memcpy(wfb->patches, plan->patches,
+           (size_t)plan->patch_count * sizeof(struct WaveFrontPatch));
+    wfb->program_count = plan->program_count;
+    wfb->patch_count = plan->patch_count;
+    if (plan->has_drumkit) {
+        wfb->drumkit = plan->drumkit;
+        wfb->has_drumkit = 1;
+    }
+
+    jobs.plan = plan;
+    jobs.sf2 = sf2;
+    jobs.stats = stats_current();
+    jobs.log = log_capture_current();
+    jobs.cache = NULL;
+    if (opts && opts->cache_dir) {
+        if (sample_cache_open(&cache, opts->cache_dir) != 0) {
+            return -1;
+        }
+        jobs.cache = &cache;
+    }
+    jobs.prepared = conv_calloc(sf2, (size_t)(plan->slot_count > 0 ? plan->slot_count : 1),
+                                sizeof(*jobs.prepared));
+    if (!jobs.prepared) {
+        log_errorf("Error: Failed to allocate sample preparation table\n");
+        return -1;
+    }
+
+    /* Serially, each slot is prepared just before it is merged */
+    int prepared_ahead = threads > 1 && plan->slot_count > 1;
+    if (prepared_ahead) {
+        struct ThreadPool *pool = threadpool_create(threads);
+        threadpool_parallel_for(pool, plan->slot_count, prepare_sample_job, &jobs);
+        threadpool_destroy(pool);
+    }
+
+    for (i = 0; i < plan->slot_count; i++) {
+        const struct PlanSlot *slot = &plan->slots[i];
+        int wfb_idx;
+
+        if (slot->kind == PLAN_SLOT_SAMPLE) {
+            if (!prepared_ahead) {
+                prepare_sample(slot_source(plan, sf2, slot), slot, jobs.cache,
+                               &jobs.prepared[i]);
+            }
+            long long span = trace_begin();
+            wfb_idx = materialise_sample(wfb, slot, &jobs.prepared[i]);
+            trace_end(span, "materialise_sample", "%.32s", slot->name);
+        } else {
+            int16_t numbers[NUM_MIDIKEYS];
+            memcpy(numbers, slot->data.multisample.nSampleNumber, sizeof(numbers));
+            wfb_idx = add_multisample_entry(wfb, numbers,
+                                            slot->data.multisample.nNumberOfSamples,
+                                            slot->name);
+        }
+
+        if (wfb_idx != i) {
+            log_errorf("Error: Failed to materialise sample %d (\"%s\")\n",
+                       i, slot->name);
+            result = -1;
+            break;
+        }
+    }
+
+    /* Release PCM not handed to the bank (failures, unmerged slots) */
+    for (i = 0; i < plan->slot_count; i++) {
+        mem_free(jobs.prepared[i].pcm);
+    }
+    conv_free(sf2, jobs.prepared);
+
+    if (jobs.cache && opts->verbose) {
+        log_printf("Sample cache: %d hit(s), %d miss(es), %d stored\n",
+                   atomic_load(&cache.hits), atomic_load(&cache.misses),
+                   atomic_load(&cache.stores));
+    }
+
+    return result;
+}
+
+/* Converted PCM hash of one slot, filled in the first time it is needed */
+struct SlotHash {
+    uint64_t hash;
+    int state;                       /* 0: not loaded, 1: hashed, -1: unreadable */
+};
+
+/* Load, convert and hash a slot's PCM at most once per estimate */
+static int plan_slot_hash(const struct ConversionPlan *plan, struct SF2Bank *sf2,
+                          struct SlotHash *hashes, int index, uint64_t *hash) {
+    struct SlotHash *h = &hashes[index];
+
+    if (h->state == 0) {
+        const struct PlanSlot *slot = &plan->slots[index];
+        int16_t *pcm = load_slot_pcm(slot_source(plan, sf2, slot), slot);
+
+        h->state = pcm ? 1 : -1;
+        h->hash = pcm ? hash_pcm_data(pcm, slot->samples) : 0;
+        mem_free(pcm);
+    }
+    *hash = h->hash;
+    return h->state > 0 ? 0 : -1;
+}
+
+/* Whether materialising slot b would turn it into an alias of stored slot a */
+static int plan_slots_identical(const struct ConversionPlan *plan, struct SF2Bank *sf2,
+                                struct SlotHash *hashes, int a_index, int b_index) {
+    const struct PlanSlot *a = &plan->slots[a_index];
+    const struct PlanSlot *b = &plan->slots[b_index];
+    const struct SAMPLE *sa = &a->data.sample;
+    const struct SAMPLE *sb = &b->data.sample;
+    uint64_t hash_a;
+    uint64_t hash_b;
+    int16_t *pcm_a;
+    int16_t *pcm_b;
+    int identical;
+
+    if (a->rate != b->rate || a->samples != b->samples || a->channel != b->channel) {
+        return 0;
+    }
+    if (!sample_offsets_equal(&sa->loopStartOffset, &sb->loopStartOffset) ||
+        !sample_offsets_equal(&sa->loopEndOffset, &sb->loopEndOffset) ||
+        !sample_offsets_equal(&sa->sampleStartOffset, &sb->sampleStartOffset) ||
+        !sample_offsets_equal(&sa->sampleEndOffset, &sb->sampleEndOffset) ||
+        sa->fLoop != sb->fLoop ||
+        sa->nFrequencyBias != sb->nFrequencyBias ||
+        sa->fSampleResolution != sb->fSampleResolution) {
+        return 0;
+    }
+    if (a->samples == 0) {
+        return 1;
+    }
+
+    /* Same source sample at the same rate and length: same PCM */
+    if (a->source == b->source && a->sf2_sample_idx == b->sf2_sample_idx) {
+        return 1;
+    }
+
+    /* Metadata matches: compare hashes, then the PCM only when they agree */
+    if (plan_slot_hash(plan, sf2, hashes, a_index, &hash_a) != 0 ||
+        plan_slot_hash(plan, sf2, hashes, b_index, &hash_b) != 0 ||
+        hash_a != hash_b) {
+        return 0;
+    }
+    stats_count(STAT_MEMCMP_CALLS, 1);
+    pcm_a = load_slot_pcm(slot_source(plan, sf2, a), a);
+    pcm_b = load_slot_pcm(slot_source(plan, sf2, b), b);
+    identical = pcm_a && pcm_b &&
+                memcmp(pcm_a, pcm_b, a->samples * sizeof(int16_t)) == 0;
+    mem_free(pcm_a);
+    mem_free(pcm_b);
+    return identical;
+}
+
+/*
+ * Resolve a plan's dedup outcome and output totals without materialising it.
+ * Only samples whose metadata matches an earlier stored sample have their
+ * PCM read, each at most once for its hash, so this works on banks opened
+ * with sf2_open_hydra().
+ */
+int estimate_plan(const struct ConversionPlan *plan, struct SF2Bank *sf2,
+                  struct PlanEstimate *est) {
+    struct SlotHash *hashes;
+    int *stored;
+    int stored_count = 0;
+
+    memset(est, 0, sizeof(*est));
+    est->program_count = plan->program_count;
+    est->patch_count = plan->patch_count;
+    est->sample_count = plan->slot_count;
+
+    est->file_size = sizeof(struct WaveFrontFileHeader) +
+                     plan->program_count * sizeof(struct WaveFrontProgram) +
+                     (plan->has_drumkit ? sizeof(struct WaveFrontDrumkit) : 0) +
+                     plan->patch_count * sizeof(struct WaveFrontPatch);
+
+    stored = conv_alloc(sf2, (plan->slot_count > 0 ? plan->slot_count : 1) * sizeof(int));
+    hashes = conv_calloc(sf2, plan->slot_count > 0 ? plan->slot_count : 1, sizeof(*hashes));
+    if (!stored || !hashes) {
+        conv_free(sf2, stored);
+        conv_free(sf2, hashes);
+        return -1;
+    }
+
+    for (int i = 0; i < plan->slot_count; i++) {
+        const struct PlanSlot *slot = &plan->slots[i];
+        int alias = 0;
+
+        est->file_size += sizeof(struct WaveFrontExtendedSampleInfo) + MAX_PATH_LENGTH;
+
+        if (slot->kind == PLAN_SLOT_MULTISAMPLE) {
+            est->multisample_count++;
+            est->file_size += sizeof(struct MULTISAMPLE);
+            continue;
+        }
+
+        for (int j = 0; j < stored_count; j++) {
+            if (plan_slots_identical(plan, sf2, hashes, stored[j], i)) {
+                alias = 1;
+                break;
+            }
+        }
+
+        if (alias) {
+            est->alias_count++;
+            est->file_size += sizeof(struct ALIAS);
+        } else {
+            stored[stored_count++] = i;
+            est->stored_samples++;
+            est->memory_required += slot->samples * sizeof(int16_t);
+            est->file_size += sizeof(struct SAMPLE) + slot->samples * sizeof(int16_t);
+        }
+    }
+
+    conv_free(sf2, hashes);
+    conv_free(sf2, stored);
+    return 0;
+}
+
+/* Close a conversion's source bank and release its arena for the next file */
+static void close_source(struct SF2Bank *sf2) {
+    struct Arena *arena = sf2->arena;
+
+    sf2_close(sf2);
+    if (arena) {
+        arena_reset(arena);
+    }
+}
+
+/* Plan a conversion from the hydra only and print what it would produce */
+int preview_sf2_conversion(const char *input_file, struct ConversionOptions *opts) {
+    struct SF2Bank sf2;
+    struct ConversionPlan *plan;
+    struct PlanEstimate est;
+
+    if (sf2_open_arena(input_file, &sf2, arena_thread(), 0) != 0) {
+        return -1;
+    }
+
+    plan = conv_alloc(&sf2, sizeof(*plan));
+    if (!plan) {
+        log_errorf("Error: Failed to allocate conversion plan\n");
+        close_source(&sf2);
+        return -1;
+    }
+
+    if (plan_conversion(&sf2, opts, plan) != 0) {
+        plan_release_sources(plan, &sf2);
+        conv_free(&sf2, plan);
+        close_source(&sf2);
+        return -1;
+    }
+    if (estimate_plan(plan, &sf2, &est) != 0) {
+        log_errorf("Error: Failed to estimate conversion plan\n");
+        plan_release_sources(plan, &sf2);
+        conv_free(&sf2, plan);
+        close_source(&sf2);
+        return -1;
+    }
+
+    log_printf("Conversion plan: '%s'\n", input_file);
+    log_printf("  Programs: %d, Patches: %d, Samples: %d\n",
+               est.program_count, est.patch_count, est.sample_count);
+    log_printf("  Stored: %d, Aliases: %d, Multisamples: %d\n",
+               est.stored_samples, est.alias_count, est.multisample_count);
+    log_printf("  Drum kit: %s\n", plan->has_drumkit ? "Yes" : "No");
+    if (plan->resample_count > 0) {
+        log_printf("  To resample: %d samples\n", plan->resample_count);
+    }
+    if (plan->slots_refused > 0) {
+        log_printf("  Over sample limit: %d samples not converted\n", plan->slots_refused);
+    }
+    log_printf("  RAM Required: %u bytes (%.2f MB)\n",
+               est.memory_required, est.memory_required / (1024.0 * 1024.0));
+    log_printf("  File size: %u bytes\n", est.file_size);
+
+    if (opts->result) {
+        struct ConversionResult *r = opts->result;
+        memset(r, 0, sizeof(*r));
+        r->program_count = est.program_count;
+        r->patch_count = est.patch_count;
+        r->sample_count = est.sample_count;
+        r->alias_count = est.alias_count;
+        r->multisample_count = est.multisample_count;
+        r->resampled_count = plan->resample_count;
+        r->samples_refused = plan->slots_refused;
+        r->has_drumkit = plan->has_drumkit;
+        r->memory_required = est.memory_required;
+        r->file_size = est.file_size;
+    }
+
+    plan_release_sources(plan, &sf2);
+    conv_free(&sf2, plan);
+    close_source(&sf2);
+    return 0;
+}
+
+/* Convert an opened SF2 into a bank; the source is closed either way */
+static int convert_source_to_bank(struct SF2Bank *sf2, const struct ConversionOptions *opts,
+                                  struct WFBBank *wfb, int *resampled_count) {
+    struct ConversionPlan *plan;
+    int discarded_samples = 0;
+
+    plan = conv_alloc(sf2, sizeof(*plan));
+    if (!plan) {
+        log_errorf("Error: Failed to allocate conversion plan\n");
+        close_source(sf2);
+        return -1;
+    }
+
+    /* Decide bank contents, size the bank to them, then copy/resample PCM */
+    if (plan_conversion(sf2, opts, plan) != 0) {
+        plan_release_sources(plan, sf2);
+        conv_free(sf2, plan);
+        close_source(sf2);
+        return -1;
+    }
+    if (resampled_count) {
+        *resampled_count = plan->resample_count;
+    }
+    if (init_wfb_bank(wfb, opts->device_name ? opts->device_name : "Maui",
+                      plan->program_count, plan->patch_count, plan->slot_count) != 0) {
+        plan_release_sources(plan, sf2);
+        conv_free(sf2, plan);
+        close_source(sf2);
+        return -1;
+    }
+    if (materialise_plan(plan, sf2, wfb, opts) != 0) {
+        plan_release_sources(plan, sf2);
+        conv_free(sf2, plan);
+        close_source(sf2);
+        free_wfb_bank(wfb);
+        return -1;
+    }
+    plan_release_sources(plan, sf2);
+    conv_free(sf2, plan);
+
+    /* The bank owns its PCM now; the source is no longer needed */
+    close_source(sf2);
+
     /* Check sample limit */
-    if (wfb.sample_count > WF_MAX_SAMPLES) {
-        discarded_samples = wfb.sample_count - WF_MAX_SAMPLES;
-        wfb.sample_count = WF_MAX_SAMPLES;
-        printf("Warning: Source exceeded 512 sample limit. "
-               "%d samples were discarded.\n", discarded_samples);
+    if (wfb->sample_count > WF_MAX_SAMPLES) {
+        discarded_samples = wfb->sample_count - WF_MAX_SAMPLES;
+        wfb->sample_count = WF_MAX_SAMPLES;
+        log_printf("Warning: Source exceeded 512 sample limit. "
+                   "%d samples were discarded.\n", discarded_samples);
+    }
+
+    wfb_update_header(wfb);
+    return 0;
+}
+
+/* Convert an SF2 into an in-memory bank with its header filled in */
+int convert_sf2_to_bank(const char *input_file, const struct ConversionOptions *opts,
+                        struct WFBBank *wfb, int *resampled_count) {
+    struct SF2Bank sf2;
+
+    /* Open SF2 file */
+    if (sf2_open_arena(input_file, &sf2, arena_thread(), 1) != 0) {
+        return -1;
+    }
+    return convert_source_to_bank(&sf2, opts, wfb, resampled_count);
+}
+
+/* As convert_sf2_to_bank(), reading the SF2 from a seekable stream it takes over */
+int convert_sf2_stream_to_bank(FILE *input, const struct ConversionOptions *opts,
+                               struct WFBBank *wfb, int *resampled_count) {
+    struct SF2Bank sf2;
+
+    if (sf2_open_stream(input, &sf2, arena_thread(), 1) != 0) {
+        return -1;
     }
+    return convert_source_to_bank(&sf2, opts, wfb, resampled_count);
+}
+
+/* Main conversion function */
+int convert_sf2_to_wfb(const char *input_file, const char *output_file,
+                       struct ConversionOptions *opts) {
+    struct WFBBank wfb;
+    int resampled_count = 0;
+    uint32_t memory_limit;
 
-    /* Update header counts */
-    wfb.header.wProgramCount = wfb.program_count;
-    wfb.header.wPatchCount = wfb.patch_count;
-    wfb.header.wSampleCount = wfb.sample_count;
-    wfb.header.wDrumkitCount = wfb.has_drumkit ? 1 : 0;
-    wfb.header.dwMemoryRequired = wfb.total_sample_memory;
+    if (convert_sf2_to_bank(input_file, opts, &wfb, &resampled_count) != 0) {
+        return -1;
+    }
 
     /* Check memory limit */
     memory_limit = get_device_memory_limit(wfb.header.szSynthName);
     if (wfb.total_sample_memory > memory_limit) {
-        printf("Warning: Total sample memory (%u bytes) exceeds %s limit (%u bytes)\n",
-               wfb.total_sample_memory, wfb.header.szSynthName, memory_limit);
+        log_printf("Warning: Total sample memory (%u bytes) exceeds %s limit (%u bytes)\n",
+                   wfb.total_sample_memory, wfb.header.szSynthName, memory_limit);
     }
 
     /* Write WFB file */
-    const char *final_output = output_file ? output_file : get_auto_increment_filename(output_file);
+    char auto_output[512];
+    const char *final_output = output_file ? output_file :
+                               get_auto_increment_filename(output_file, auto_output, sizeof(auto_output));
     if (wfb_write(final_output, &wfb) != 0) {
-        sf2_close(&sf2);
-        free_conversion_context(&ctx);
+        free_wfb_bank(&wfb);
         return -1;
     }
 
-    printf("Conversion complete: '%s' -> '%s'\n", input_file, final_output);
-    printf("  Programs: %d, Patches: %d, Samples: %d\n",
-           wfb.program_count, wfb.patch_count, wfb.sample_count);
-    if (ctx.dedupe_alias_count > 0) {
-        printf("  Deduped samples (aliases): %d\n", ctx.dedupe_alias_count);
+    log_printf("Conversion complete: '%s' -> '%s'\n", input_file, final_output);
+    log_printf("  Programs: %d, Patches: %d, Samples: %d\n",
+               wfb.program_count, wfb.patch_count, wfb.sample_count);
+    if (wfb.alias_count > 0) {
+        log_printf("  Deduped samples (aliases): %d\n", wfb.alias_count);
     }
     if (resampled_count > 0) {
-        printf("  Resampled: %d samples\n", resampled_count);
+        log_printf("  Resampled: %d samples\n", resampled_count);
     }
 
     /* Print info */
     wfb_print_info(&wfb);
 
-    /* Cleanup */
-    sf2_close(&sf2);
-    for (i = 0; i < wfb.sample_count; i++) {
-        free(wfb.samples[i].pcm_data);
+    if (opts->result) {
+        struct ConversionResult *r = opts->result;
+        memset(r, 0, sizeof(*r));
+        r->program_count = wfb.program_count;
+        r->patch_count = wfb.patch_count;
+        r->sample_count = wfb.sample_count;
+        r->alias_count = wfb.alias_count;
+        for (int i = 0; i < wfb.sample_count; i++) {
+            if (wfb.samples[i].info.nSampleType == WF_ST_MULTISAMPLE) {
+                r->multisample_count++;
+            }
+        }
+        r->resampled_count = resampled_count;
+        r->has_drumkit = wfb.has_drumkit;
+        r->memory_required = wfb.total_sample_memory;
     }
-    free_conversion_context(&ctx);
+
+    /* Cleanup */
+    free_wfb_bank(&wfb);
 
     return 0;
 }
@@ -0,0 +1,172 @@
+/*
+ * logging.c - Console output with optional per-thread capture
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/logging.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Capture owned by the current thread, if any */
+static _Thread_local struct LogCapture *current_capture;
+
+int log_printf(const char *fmt, ...) {
+    FILE *stream = current_capture ? current_capture->out_stream : stdout;
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vfprintf(stream, fmt, args);
+    va_end(args);
+    return n;
+}
+
+int log_errorf(const char *fmt, ...) {
+    FILE *stream = current_capture ? current_capture->err_stream : stderr;
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vfprintf(stream, fmt, args);
+    va_end(args);
+    return n;
+}
+
+size_t log_json_escape(const char *s, char *dest, size_t dest_size) {
+    size_t len = 0;
+
+    if (dest_size == 0) {
+        return 0;
+    }
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        char escape[7];
+        size_t n;
+
+        if (c == '"' || c == '\\') {
+            n = (size_t)snprintf(escape, sizeof(escape), "\\%c", c);
+        } else if (c < 0x20 || c >= 0x80) {
+            n = (size_t)snprintf(escape, sizeof(escape), "\\u%04x", c);
+        } else {
+            escape[0] = (char)c;
+            n = 1;
+        }
+        if (len + n >= dest_size) {
+            break;
+        }
+        memcpy(dest + len, escape, n);
+        len += n;
+    }
+    dest[len] = '\0';
+    return len;
+}
+
+void log_json_string(const char *s) {
+    size_t size = strlen(s) * 6 + 1;
+    char *escaped = malloc(size);
+
+    if (!escaped) {
+        log_printf("\"\"");
+        return;
+    }
+    log_json_escape(s, escaped, size);
+    log_printf("\"%s\"", escaped);
+    free(escaped);
+}
+
+int log_capture_begin(struct LogCapture *cap) {
+    memset(cap, 0, sizeof(*cap));
+
+    cap->out_stream = open_memstream(&cap->out, &cap->out_len);
+    if (!cap->out_stream) {
+        return -1;
+    }
+    cap->err_stream = open_memstream(&cap->err, &cap->err_len);
+    if (!cap->err_stream) {
+        fclose(cap->out_stream);
+        free(cap->out);
+        memset(cap, 0, sizeof(*cap));
+        return -1;
+    }
+
+    cap->prev = current_capture;
+    current_capture = cap;
+    return 0;
+}
+
+void log_capture_end(struct LogCapture *cap) {
+    if (current_capture == cap) {
+        current_capture = cap->prev;
+    }
+    if (cap->out_stream) {
+        fclose(cap->out_stream);
+        cap->out_stream = NULL;
+    }
+    if (cap->err_stream) {
+        fclose(cap->err_stream);
+        cap->err_stream = NULL;
+    }
+}
+
+struct LogCapture *log_capture_current(void) {
+    return current_capture;
+}
+
+void log_capture_set_current(struct LogCapture *cap) {
+    current_capture = cap;
+}
+
+void log_capture_flush(struct LogCapture *cap) {
+    if (cap->out_len > 0) {
+        fwrite(cap->out, 1, cap->out_len, stdout);
+        fflush(stdout);
+    }
+    if (cap->err_len > 0) {
+        fwrite(cap->err, 1, cap->err_len, stderr);
+    }
+    free(cap->out);
+    free(cap->err);
+    memset(cap, 0, sizeof(*cap));
+}
+
+/* Last line of text[0, len) starting with prefix, or NULL */
+static const char *last_line_with(const char *text, size_t len, const char *prefix,
+                                  size_t *line_len_out) {
+    size_t prefix_len = strlen(prefix);
+    const char *found = NULL;
+    size_t pos = 0;
+
+    while (text && pos < len) {
+        const char *line = text + pos;
+        const char *nl = memchr(line, '\n', len - pos);
+        size_t line_len = nl ? (size_t)(nl - line) : len - pos;
+
+        if (line_len >= prefix_len && memcmp(line, prefix, prefix_len) == 0) {
+            found = line;
+            *line_len_out = line_len;
+        }
+        pos += line_len + 1;
+    }
+    return found;
+}
+
+int log_capture_last_line(const struct LogCapture *cap, const char *prefix,
+                          char *dest, size_t dest_size) {
+    size_t len = 0;
+    const char *line = last_line_with(cap->err, cap->err_len, prefix, &len);
+
+    if (!line) {
+        line = last_line_with(cap->out, cap->out_len, prefix, &len);
+    }
+    if (!line || dest_size == 0) {
+        return 0;
+    }
+    if (len >= dest_size) {
+        len = dest_size - 1;
+    }
+    memcpy(dest, line, len);
+    dest[len] = '\0';
+    return 1;
+}
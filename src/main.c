@@ -6,17 +6,30 @@
  */
 
 #include "../include/converter.h"
+#include "../include/logging.h"
 #include "../include/viability.h"
+#include "../include/threadpool.h"
+#include "../include/manifest.h"
+#include "../include/merge.h"
+#include "../include/report.h"
+#include "../include/server.h"
+#include "../include/stats.h"
+#include "../include/trace.h"
+#include "../include/watch.h"
+#include "../include/wfb_index.h"
+#include "../include/wfb_verify.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <glob.h>
+#include <pthread.h>
 
 /* Forward declarations */
 extern int is_valid_device_name(const char *name);
 extern const char *normalize_device_name(const char *name);
 extern int wfb_retarget(const char *filename, const char *new_device);
+extern void safe_string_copy(char *dest, const char *src, size_t dest_size);
 
 /* Usage information */
 static void print_usage(const char *prog_name) {
@@ -32,6 +45,28 @@ static void print_usage(const char *prog_name) {
     printf("  -v, --verbose            Enable verbose warnings and detailed assessment\n");
     printf("  -y, --yes                Skip assessment prompt, always proceed\n");
     printf("      --no-assess          Skip viability assessment entirely\n");
+    printf("  -n, --dry-run            Plan the conversion and report it, write nothing\n");
+    printf("  -t, --threads <n>        Worker threads per conversion (0 = one per CPU)\n");
+    printf("                           Default: 1. Output is identical for any value\n");
+    printf("  -j, --jobs <n>           Convert up to n files at once (0 = one per CPU)\n");
+    printf("                           Logs print per file, in input order; implies -y\n");
+    printf("      --cache <dir>        Reuse resampled sample data across runs\n");
+    printf("      --manifest <file>    Skip outputs whose inputs and options are unchanged\n");
+    printf("      --stats[=json]       Report phase timings and counters per file\n");
+    printf("      --format <text|json> Print each file's assessment, counts, device fit\n");
+    printf("                           and timings as one JSON line (implies -y)\n");
+    printf("      --trace <file>       Write a Chrome/Perfetto trace of the run\n");
+    printf("      --index              Keep a <file>.idx record index beside each WFB,\n");
+    printf("                           reused by --merge to read single records\n");
+    printf("      --merge <out.wfb>    Merge programs of the inputs into one bank; inputs\n");
+    printf("                           may select, e.g. pianos.wfb:0-7 kit.sf2:drums\n");
+    printf("      --verify             Check .wfb inputs' references, layout and totals\n");
+    printf("                           With only .wfb inputs, runs one file per CPU\n");
+    printf("                           unless -j is given\n");
+    printf("      --watch <dir>        Convert .sf2 files as they are written into dir\n");
+    printf("                           until interrupted; -j files at once\n");
+    printf("      --serve <socket>     Convert requests sent to a UNIX socket; -d, -t and\n");
+    printf("                           --cache set defaults, -j the concurrent jobs\n");
     printf("  -h, --help               Show this help message\n");
     printf("\nExamples:\n");
     printf("  %s piano.sf2\n", prog_name);
@@ -39,6 +74,7 @@ static void print_usage(const char *prog_name) {
     printf("  %s -D drums.sf2 melodic.sf2\n", prog_name);
     printf("  %s -p violin.sf2:40 orchestra.sf2\n", prog_name);
     printf("  %s -o custom.wfb bank.sf2\n", prog_name);
+    printf("  %s --merge combo.wfb piano.wfb:0-7 strings.sf2:40-51,drums\n", prog_name);
     printf("\nFile Operations:\n");
     printf("  .sf2 input:  Conversion mode\n");
     printf("  .wfb input:  Verification/modification mode\n");
@@ -58,8 +94,8 @@ static int has_extension(const char *filename, const char *ext) {
 }
 
 /* Get output filename from input filename, preserving extension case */
-static const char *get_output_filename(const char *input, const char *explicit_output) {
-    static char result[512];
+static const char *get_output_filename(const char *input, const char *explicit_output,
+                                       char *result, size_t result_size) {
     const char *dot;
     const char *ext;
     char wfb_ext[8];
@@ -69,6 +105,11 @@ static const char *get_output_filename(const char *input, const char *explicit_o
         return explicit_output;
     }
 
+    /* Room for the whole input name plus ".wfb" */
+    if (strlen(input) + 5 > result_size) {
+        return NULL;
+    }
+
     /* Find extension */
     dot = strrchr(input, '.');
     if (dot) {
@@ -124,75 +165,166 @@ static const char *get_output_filename(const char *input, const char *explicit_o
     return result;
 }
 
-/* Process a single file */
-static int process_file(const char *filename, struct ConversionOptions *opts,
-                       int assess, int interactive,
-                       int *converted, int *failed) {
+/* Refresh the .idx sidecar of a WFB (--index); a stale or missing one is rebuilt */
+static void index_wfb(const char *filename) {
+    struct WFBIndex index;
+
+    if (wfb_index_load(filename, &index) != 0) {
+        if (wfb_index_build(filename, &index) != 0 || wfb_index_save(filename, &index) != 0) {
+            log_errorf("Warning: Could not index '%s'\n", filename);
+            wfb_index_free(&index);
+            return;
+        }
+    }
+    log_printf("Indexed %d sample record(s): %s.idx\n", index.sample_count, filename);
+    wfb_index_free(&index);
+}
+
+/*
+ * Process a single file. With a file_report, results are collected there for
+ * --format json instead of the assessment being printed.
+ */
+static int process_file_inner(const char *filename, struct ConversionOptions *opts,
+                              int assess, int interactive, struct Manifest *manifest,
+                              int *converted, int *failed, struct FileReport *file_report) {
     int result = 0;
 
     if (has_extension(filename, ".sf2")) {
         /* Conversion mode */
-        const char *output = get_output_filename(filename, opts->output_file);
+        char output_buf[512];
+        const char *output = get_output_filename(filename, opts->output_file,
+                                                 output_buf, sizeof(output_buf));
         const char *device = opts->device_name ? opts->device_name : "Maui";
 
+        if (!output) {
+            log_errorf("Error: Input path too long '%s'\n", filename);
+            (*failed)++;
+            return -1;
+        }
+        if (file_report && !opts->dry_run) {
+            safe_string_copy(file_report->output, output, sizeof(file_report->output));
+        }
+
+        /* Incremental rebuild: nothing to do if inputs and options are unchanged */
+        if (manifest && !opts->dry_run &&
+            manifest_is_current(manifest, output, filename, opts)) {
+            log_printf("Up to date: %s -> %s\n", filename, output);
+            if (file_report) {
+                file_report->status = "up_to_date";
+            }
+            (*converted)++;
+            return 0;
+        }
+
         /* Viability assessment */
         if (assess) {
             struct ViabilityReport report;
             struct ViabilityConfig config = {
                 .verbose = opts->verbose,
                 .interactive = interactive,
-                .auto_yes = !interactive
+                .auto_yes = !interactive,
+                .conversion = opts
             };
 
-            printf("Assessing conversion viability for: %s\n\n", filename);
+            log_printf("Assessing conversion viability for: %s\n\n", filename);
 
-            if (assess_sf2_viability(filename, &report, &config) != 0) {
-                fprintf(stderr, "Error: Assessment failed\n");
+            long long assess_start = stats_phase_begin();
+            int assess_result = assess_sf2_viability(filename, &report, &config);
+            stats_phase_end(STAT_ASSESS, assess_start);
+            if (assess_result != 0) {
+                log_errorf("Error: Assessment failed\n");
                 (*failed)++;
                 return -1;
             }
 
-            /* Print report */
-            if (opts->verbose) {
+            /* Keep the report for JSON output, or print it */
+            if (file_report) {
+                file_report->viability = report;
+                file_report->assessed = 1;
+            } else if (opts->verbose) {
                 print_viability_verbose(&report);
             } else {
                 print_viability_summary(&report);
             }
 
-            /* Prompt user if interactive and warnings exist */
-            if (interactive && report.warning_count > 0) {
+            /* Prompt user if interactive and warnings exist; a dry run writes nothing */
+            if (interactive && !opts->dry_run && report.warning_count > 0) {
                 if (!prompt_user_proceed(&report)) {
-                    printf("Conversion cancelled.\n");
+                    log_printf("Conversion cancelled.\n");
                     free_viability_report(&report);
                     return 0;  /* Not a failure, user chose to cancel */
                 }
             }
 
-            free_viability_report(&report);
-            printf("\n");
+            if (!file_report) {
+                free_viability_report(&report);
+            }
+            log_printf("\n");
         }
 
-        /* Proceed with conversion */
-        printf("Converting: %s -> %s\n", filename, output);
-
         /* Set device name for conversion if not specified */
         struct ConversionOptions conv_opts = *opts;
         conv_opts.device_name = device;
+        conv_opts.result = file_report ? &file_report->result : NULL;
+
+        /* Dry run: plan from the hydra only */
+        if (opts->dry_run) {
+            if (preview_sf2_conversion(filename, &conv_opts) == 0) {
+                if (file_report) {
+                    file_report->status = "planned";
+                    file_report->has_result = 1;
+                }
+                (*converted)++;
+            } else {
+                (*failed)++;
+                result = -1;
+            }
+            return result;
+        }
+
+        /* Proceed with conversion */
+        log_printf("Converting: %s -> %s\n", filename, output);
 
         if (convert_sf2_to_wfb(filename, output, &conv_opts) == 0) {
+            if (file_report) {
+                file_report->status = "converted";
+                file_report->has_result = 1;
+            }
             (*converted)++;
+            if (opts->write_index) {
+                index_wfb(output);
+            }
+            if (manifest && manifest_record(manifest, output, filename, opts) != 0) {
+                log_errorf("Warning: Could not record '%s' in the build manifest\n", output);
+            }
         } else {
-            fprintf(stderr, "Error: Failed to convert '%s'\n", filename);
+            log_errorf("Error: Failed to convert '%s'\n", filename);
             (*failed)++;
             result = -1;
         }
     }
     else if (has_extension(filename, ".wfb")) {
         /* Verification or modification mode */
-        if (opts->device_name) {
+        if (opts->verify) {
+            /* Deep verification */
+            struct WFBVerifyReport report;
+            if (wfb_verify(filename, &report, opts->verbose) == 0) {
+                log_printf("Verified: %s (%d warning(s))\n", filename, report.warnings);
+                (*converted)++;
+            } else {
+                log_errorf("Error: '%s' failed verification (%d error(s))\n",
+                           filename, report.errors);
+                (*failed)++;
+                result = -1;
+            }
+            wfb_verify_summary_add(opts->verify, filename, &report);
+        } else if (opts->device_name) {
             /* Retarget mode */
             if (wfb_retarget(filename, opts->device_name) == 0) {
                 (*converted)++;
+                if (opts->write_index) {
+                    index_wfb(filename);
+                }
             } else {
                 (*failed)++;
                 result = -1;
@@ -202,7 +334,11 @@ static int process_file(const char *filename, struct ConversionOptions *opts,
             struct WFBBank bank;
             if (wfb_read(filename, &bank) == 0) {
                 wfb_print_info(&bank);
+                free_wfb_bank(&bank);
                 (*converted)++;
+                if (opts->write_index) {
+                    index_wfb(filename);
+                }
             } else {
                 (*failed)++;
                 result = -1;
@@ -210,7 +346,7 @@ static int process_file(const char *filename, struct ConversionOptions *opts,
         }
     }
     else {
-        fprintf(stderr, "Error: Unknown file type '%s' (expected .sf2 or .wfb)\n", filename);
+        log_errorf("Error: Unknown file type '%s' (expected .sf2 or .wfb)\n", filename);
         (*failed)++;
         result = -1;
     }
@@ -218,6 +354,217 @@ static int process_file(const char *filename, struct ConversionOptions *opts,
     return result;
 }
 
+/* --format json: run silently, then print the file's results as one JSON line */
+static int process_file_json(const char *filename, struct ConversionOptions *opts,
+                             int assess, struct Manifest *manifest,
+                             int *converted, int *failed) {
+    struct FileReport *report = calloc(1, sizeof(*report));
+    struct LogCapture cap;
+    int failed_before = *failed;
+    int captured;
+    int result;
+
+    if (!report) {
+        log_errorf("Error: Failed to allocate report for '%s'\n", filename);
+        (*failed)++;
+        return -1;
+    }
+    report->file = filename;
+
+    stats_init(&report->stats);
+    stats_set_current(&report->stats);
+    captured = log_capture_begin(&cap) == 0;
+    long long start = stats_now_ns();
+    result = process_file_inner(filename, opts, assess, 0, manifest,
+                                converted, failed, report);
+    report->stats.wall_ns = stats_now_ns() - start;
+    report->stats.peak_rss = stats_peak_rss();
+    stats_set_current(NULL);
+
+    if (captured) {
+        log_capture_end(&cap);
+        log_capture_last_line(&cap, "Error:", report->error, sizeof(report->error));
+        free(cap.out);
+        free(cap.err);
+    }
+    if (*failed > failed_before) {
+        report->status = "failed";
+    } else if (!report->status) {
+        report->status = "ok";
+    }
+
+    file_report_print_json(report);
+    if (report->assessed) {
+        free_viability_report(&report->viability);
+    }
+    free(report);
+    return result;
+}
+
+/* Process a single file, timing it when --stats or --trace is on */
+static int process_file(const char *filename, struct ConversionOptions *opts,
+                       int assess, int interactive, struct Manifest *manifest,
+                       int *converted, int *failed) {
+    struct ConversionStats stats;
+    long long span = trace_begin();
+    int result;
+
+    if (opts->output_format == FORMAT_JSON) {
+        result = process_file_json(filename, opts, assess, manifest, converted, failed);
+        trace_end(span, "process_file", "%s", filename);
+        return result;
+    }
+
+    if (opts->stats_format == STATS_NONE) {
+        result = process_file_inner(filename, opts, assess, interactive, manifest,
+                                    converted, failed, NULL);
+        trace_end(span, "process_file", "%s", filename);
+        return result;
+    }
+
+    stats_init(&stats);
+    stats_set_current(&stats);
+    long long start = stats_now_ns();
+    result = process_file_inner(filename, opts, assess, interactive, manifest,
+                                converted, failed, NULL);
+    stats.wall_ns = stats_now_ns() - start;
+    stats.peak_rss = stats_peak_rss();
+    stats_set_current(NULL);
+
+    trace_end(span, "process_file", "%s", filename);
+    stats_print(&stats, filename, opts->stats_format);
+    return result;
+}
+
+/* One input of a parallel batch */
+struct BatchJob {
+    const char *filename;
+    struct LogCapture log;
+    int converted;
+    int failed;
+    int done;
+};
+
+/* Parallel batch: files convert concurrently, logs print in input order */
+struct Batch {
+    struct BatchJob *jobs;
+    int count;
+    struct ConversionOptions *opts;
+    int assess;
+    struct Manifest *manifest;
+    pthread_mutex_t lock;
+    int next_to_print;
+};
+
+static void batch_file_job(void *arg, int index) {
+    struct Batch *batch = arg;
+    struct BatchJob *job = &batch->jobs[index];
+    int captured = log_capture_begin(&job->log) == 0;
+
+    /* Prompts cannot be answered while other files are converting */
+    process_file(job->filename, batch->opts, batch->assess, 0, batch->manifest,
+                 &job->converted, &job->failed);
+
+    if (captured) {
+        log_capture_end(&job->log);
+    }
+
+    /* Release every finished log that is next in input order */
+    pthread_mutex_lock(&batch->lock);
+    job->done = 1;
+    while (batch->next_to_print < batch->count &&
+           batch->jobs[batch->next_to_print].done) {
+        log_capture_flush(&batch->jobs[batch->next_to_print].log);
+        batch->next_to_print++;
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/* Convert files, up to jobs at once; logs print per file, in list order */
+static void run_batch(char **inputs, int input_count, struct ConversionOptions *opts,
+                      int assess, int interactive, struct Manifest *manifest, int jobs,
+                      int *converted, int *failed) {
+    struct Batch batch;
+    int i;
+
+    if (jobs <= 1 || input_count <= 1) {
+        for (i = 0; i < input_count; i++) {
+            process_file(inputs[i], opts, assess, interactive, manifest, converted, failed);
+        }
+        return;
+    }
+
+    batch.jobs = calloc((size_t)input_count, sizeof(*batch.jobs));
+    if (!batch.jobs) {
+        fprintf(stderr, "Error: Failed to allocate batch\n");
+        *failed += input_count;
+        return;
+    }
+    batch.count = input_count;
+    batch.opts = opts;
+    batch.assess = assess;
+    batch.manifest = manifest;
+    batch.next_to_print = 0;
+    pthread_mutex_init(&batch.lock, NULL);
+    for (i = 0; i < input_count; i++) {
+        batch.jobs[i].filename = inputs[i];
+    }
+
+    struct ThreadPool *pool = threadpool_create(jobs < input_count ? jobs : input_count);
+    threadpool_parallel_for(pool, input_count, batch_file_job, &batch);
+    threadpool_destroy(pool);
+
+    for (i = 0; i < input_count; i++) {
+        *converted += batch.jobs[i].converted;
+        *failed += batch.jobs[i].failed;
+    }
+    pthread_mutex_destroy(&batch.lock);
+    free(batch.jobs);
+}
+
+/* Settings shared by every batch of a --watch run */
+struct WatchRun {
+    struct ConversionOptions *opts;
+    int assess;
+    struct Manifest *manifest;
+    int jobs;
+    int converted;
+    int failed;
+};
+
+/* Convert one settled set of watched files, then persist the manifest */
+static void watch_batch(void *arg, char **paths, int count) {
+    struct WatchRun *run = arg;
+
+    run_batch(paths, count, run->opts, run->assess, 0, run->manifest, run->jobs,
+              &run->converted, &run->failed);
+    if (run->manifest && manifest_save(run->manifest) != 0) {
+        run->failed++;
+    }
+}
+
+/* Add a path to the input list */
+static int append_input(char ***inputs, int *count, int *capacity, const char *path) {
+    if (*count >= *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 16;
+        char **grown = realloc(*inputs, (size_t)new_capacity * sizeof(char *));
+        if (!grown) {
+            return -1;
+        }
+        *inputs = grown;
+        *capacity = new_capacity;
+    }
+
+    size_t len = strlen(path) + 1;
+    char *copy = malloc(len);
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, path, len);
+    (*inputs)[(*count)++] = copy;
+    return 0;
+}
+
 /* Main function */
 int main(int argc, char *argv[]) {
     struct ConversionOptions opts;
@@ -235,6 +582,19 @@ int main(int argc, char *argv[]) {
         {"verbose",    no_argument,       0, 'v'},
         {"yes",        no_argument,       0, 'y'},
         {"no-assess",  no_argument,       0, 1000},
+        {"dry-run",    no_argument,       0, 'n'},
+        {"threads",    required_argument, 0, 't'},
+        {"jobs",       required_argument, 0, 'j'},
+        {"cache",      required_argument, 0, 1001},
+        {"manifest",   required_argument, 0, 1002},
+        {"stats",      optional_argument, 0, 1003},
+        {"trace",      required_argument, 0, 1004},
+        {"index",      no_argument,       0, 1005},
+        {"verify",     no_argument,       0, 1006},
+        {"merge",      required_argument, 0, 1007},
+        {"serve",      required_argument, 0, 1008},
+        {"watch",      required_argument, 0, 1009},
+        {"format",     required_argument, 0, 1010},
         {"help",       no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
@@ -242,13 +602,22 @@ int main(int argc, char *argv[]) {
     /* Initialize options */
     memset(&opts, 0, sizeof(opts));
     opts.device_name = NULL;  /* Default - will be set to Maui for conversions */
+    opts.threads = 1;
 
     /* Assessment flags (local to main) */
     int assess_viability = 1;      /* Default: always assess */
     int interactive_prompt = 1;    /* Default: prompt if warnings */
+    int batch_jobs = 1;            /* Files converted concurrently */
+    const char *manifest_path = NULL;
+    const char *trace_path = NULL;
+    int jobs_given = 0;
+    int verify = 0;
+    const char *merge_output = NULL;
+    const char *serve_socket = NULL;
+    const char *watch_dir = NULL;
 
     /* Parse command-line arguments */
-    while ((opt = getopt_long(argc, argv, "d:D:p:o:vyh", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:D:p:o:t:j:vynh", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'd':
                 if (!is_valid_device_name(optarg)) {
@@ -293,6 +662,35 @@ int main(int argc, char *argv[]) {
                 opts.verbose = 1;
                 break;
 
+            case 'n':
+                opts.dry_run = 1;
+                break;
+
+            case 't':
+                {
+                    char *end;
+                    long threads = strtol(optarg, &end, 10);
+                    if (*optarg == '\0' || *end != '\0' || threads < 0) {
+                        fprintf(stderr, "Error: Invalid thread count '%s'\n", optarg);
+                        return 1;
+                    }
+                    opts.threads = threadpool_resolve_count(threads > 4096 ? 4096 : (int)threads);
+                }
+                break;
+
+            case 'j':
+                {
+                    char *end;
+                    long jobs = strtol(optarg, &end, 10);
+                    if (*optarg == '\0' || *end != '\0' || jobs < 0) {
+                        fprintf(stderr, "Error: Invalid job count '%s'\n", optarg);
+                        return 1;
+                    }
+                    batch_jobs = threadpool_resolve_count(jobs > 4096 ? 4096 : (int)jobs);
+                    jobs_given = 1;
+                }
+                break;
+
             case 'y':
                 interactive_prompt = 0;  /* Skip prompt, always proceed */
                 break;
@@ -301,6 +699,60 @@ int main(int argc, char *argv[]) {
                 assess_viability = 0;
                 break;
 
+            case 1001:  /* --cache */
+                opts.cache_dir = optarg;
+                break;
+
+            case 1002:  /* --manifest */
+                manifest_path = optarg;
+                break;
+
+            case 1004:  /* --trace */
+                trace_path = optarg;
+                break;
+
+            case 1005:  /* --index */
+                opts.write_index = 1;
+                break;
+
+            case 1006:  /* --verify */
+                verify = 1;
+                break;
+
+            case 1008:  /* --serve */
+                serve_socket = optarg;
+                break;
+
+            case 1009:  /* --watch */
+                watch_dir = optarg;
+                break;
+
+            case 1010:  /* --format text|json */
+                if (strcmp(optarg, "text") == 0) {
+                    opts.output_format = FORMAT_TEXT;
+                } else if (strcmp(optarg, "json") == 0) {
+                    opts.output_format = FORMAT_JSON;
+                } else {
+                    fprintf(stderr, "Error: Invalid output format '%s' (expected text or json)\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 1007:  /* --merge */
+                merge_output = optarg;
+                break;
+
+            case 1003:  /* --stats[=table|json] */
+                if (!optarg || strcmp(optarg, "table") == 0) {
+                    opts.stats_format = STATS_TABLE;
+                } else if (strcmp(optarg, "json") == 0) {
+                    opts.stats_format = STATS_JSON;
+                } else {
+                    fprintf(stderr, "Error: Invalid stats format '%s' (expected table or json)\n", optarg);
+                    return 1;
+                }
+                break;
+
             case 'o':
                 opts.output_file = optarg;
                 break;
@@ -315,8 +767,28 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    /* Daemon mode: inputs arrive over the socket, -j conversions at a time */
+    if (serve_socket) {
+        if (optind < argc) {
+            fprintf(stderr, "Error: --serve takes no input files\n");
+            return 1;
+        }
+        return server_run(serve_socket, &opts,
+                          jobs_given ? batch_jobs : threadpool_resolve_count(0)) == 0 ? 0 : 1;
+    }
+
+    /* JSON lines are the whole output: no prompts, no text summary */
+    if (opts.output_format == FORMAT_JSON) {
+        interactive_prompt = 0;
+    }
+
+    if (watch_dir && (optind < argc || opts.output_file)) {
+        fprintf(stderr, "Error: --watch takes no input files or -o/--output\n");
+        return 1;
+    }
+
     /* Check for input files */
-    if (optind >= argc) {
+    if (optind >= argc && !watch_dir) {
         fprintf(stderr, "Error: No input files specified\n\n");
         print_usage(argv[0]);
         return 1;
@@ -327,34 +799,140 @@ int main(int argc, char *argv[]) {
         file_count++;
     }
 
+    /* Merge mode: every input is a source of the one output bank */
+    if (merge_output) {
+        struct MergeSource *sources = calloc((size_t)file_count, sizeof(*sources));
+        int result;
+
+        if (!sources) {
+            fprintf(stderr, "Error: Failed to allocate merge sources\n");
+            return 1;
+        }
+        for (i = 0; i < file_count; i++) {
+            if (merge_parse_source(argv[optind + i], &sources[i]) != 0) {
+                free(sources);
+                return 1;
+            }
+        }
+        result = merge_banks(sources, file_count, merge_output, &opts);
+        free(sources);
+        return result == 0 ? 0 : 1;
+    }
+
     /* Validate options */
     if (opts.output_file && file_count > 1) {
         fprintf(stderr, "Error: -o/--output can only be used with a single input file\n");
         return 1;
     }
 
-    /* Process each input file */
+    /* Record a timeline of the run */
+    if (trace_path && trace_open(trace_path) != 0) {
+        return 1;
+    }
+
+    /* Deep verification */
+    struct WFBVerifySummary verify_summary;
+    if (verify) {
+        wfb_verify_summary_init(&verify_summary);
+        opts.verify = &verify_summary;
+    }
+
+    /* Load the build manifest for incremental rebuilds */
+    struct Manifest manifest;
+    if (manifest_path && manifest_load(&manifest, manifest_path) != 0) {
+        return 1;
+    }
+
+    /* Watch mode: convert .sf2 files as they settle in the directory */
+    if (watch_dir) {
+        struct WatchRun run;
+        int result;
+
+        run.opts = &opts;
+        run.assess = assess_viability;
+        run.manifest = manifest_path ? &manifest : NULL;
+        run.jobs = jobs_given ? batch_jobs : threadpool_resolve_count(0);
+        run.converted = 0;
+        run.failed = 0;
+        result = watch_directory(watch_dir, ".sf2", watch_batch, &run);
+
+        if (manifest_path) {
+            manifest_free(&manifest);
+        }
+        if (trace_path && trace_close() != 0) {
+            run.failed++;
+        }
+        if (opts.output_format != FORMAT_JSON) {
+            printf("Converted: %d, Failed: %d\n", run.converted, run.failed);
+        }
+        return result == 0 && run.failed == 0 ? 0 : 1;
+    }
+
+    /* Expand glob patterns into the input list */
+    char **inputs = NULL;
+    int input_count = 0;
+    int input_capacity = 0;
     for (i = optind; i < argc; i++) {
         const char *pattern = argv[i];
         glob_t globbuf;
+        int append_failed = 0;
 
-        /* Expand glob patterns */
         if (glob(pattern, GLOB_TILDE, NULL, &globbuf) == 0) {
             size_t j;
-            for (j = 0; j < globbuf.gl_pathc; j++) {
-                process_file(globbuf.gl_pathv[j], &opts, assess_viability,
-                            interactive_prompt, &converted, &failed);
+            for (j = 0; j < globbuf.gl_pathc && !append_failed; j++) {
+                append_failed = append_input(&inputs, &input_count, &input_capacity,
+                                             globbuf.gl_pathv[j]) != 0;
             }
             globfree(&globbuf);
         } else {
             /* No matches, try as literal filename */
-            process_file(pattern, &opts, assess_viability, interactive_prompt,
-                        &converted, &failed);
+            append_failed = append_input(&inputs, &input_count, &input_capacity, pattern) != 0;
+        }
+
+        if (append_failed) {
+            fprintf(stderr, "Error: Failed to allocate input list\n");
+            return 1;
         }
     }
 
+    /* Verifying only .wfb files fans out across them; .sf2 inputs keep their prompts */
+    if (verify && !jobs_given) {
+        int all_wfb = 1;
+        for (i = 0; i < input_count && all_wfb; i++) {
+            all_wfb = has_extension(inputs[i], ".wfb");
+        }
+        if (all_wfb) {
+            batch_jobs = threadpool_resolve_count(0);
+        }
+    }
+
+    /* Process each input file */
+    run_batch(inputs, input_count, &opts, assess_viability, interactive_prompt,
+              manifest_path ? &manifest : NULL, batch_jobs, &converted, &failed);
+
+    for (i = 0; i < input_count; i++) {
+        free(inputs[i]);
+    }
+    free(inputs);
+
+    if (manifest_path) {
+        if (manifest_save(&manifest) != 0) {
+            failed++;
+        }
+        manifest_free(&manifest);
+    }
+
+    if (trace_path && trace_close() != 0) {
+        failed++;
+    }
+
+    if (verify) {
+        wfb_verify_summary_print(&verify_summary, opts.verbose);
+        wfb_verify_summary_free(&verify_summary);
+    }
+
     /* Print summary if batch processing */
-    if (file_count > 1 || failed > 0) {
+    if ((file_count > 1 || failed > 0) && opts.output_format != FORMAT_JSON) {
         printf("\n=== Summary ===\n");
         printf("Processed: %d files\n", converted + failed);
         printf("Converted: %d\n", converted);
@@ -0,0 +1,374 @@
+/*
+ * manifest.c - Build manifest for incremental rebuilds
+ *
+ * Text format, one block per output:
+ *
+ *   sf2wfb-manifest 1
+ *   output <version> <options hash> <path>
+ *   input <size> <mtime ns> <content hash> <path>
+ *   ...
+ *
+ * Paths come last on their line so they may contain spaces.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/manifest.h"
+#include "../include/converter.h"
+#include "../include/logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MANIFEST_HEADER "sf2wfb-manifest 1"
+
+static char *copy_string(const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = malloc(len);
+    if (copy) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+static void free_entry(struct ManifestEntry *e) {
+    for (int i = 0; i < e->input_count; i++) {
+        free(e->inputs[i].path);
+    }
+    free(e->inputs);
+    free(e->output);
+    memset(e, 0, sizeof(*e));
+}
+
+static uint64_t fnv_update(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int hash_file(const char *path, uint64_t *hash) {
+    uint8_t buf[65536];
+    size_t n;
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        return -1;
+    }
+    *hash = 1469598103934665603ULL;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        *hash = fnv_update(*hash, buf, n);
+    }
+    if (ferror(f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int stat_file(const char *path, long long *size, long long *mtime_ns) {
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    *size = (long long)st.st_size;
+    *mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+/* Options that change the written bank (not verbosity, threads or caching) */
+static uint64_t hash_options(const struct ConversionOptions *opts) {
+    uint64_t hash = 1469598103934665603ULL;
+    const char *device = opts->device_name ? opts->device_name : "Maui";
+    char id[16];
+
+    hash = fnv_update(hash, device, strlen(device) + 1);
+    if (opts->drums_file) {
+        hash = fnv_update(hash, "D", 1);
+        hash = fnv_update(hash, opts->drums_file, strlen(opts->drums_file) + 1);
+    }
+    for (int i = 0; i < opts->patch_count; i++) {
+        snprintf(id, sizeof(id), "%d", opts->patches[i].program_id);
+        hash = fnv_update(hash, "P", 1);
+        hash = fnv_update(hash, opts->patches[i].file, strlen(opts->patches[i].file) + 1);
+        hash = fnv_update(hash, id, strlen(id) + 1);
+    }
+    return hash;
+}
+
+/* Files a conversion reads: the SF2 itself, then each distinct -D/-p source */
+static int list_inputs(const char *input, const struct ConversionOptions *opts,
+                       const char **paths, int max_paths) {
+    int count = 0;
+
+    paths[count++] = input;
+    if (opts->drums_file && count < max_paths) {
+        paths[count++] = opts->drums_file;
+    }
+    for (int i = 0; i < opts->patch_count && count < max_paths; i++) {
+        int seen = 0;
+        for (int j = 0; j < count; j++) {
+            if (strcmp(paths[j], opts->patches[i].file) == 0) {
+                seen = 1;
+                break;
+            }
+        }
+        if (!seen) {
+            paths[count++] = opts->patches[i].file;
+        }
+    }
+    return count;
+}
+
+static struct ManifestEntry *find_entry(struct Manifest *m, const char *output) {
+    for (int i = 0; i < m->entry_count; i++) {
+        if (strcmp(m->entries[i].output, output) == 0) {
+            return &m->entries[i];
+        }
+    }
+    return NULL;
+}
+
+static struct ManifestEntry *append_entry(struct Manifest *m) {
+    if (m->entry_count >= m->entry_capacity) {
+        int new_capacity = m->entry_capacity ? m->entry_capacity * 2 : 32;
+        struct ManifestEntry *grown = realloc(m->entries,
+                                              (size_t)new_capacity * sizeof(*grown));
+        if (!grown) {
+            return NULL;
+        }
+        m->entries = grown;
+        m->entry_capacity = new_capacity;
+    }
+    memset(&m->entries[m->entry_count], 0, sizeof(m->entries[0]));
+    return &m->entries[m->entry_count++];
+}
+
+static int append_input(struct ManifestEntry *e, const char *path, long long size,
+                        long long mtime_ns, uint64_t hash) {
+    struct ManifestInput *grown = realloc(e->inputs,
+                                          (size_t)(e->input_count + 1) * sizeof(*grown));
+    if (!grown) {
+        return -1;
+    }
+    e->inputs = grown;
+    e->inputs[e->input_count].path = copy_string(path);
+    if (!e->inputs[e->input_count].path) {
+        return -1;
+    }
+    e->inputs[e->input_count].size = size;
+    e->inputs[e->input_count].mtime_ns = mtime_ns;
+    e->inputs[e->input_count].hash = hash;
+    e->input_count++;
+    return 0;
+}
+
+int manifest_load(struct Manifest *m, const char *path) {
+    char line[4096];
+    struct ManifestEntry *current = NULL;
+    FILE *f;
+
+    memset(m, 0, sizeof(*m));
+    m->path = path;
+    pthread_mutex_init(&m->lock, NULL);
+
+    f = fopen(path, "r");
+    if (!f) {
+        return 0;  /* First run: nothing built yet */
+    }
+
+    if (!fgets(line, sizeof(line), f) || strncmp(line, MANIFEST_HEADER, strlen(MANIFEST_HEADER)) != 0) {
+        log_errorf("Warning: Ignoring unrecognised manifest '%s'\n", path);
+        fclose(f);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        int version;
+        unsigned long long hash;
+        long long size, mtime_ns;
+        int name_at = -1;
+
+        line[strcspn(line, "\n")] = '\0';
+
+        if (sscanf(line, "output %d %llx %n", &version, &hash, &name_at) == 2 && name_at > 0) {
+            current = append_entry(m);
+            if (!current || !(current->output = copy_string(line + name_at))) {
+                break;
+            }
+            current->version = version;
+            current->options_hash = hash;
+        } else if (current &&
+                   sscanf(line, "input %lld %lld %llx %n", &size, &mtime_ns, &hash,
+                          &name_at) == 3 && name_at > 0) {
+            if (append_input(current, line + name_at, size, mtime_ns, hash) != 0) {
+                break;
+            }
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int manifest_save(struct Manifest *m) {
+    char tmp_path[1024];
+    FILE *f;
+    int ok;
+
+    if (!m->dirty) {
+        return 0;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", m->path);
+    f = fopen(tmp_path, "w");
+    if (!f) {
+        log_errorf("Error: Cannot write manifest '%s'\n", tmp_path);
+        return -1;
+    }
+
+    fprintf(f, "%s\n", MANIFEST_HEADER);
+    for (int i = 0; i < m->entry_count; i++) {
+        struct ManifestEntry *e = &m->entries[i];
+        fprintf(f, "output %d %016llx %s\n", e->version,
+                (unsigned long long)e->options_hash, e->output);
+        for (int j = 0; j < e->input_count; j++) {
+            fprintf(f, "input %lld %lld %016llx %s\n", e->inputs[j].size,
+                    e->inputs[j].mtime_ns, (unsigned long long)e->inputs[j].hash,
+                    e->inputs[j].path);
+        }
+    }
+
+    ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp_path, m->path) != 0) {
+        log_errorf("Error: Failed to write manifest '%s'\n", m->path);
+        remove(tmp_path);
+        return -1;
+    }
+
+    m->dirty = 0;
+    return 0;
+}
+
+void manifest_free(struct Manifest *m) {
+    for (int i = 0; i < m->entry_count; i++) {
+        free_entry(&m->entries[i]);
+    }
+    free(m->entries);
+    pthread_mutex_destroy(&m->lock);
+    memset(m, 0, sizeof(*m));
+}
+
+int manifest_is_current(struct Manifest *m, const char *output, const char *input,
+                        const struct ConversionOptions *opts) {
+    const char *paths[130];
+    int path_count = list_inputs(input, opts, paths, 130);
+    struct ManifestInput recorded[130];
+    long long size, mtime_ns;
+    int current = 1;
+
+    /* Snapshot the record so files can be hashed without holding the lock */
+    pthread_mutex_lock(&m->lock);
+    struct ManifestEntry *e = find_entry(m, output);
+    if (!e || e->version != SF2WFB_CONVERTER_VERSION ||
+        e->options_hash != hash_options(opts) || e->input_count != path_count) {
+        current = 0;
+    } else {
+        for (int i = 0; i < path_count; i++) {
+            recorded[i] = e->inputs[i];
+            if (strcmp(recorded[i].path, paths[i]) != 0) {
+                current = 0;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    if (!current || stat_file(output, &size, &mtime_ns) != 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < path_count; i++) {
+        uint64_t hash;
+
+        if (stat_file(paths[i], &size, &mtime_ns) != 0) {
+            return 0;
+        }
+        if (size == recorded[i].size && mtime_ns == recorded[i].mtime_ns) {
+            continue;
+        }
+        if (size != recorded[i].size || hash_file(paths[i], &hash) != 0 ||
+            hash != recorded[i].hash) {
+            return 0;
+        }
+
+        /* Touched but unchanged: remember the new mtime to skip hashing next time */
+        pthread_mutex_lock(&m->lock);
+        e = find_entry(m, output);
+        if (e && i < e->input_count && strcmp(e->inputs[i].path, paths[i]) == 0) {
+            e->inputs[i].mtime_ns = mtime_ns;
+            m->dirty = 1;
+        }
+        pthread_mutex_unlock(&m->lock);
+    }
+
+    return 1;
+}
+
+int manifest_record(struct Manifest *m, const char *output, const char *input,
+                    const struct ConversionOptions *opts) {
+    const char *paths[130];
+    int path_count = list_inputs(input, opts, paths, 130);
+    struct ManifestEntry fresh;
+    int result = 0;
+
+    /* Paths are stored one per line */
+    if (strchr(output, '\n')) {
+        return -1;
+    }
+
+    memset(&fresh, 0, sizeof(fresh));
+    fresh.version = SF2WFB_CONVERTER_VERSION;
+    fresh.options_hash = hash_options(opts);
+    fresh.output = copy_string(output);
+    if (!fresh.output) {
+        return -1;
+    }
+
+    for (int i = 0; i < path_count; i++) {
+        long long size, mtime_ns;
+        uint64_t hash;
+
+        if (strchr(paths[i], '\n') ||
+            stat_file(paths[i], &size, &mtime_ns) != 0 ||
+            hash_file(paths[i], &hash) != 0 ||
+            append_input(&fresh, paths[i], size, mtime_ns, hash) != 0) {
+            free_entry(&fresh);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&m->lock);
+    struct ManifestEntry *e = find_entry(m, output);
+    if (e) {
+        free_entry(e);
+    } else {
+        e = append_entry(m);
+    }
+    if (e) {
+        *e = fresh;
+        m->dirty = 1;
+    } else {
+        free_entry(&fresh);
+        result = -1;
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return result;
+}
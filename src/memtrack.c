@@ -0,0 +1,78 @@
+/*
+ * memtrack.c - Allocation wrappers that account memory by category
+ *
+ * Each block carries a small header recording its size, category and the
+ * stats it was charged to, so mem_free() needs no size from the caller.
+ */
+
+#include "../include/memtrack.h"
+#include <stdlib.h>
+#include <string.h>
+
+union MemHeader {
+    struct {
+        struct ConversionStats *stats;
+        size_t size;
+        enum StatMemory category;
+    } block;
+    max_align_t align;               /* Keep the payload suitably aligned */
+};
+
+void *mem_alloc(enum StatMemory category, size_t size) {
+    union MemHeader *header;
+
+    if (size > (size_t)-1 - sizeof(*header)) {
+        return NULL;
+    }
+    header = malloc(sizeof(*header) + size);
+    if (!header) {
+        return NULL;
+    }
+
+    header->block.stats = stats_current();
+    header->block.size = size;
+    header->block.category = category;
+    stats_mem_change(header->block.stats, category, (long long)size);
+    return header + 1;
+}
+
+void *mem_calloc(enum StatMemory category, size_t count, size_t size) {
+    void *ptr;
+
+    if (size != 0 && count > (size_t)-1 / size) {
+        return NULL;
+    }
+    ptr = mem_alloc(category, count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void mem_free(void *ptr) {
+    union MemHeader *header;
+
+    if (!ptr) {
+        return;
+    }
+    header = (union MemHeader *)ptr - 1;
+    stats_mem_change(header->block.stats, header->block.category,
+                     -(long long)header->block.size);
+    free(header);
+}
+
+void mem_retag(void *ptr, enum StatMemory category) {
+    union MemHeader *header;
+
+    if (!ptr) {
+        return;
+    }
+    header = (union MemHeader *)ptr - 1;
+    if (header->block.category == category) {
+        return;
+    }
+    stats_mem_change(header->block.stats, header->block.category,
+                     -(long long)header->block.size);
+    header->block.category = category;
+    stats_mem_change(header->block.stats, category, (long long)header->block.size);
+}
@@ -0,0 +1,474 @@
+/*
+ * merge.c - Combine programs from several banks into one WFB
+ */
+
+#include "../include/merge.h"
+#include "../include/logging.h"
+#include "../include/memtrack.h"
+#include "../include/wfb_index.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAP_UNSET   -1
+#define MAP_PENDING -2               /* Being imported; guards alias cycles */
+
+/*
+ * A loaded source and where its records landed in the merged bank. A .wfb
+ * source is read through its record index: programs and the drum kit up
+ * front, patches and samples only when a selected program uses them.
+ */
+struct MergeInput {
+    struct WFBBank bank;
+    int loaded;
+    FILE *file;                      /* Indexed .wfb, or NULL when bank is complete */
+    struct WFBIndex index;
+    uint8_t patch_read[WF_MAX_PATCHES];
+    uint8_t sample_read[WF_MAX_SAMPLES];
+    int sample_map[WF_MAX_SAMPLES];
+    int patch_map[WF_MAX_PATCHES];
+};
+
+/* Parse "a", "a-b" or "drums" selection terms; -1 when arg is not a selection */
+static int parse_selection(const char *sel, struct MergeSource *source) {
+    const char *p = sel;
+
+    if (*p == '\0') {
+        return -1;
+    }
+    while (*p) {
+        if (strncmp(p, "drums", 5) == 0 && (p[5] == ',' || p[5] == '\0')) {
+            source->drums = 1;
+            p += 5;
+        } else if (isdigit((unsigned char)*p)) {
+            char *end;
+            long lo = strtol(p, &end, 10);
+            long hi = lo;
+            if (*end == '-') {
+                if (!isdigit((unsigned char)end[1])) {
+                    return -1;
+                }
+                hi = strtol(end + 1, &end, 10);
+            }
+            if (lo < 0 || hi >= WF_MAX_PROGRAMS || lo > hi) {
+                return -1;
+            }
+            for (long n = lo; n <= hi; n++) {
+                source->programs[n] = 1;
+            }
+            p = end;
+        } else {
+            return -1;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int merge_parse_source(const char *arg, struct MergeSource *source) {
+    const char *colon = strrchr(arg, ':');
+    size_t len = strlen(arg);
+
+    memset(source, 0, sizeof(*source));
+
+    /* A trailing ":selection"; otherwise the colon belongs to the path */
+    if (colon && parse_selection(colon + 1, source) == 0) {
+        len = (size_t)(colon - arg);
+    } else {
+        memset(source->programs, 1, sizeof(source->programs));
+        source->drums = 1;
+    }
+
+    if (len >= sizeof(source->path)) {
+        log_errorf("Error: Path too long '%s'\n", arg);
+        return -1;
+    }
+    memcpy(source->path, arg, len);
+    source->path[len] = '\0';
+    return 0;
+}
+
+static int has_suffix(const char *path, const char *suffix) {
+    size_t len = strlen(path);
+    size_t suffix_len = strlen(suffix);
+
+    if (len < suffix_len) {
+        return 0;
+    }
+    for (size_t i = 0; i < suffix_len; i++) {
+        if (tolower((unsigned char)path[len - suffix_len + i]) != suffix[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void close_source(struct MergeInput *in) {
+    if (in->loaded) {
+        free_wfb_bank(&in->bank);
+        in->loaded = 0;
+    }
+    if (in->file) {
+        fclose(in->file);
+        in->file = NULL;
+        wfb_index_free(&in->index);
+    }
+}
+
+/* Open a .wfb through its index (the .idx sidecar when current) */
+static int open_indexed_source(const char *path, const struct ConversionOptions *opts,
+                               struct MergeInput *in) {
+    const struct WaveFrontFileHeader *header = &in->index.header;
+
+    if (wfb_index_open(path, &in->index, opts->write_index) != 0) {
+        return -1;
+    }
+    in->file = fopen(path, "rb");
+    if (!in->file) {
+        log_errorf("Error: Cannot open '%s'\n", path);
+        wfb_index_free(&in->index);
+        return -1;
+    }
+    if (header->wProgramCount > WF_MAX_PROGRAMS || header->wPatchCount > WF_MAX_PATCHES) {
+        log_errorf("Error: '%s' has more programs or patches than WaveFront allows\n", path);
+        close_source(in);
+        return -1;
+    }
+    if (init_wfb_bank(&in->bank, header->szSynthName, header->wProgramCount,
+                      header->wPatchCount, in->index.sample_count) != 0) {
+        close_source(in);
+        return -1;
+    }
+    in->bank.header = *header;
+    in->bank.program_count = header->wProgramCount;
+    in->bank.patch_count = header->wPatchCount;
+    in->bank.sample_count = in->index.sample_count;
+    in->bank.has_drumkit = header->wDrumkitCount > 0;
+    in->loaded = 1;
+
+    for (int i = 0; i < in->bank.program_count; i++) {
+        if (wfb_index_read_program(in->file, &in->index, i, &in->bank.programs[i]) != 0) {
+            return -1;
+        }
+    }
+    if (in->bank.has_drumkit &&
+        wfb_index_read_drumkit(in->file, &in->index, &in->bank.drumkit) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int load_source(const char *path, const struct ConversionOptions *opts,
+                       struct MergeInput *in) {
+    if (has_suffix(path, ".wfb")) {
+        return open_indexed_source(path, opts, in);
+    }
+    if (has_suffix(path, ".sf2")) {
+        if (convert_sf2_to_bank(path, opts, &in->bank, NULL) != 0) {
+            return -1;
+        }
+        in->loaded = 1;
+        return 0;
+    }
+    log_errorf("Error: Unknown file type '%s' (expected .sf2 or .wfb)\n", path);
+    return -1;
+}
+
+/* Patch p of a source, read on first use from an indexed one */
+static const struct WaveFrontPatch *input_patch(struct MergeInput *in, int p) {
+    if (in->file && !in->patch_read[p]) {
+        if (wfb_index_read_patch(in->file, &in->index, p, &in->bank.patches[p]) != 0) {
+            return NULL;
+        }
+        in->patch_read[p] = 1;
+    }
+    return &in->bank.patches[p];
+}
+
+/* Sample ref of a source (with its PCM), read on first use from an indexed one */
+static const struct WFBSample *input_sample(struct MergeInput *in, int ref) {
+    if (in->file && !in->sample_read[ref]) {
+        if (wfb_index_read_sample(in->file, &in->index, ref, &in->bank.samples[ref]) != 0) {
+            return NULL;
+        }
+        in->sample_read[ref] = 1;
+    }
+    return &in->bank.samples[ref];
+}
+
+/* Append an alias to a sample already in out, keeping the source's offsets */
+static int append_alias(struct WFBBank *out, const struct WFBSample *alias, int target) {
+    int idx = out->sample_count;
+
+    if (idx >= out->sample_capacity) {
+        return -1;
+    }
+    /* The target may itself have deduped to an alias; point at what it stores */
+    if (out->samples[target].info.nSampleType == WF_ST_ALIAS) {
+        target = out->samples[target].data.alias.nOriginalSample;
+    }
+
+    out->samples[idx].info = alias->info;
+    out->samples[idx].info.nNumber = idx;
+    out->samples[idx].data.alias = alias->data.alias;
+    out->samples[idx].data.alias.nOriginalSample = target;
+    out->samples[idx].pcm_data = NULL;
+    memset(&out->sample_keys[idx], 0, sizeof(out->sample_keys[idx]));
+    out->sample_keys[idx].type = WF_ST_ALIAS;
+    out->sample_count++;
+    out->alias_count++;
+    return idx;
+}
+
+/* Copy sample ref (and whatever it refers to) into out; returns its new number */
+static int import_sample(struct WFBBank *out, struct MergeInput *in, int ref,
+                         uint64_t *source_bytes) {
+    const struct WFBSample *sample;
+    int idx = -1;
+
+    if (ref < 0 || ref >= in->bank.sample_count || in->sample_map[ref] == MAP_PENDING) {
+        return -1;
+    }
+    if (in->sample_map[ref] != MAP_UNSET) {
+        return in->sample_map[ref];
+    }
+    in->sample_map[ref] = MAP_PENDING;
+    sample = input_sample(in, ref);
+    if (!sample) {
+        in->sample_map[ref] = MAP_UNSET;
+        return -1;
+    }
+
+    switch (sample->info.nSampleType) {
+        case WF_ST_SAMPLE:
+            idx = add_stored_sample(out, sample);
+            if (idx >= 0) {
+                *source_bytes += sample->info.dwSizeInBytes;
+            }
+            break;
+
+        case WF_ST_ALIAS: {
+            int target = import_sample(out, in, sample->data.alias.nOriginalSample,
+                                       source_bytes);
+            if (target >= 0) {
+                idx = append_alias(out, sample, target);
+            }
+            break;
+        }
+
+        case WF_ST_MULTISAMPLE: {
+            int16_t numbers[NUM_MIDIKEYS];
+            idx = 0;
+            for (int k = 0; k < NUM_MIDIKEYS && idx >= 0; k++) {
+                int key_ref = sample->data.multisample.nSampleNumber[k];
+                numbers[k] = -1;
+                if (key_ref >= 0) {
+                    int mapped = import_sample(out, in, key_ref, source_bytes);
+                    numbers[k] = (int16_t)mapped;
+                    idx = mapped < 0 ? -1 : 0;
+                }
+            }
+            if (idx >= 0) {
+                idx = add_multisample_entry(out, numbers,
+                                            sample->data.multisample.nNumberOfSamples,
+                                            sample->info.szName);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    in->sample_map[ref] = idx < 0 ? MAP_UNSET : idx;
+    return idx;
+}
+
+/* Copy patch p and its sample into out; returns its new number */
+static int import_patch(struct WFBBank *out, struct MergeInput *in, int p,
+                        uint64_t *source_bytes) {
+    const struct WaveFrontPatch *source;
+    struct WaveFrontPatch *patch;
+    int ref, sample;
+
+    if (p < 0 || p >= in->bank.patch_count) {
+        return -1;
+    }
+    if (in->patch_map[p] != MAP_UNSET) {
+        return in->patch_map[p];
+    }
+    if (out->patch_count >= out->patch_capacity) {
+        log_errorf("Error: Merged bank needs more than %d patches\n", WF_MAX_PATCHES);
+        return -1;
+    }
+
+    source = input_patch(in, p);
+    if (!source) {
+        return -1;
+    }
+    ref = get_patch_sample(&source->base);
+    sample = import_sample(out, in, ref, source_bytes);
+    if (sample < 0) {
+        log_errorf("Error: Cannot copy sample %d of patch %d\n", ref, p);
+        return -1;
+    }
+
+    patch = &out->patches[out->patch_count];
+    *patch = *source;
+    patch->nNumber = out->patch_count;
+    set_patch_sample(&patch->base, sample);
+    in->patch_map[p] = out->patch_count++;
+    return in->patch_map[p];
+}
+
+static int merge_into(struct WFBBank *out, struct MergeInput *inputs,
+                      const struct MergeSource *sources, int count, uint64_t *source_bytes) {
+    int owner[WF_MAX_PROGRAMS];
+    int owner_index[WF_MAX_PROGRAMS];
+    int drum_owner = -1;
+
+    /* Later sources win a program number */
+    for (int n = 0; n < WF_MAX_PROGRAMS; n++) {
+        owner[n] = -1;
+    }
+    for (int s = 0; s < count; s++) {
+        const struct WFBBank *bank = &inputs[s].bank;
+        for (int i = 0; i < bank->program_count; i++) {
+            int n = bank->programs[i].nNumber;
+            if (n < 0 || n >= WF_MAX_PROGRAMS || !sources[s].programs[n]) {
+                continue;
+            }
+            if (owner[n] >= 0) {
+                log_printf("Warning: Program %d from '%s' replaces the one from '%s'\n",
+                           n, sources[s].path, sources[owner[n]].path);
+            }
+            owner[n] = s;
+            owner_index[n] = i;
+        }
+        if (sources[s].drums && bank->has_drumkit) {
+            if (drum_owner >= 0) {
+                log_printf("Warning: Drum kit from '%s' replaces the one from '%s'\n",
+                           sources[s].path, sources[drum_owner].path);
+            }
+            drum_owner = s;
+        }
+    }
+
+    for (int n = 0; n < WF_MAX_PROGRAMS; n++) {
+        struct MergeInput *in;
+        struct WaveFrontProgram *program;
+
+        if (owner[n] < 0) {
+            continue;
+        }
+        in = &inputs[owner[n]];
+        program = &out->programs[out->program_count++];
+        *program = in->bank.programs[owner_index[n]];
+        for (int l = 0; l < NUM_LAYERS; l++) {
+            struct LAYER *layer = &program->base.layer[l];
+            if (!layer->fUnmute) {
+                layer->byPatchNumber = 0;
+                continue;
+            }
+            int patch = import_patch(out, in, layer->byPatchNumber, source_bytes);
+            if (patch < 0) {
+                log_errorf("Error: Cannot copy program %d from '%s'\n", n, sources[owner[n]].path);
+                return -1;
+            }
+            layer->byPatchNumber = (uint8_t)patch;
+        }
+    }
+
+    if (drum_owner >= 0) {
+        struct MergeInput *in = &inputs[drum_owner];
+        out->drumkit = in->bank.drumkit;
+        out->has_drumkit = 1;
+        for (int k = 0; k < NUM_MIDIKEYS; k++) {
+            struct DRUM *drum = &out->drumkit.base.drum[k];
+            if (!drum->fUnmute) {
+                drum->byPatchNumber = 0;
+                continue;
+            }
+            int patch = import_patch(out, in, drum->byPatchNumber, source_bytes);
+            if (patch < 0) {
+                log_errorf("Error: Cannot copy drum kit from '%s'\n", sources[drum_owner].path);
+                return -1;
+            }
+            drum->byPatchNumber = (uint8_t)patch;
+        }
+    }
+    return 0;
+}
+
+int merge_banks(const struct MergeSource *sources, int count, const char *output,
+                const struct ConversionOptions *opts) {
+    struct MergeInput *inputs;
+    struct WFBBank out;
+    uint64_t source_bytes = 0;
+    const char *device;
+    int result = -1;
+
+    if (count <= 0) {
+        log_errorf("Error: Nothing to merge\n");
+        return -1;
+    }
+
+    inputs = mem_calloc(STAT_MEM_TABLES, (size_t)count, sizeof(*inputs));
+    if (!inputs) {
+        log_errorf("Error: Failed to allocate merge inputs\n");
+        return -1;
+    }
+    for (int s = 0; s < count; s++) {
+        for (int i = 0; i < WF_MAX_SAMPLES; i++) {
+            inputs[s].sample_map[i] = MAP_UNSET;
+        }
+        for (int i = 0; i < WF_MAX_PATCHES; i++) {
+            inputs[s].patch_map[i] = MAP_UNSET;
+        }
+        if (load_source(sources[s].path, opts, &inputs[s]) != 0) {
+            log_errorf("Error: Failed to load '%s'\n", sources[s].path);
+            goto cleanup;
+        }
+    }
+
+    device = opts->device_name ? opts->device_name : inputs[0].bank.header.szSynthName;
+    if (init_wfb_bank(&out, device, WF_MAX_PROGRAMS, WF_MAX_PATCHES, WF_MAX_SAMPLES) != 0) {
+        goto cleanup;
+    }
+
+    if (merge_into(&out, inputs, sources, count, &source_bytes) == 0) {
+        wfb_update_header(&out);
+        if (out.total_sample_memory > get_device_memory_limit(out.header.szSynthName)) {
+            log_printf("Warning: Total sample memory (%u bytes) exceeds %s limit (%u bytes)\n",
+                       out.total_sample_memory, out.header.szSynthName,
+                       get_device_memory_limit(out.header.szSynthName));
+        }
+        if (wfb_write(output, &out) == 0) {
+            log_printf("Merge complete: %d source(s) -> '%s'\n", count, output);
+            log_printf("  Programs: %d, Patches: %d, Samples: %d\n",
+                       out.program_count, out.patch_count, out.sample_count);
+            if (out.alias_count > 0) {
+                log_printf("  Deduped samples (aliases): %d\n", out.alias_count);
+            }
+            log_printf("  Sample memory: %u bytes (%llu bytes saved by dedup)\n",
+                       out.total_sample_memory,
+                       (unsigned long long)(source_bytes - out.total_sample_memory));
+            result = 0;
+        }
+    } else if (out.sample_count >= out.sample_capacity) {
+        log_errorf("Error: Merged bank needs more than %d samples\n", WF_MAX_SAMPLES);
+    }
+    free_wfb_bank(&out);
+
+cleanup:
+    for (int s = 0; s < count; s++) {
+        close_source(&inputs[s]);
+    }
+    mem_free(inputs);
+    return result;
+}
@@ -0,0 +1,146 @@
+/*
+ * report.c - Machine-readable per-file results (--format json)
+ */
+
+#include "../include/report.h"
+#include "../include/logging.h"
+#include <string.h>
+
+/* Targets listed under "devices", in the order of the -d help text */
+static const char *const device_names[] = { "Maui", "Rio", "Tropez", "TBS-2001" };
+
+/* A "key": "string" member, or "key": null */
+static void print_string_member(const char *key, const char *value) {
+    log_printf("\"%s\": ", key);
+    if (value) {
+        log_json_string(value);
+    } else {
+        log_printf("null");
+    }
+}
+
+static void print_string_array(const char *key, char *const *items, int count) {
+    log_printf("\"%s\": [", key);
+    for (int i = 0; i < count; i++) {
+        log_printf("%s", i ? ", " : "");
+        log_json_string(items[i] ? items[i] : "");
+    }
+    log_printf("]");
+}
+
+static void print_viability(const struct ViabilityReport *r) {
+    char grade[2] = { r->grade, '\0' };
+
+    log_printf("{\"grade\": ");
+    log_json_string(grade);
+    log_printf(", \"sf2_size_bytes\": %zu, \"total_presets\": %d, \"bank0_presets\": %d, "
+               "\"bank128_presets\": %d, \"other_bank_presets\": %d",
+               r->sf2_size_bytes, r->total_presets, r->bank0_presets,
+               r->bank128_presets, r->other_bank_presets);
+    log_printf(", \"total_samples_in_sf2\": %d, \"samples_referenced_by_gm\": %d, "
+               "\"samples_after_truncation\": %d, \"samples_unused\": %d",
+               r->total_samples_in_sf2, r->samples_referenced_by_gm,
+               r->samples_after_truncation, r->samples_unused);
+    log_printf(", \"planned_patches\": %d, \"planned_samples\": %d, "
+               "\"planned_stored_samples\": %d, \"planned_aliases\": %d, "
+               "\"planned_multisamples\": %d, \"samples_over_limit\": %d, "
+               "\"memory_required\": %u",
+               r->planned_patches, r->planned_samples, r->planned_stored_samples,
+               r->planned_aliases, r->planned_multisamples, r->samples_over_limit,
+               r->memory_required);
+    log_printf(", \"total_programs\": %d, \"programs_with_truncation\": %d, "
+               "\"avg_layers_before\": %.2f, \"avg_layers_after\": %.2f",
+               r->total_programs, r->programs_with_truncation,
+               r->avg_layers_before, r->avg_layers_after);
+
+    log_printf(", \"top_truncated\": [");
+    for (int i = 0; i < r->top_truncated_count; i++) {
+        const struct TopTruncated *t = &r->top_truncated[i];
+        char name[sizeof(t->name) + 1];
+
+        memcpy(name, t->name, sizeof(t->name));
+        name[sizeof(t->name)] = '\0';
+        log_printf("%s{\"program\": %d, \"name\": ", i ? ", " : "", t->program_num);
+        log_json_string(name);
+        log_printf(", \"layers_before\": %d, \"layers_after\": %d, \"layers_lost\": %d}",
+                   t->layers_before, t->layers_after, t->layers_lost);
+    }
+    log_printf("]");
+
+    log_printf(", \"programs_using_filter_q\": %d, \"programs_with_complex_mods\": %d, "
+               "\"stereo_pairs_found\": %d, \"stereo_pairs_convertible\": %d",
+               r->programs_using_filter_q, r->programs_with_complex_mods,
+               r->stereo_pairs_found, r->stereo_pairs_convertible);
+    log_printf(", \"estimated_wfb_size\": %zu, \"estimated_ram_usage\": %zu, "
+               "\"size_reduction_pct\": %.2f, ",
+               r->estimated_wfb_size, r->estimated_ram_usage, r->size_reduction_pct);
+    print_string_array("warnings", r->warnings, r->warning_count);
+    log_printf(", ");
+    print_string_member("recommendation", r->recommendation);
+    log_printf(", ");
+    print_string_array("suggestions", r->suggestions, r->suggestion_count);
+    log_printf("}");
+}
+
+static void print_result(const struct ConversionResult *r) {
+    log_printf("{\"programs\": %d, \"patches\": %d, \"samples\": %d, \"aliases\": %d, "
+               "\"multisamples\": %d, \"stored_samples\": %d, \"resampled\": %d, "
+               "\"samples_over_limit\": %d, \"drumkit\": %s, \"memory_required\": %u",
+               r->program_count, r->patch_count, r->sample_count, r->alias_count,
+               r->multisample_count,
+               r->sample_count - r->alias_count - r->multisample_count,
+               r->resampled_count, r->samples_refused,
+               r->has_drumkit ? "true" : "false", r->memory_required);
+    if (r->file_size > 0) {
+        log_printf(", \"file_size\": %u", r->file_size);
+    }
+    log_printf("}");
+}
+
+/* Whether the bank fits each device's sample RAM */
+static void print_devices(uint32_t memory_required) {
+    log_printf("{");
+    for (size_t i = 0; i < sizeof(device_names) / sizeof(device_names[0]); i++) {
+        uint32_t limit = get_device_memory_limit(device_names[i]);
+        log_printf("%s\"%s\": {\"memory_limit\": %u, \"fits\": %s}", i ? ", " : "",
+                   device_names[i], limit, memory_required <= limit ? "true" : "false");
+    }
+    log_printf("}");
+}
+
+void file_report_print_json(const struct FileReport *report) {
+    log_printf("{");
+    print_string_member("file", report->file);
+    log_printf(", ");
+    print_string_member("output", report->output[0] ? report->output : NULL);
+    log_printf(", ");
+    print_string_member("status", report->status);
+    log_printf(", ");
+    print_string_member("error", report->error[0] ? report->error : NULL);
+
+    log_printf(", \"assessment\": ");
+    if (report->assessed) {
+        print_viability(&report->viability);
+    } else {
+        log_printf("null");
+    }
+
+    log_printf(", \"conversion\": ");
+    if (report->has_result) {
+        print_result(&report->result);
+    } else {
+        log_printf("null");
+    }
+
+    log_printf(", \"devices\": ");
+    if (report->has_result || report->assessed) {
+        print_devices(report->has_result ? report->result.memory_required
+                                         : report->viability.memory_required);
+    } else {
+        log_printf("null");
+    }
+
+    log_printf(", \"stats\": {");
+    stats_print_json_fields(&report->stats);
+    log_printf("}}\n");
+}
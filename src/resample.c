@@ -3,6 +3,8 @@
  */
 
 #include "../include/converter.h"
+#include "../include/logging.h"
+#include "../include/memtrack.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -62,9 +64,25 @@ void resample_scale_loop_points(uint32_t input_rate, uint32_t output_rate,
     resample_set_sample_offset(out_end, end_pos, output_samples);
 }
 
+/*
+ * Number of output frames resample_linear() produces for a given input.
+ * Shared with the conversion planner so planned lengths match exactly.
+ */
+uint32_t resample_output_count(uint32_t input_samples, uint32_t input_rate,
+                               uint32_t output_rate) {
+    float ratio;
+
+    if (input_rate == 0 || output_rate == 0 || input_rate == output_rate) {
+        return input_samples;
+    }
+
+    ratio = (float)input_rate / (float)output_rate;
+    return (uint32_t)(input_samples / ratio);
+}
+
 /*
  * Resample audio data using linear interpolation
- * Returns newly allocated buffer (caller must free)
+ * Returns newly allocated buffer (caller must mem_free)
  */
 int16_t *resample_linear(int16_t *input, uint32_t input_samples,
                          uint32_t input_rate, uint32_t output_rate,
@@ -81,7 +99,7 @@ int16_t *resample_linear(int16_t *input, uint32_t input_samples,
     /* No resampling needed */
     if (input_rate == output_rate) {
         *output_samples = input_samples;
-        output = malloc(input_samples * sizeof(int16_t));
+        output = mem_alloc(STAT_MEM_CONVERTED_PCM, input_samples * sizeof(int16_t));
         if (!output) {
             return NULL;
         }
@@ -91,10 +109,10 @@ int16_t *resample_linear(int16_t *input, uint32_t input_samples,
 
     /* Calculate output size */
     ratio = (float)input_rate / (float)output_rate;
-    *output_samples = (uint32_t)(input_samples / ratio);
+    *output_samples = resample_output_count(input_samples, input_rate, output_rate);
 
     /* Allocate output buffer */
-    output = malloc(*output_samples * sizeof(int16_t));
+    output = mem_alloc(STAT_MEM_CONVERTED_PCM, *output_samples * sizeof(int16_t));
     if (!output) {
         return NULL;
     }
@@ -118,33 +136,17 @@ int16_t *resample_linear(int16_t *input, uint32_t input_samples,
 }
 
 /*
- * Downsample to 44.1kHz if needed
- * Returns 1 if resampling occurred, 0 if not needed, -1 on error
+ * Rate a sample is converted at: anything above 44.1kHz is downsampled
  */
-int resample_to_44100_if_needed(int16_t **data, uint32_t *sample_count,
-                                 uint32_t *sample_rate) {
-    int16_t *resampled;
-    uint32_t new_count;
-
-    if (*sample_rate <= 44100) {
-        return 0; /* No resampling needed */
-    }
-
-    printf("Warning: Resampling audio from %u Hz to 44100 Hz. "
-           "This may result in reduced sound quality compared to the original SoundFont.\n",
-           *sample_rate);
-
-    resampled = resample_linear(*data, *sample_count, *sample_rate, 44100, &new_count);
-    if (!resampled) {
-        fprintf(stderr, "Error: Failed to resample audio data\n");
-        return -1;
-    }
-
-    /* Replace original data */
-    free(*data);
-    *data = resampled;
-    *sample_count = new_count;
-    *sample_rate = 44100;
+uint32_t resample_target_rate(uint32_t sample_rate) {
+    return sample_rate > 44100 ? 44100 : sample_rate;
+}
 
-    return 1;
+/*
+ * Warn that a sample is being downsampled to 44.1kHz
+ */
+void resample_report_downsample(uint32_t sample_rate) {
+    log_printf("Warning: Resampling audio from %u Hz to 44100 Hz. "
+               "This may result in reduced sound quality compared to the original SoundFont.\n",
+               sample_rate);
 }
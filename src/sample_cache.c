@@ -0,0 +1,145 @@
+/*
+ * sample_cache.c - Persistent cache of converted sample PCM
+ *
+ * Each entry is one file, <dir>/<key hash>.pcm: a header repeating the full
+ * key (so hash collisions read as misses) followed by the converted PCM.
+ * Entries are written to a temporary file and renamed into place, so
+ * concurrent runs sharing a directory never see partial entries.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/sample_cache.h"
+#include "../include/logging.h"
+#include "../include/memtrack.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SAMPLE_CACHE_MAGIC   "SF2WFBSC"
+#define SAMPLE_CACHE_VERSION 1
+
+struct SampleCacheHeader {
+    char magic[8];
+    uint32_t version;
+    struct SampleCacheKey key;
+    uint64_t pcm_hash;               /* Hash of the stored PCM, for dedup */
+} PACKED;
+
+static uint64_t hash_key(const struct SampleCacheKey *key) {
+    const uint8_t *bytes = (const uint8_t *)key;
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < sizeof(*key); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void entry_path(const struct SampleCache *cache, const struct SampleCacheKey *key,
+                       char *path, size_t path_size) {
+    snprintf(path, path_size, "%s/%016llx.pcm", cache->dir,
+             (unsigned long long)hash_key(key));
+}
+
+int sample_cache_open(struct SampleCache *cache, const char *dir) {
+    struct stat st;
+
+    cache->dir = dir;
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    atomic_init(&cache->stores, 0);
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        log_errorf("Error: Cannot create cache directory '%s'\n", dir);
+        return -1;
+    }
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        log_errorf("Error: Cache path '%s' is not a directory\n", dir);
+        return -1;
+    }
+    return 0;
+}
+
+int sample_cache_load(struct SampleCache *cache, const struct SampleCacheKey *key,
+                      int16_t **pcm, uint64_t *pcm_hash) {
+    struct SampleCacheHeader header;
+    char path[1024];
+    FILE *f;
+    int16_t *data;
+
+    entry_path(cache, key, path, sizeof(path));
+    f = fopen(path, "rb");
+    if (!f) {
+        atomic_fetch_add(&cache->misses, 1);
+        return -1;
+    }
+
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, SAMPLE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SAMPLE_CACHE_VERSION ||
+        memcmp(&header.key, key, sizeof(*key)) != 0) {
+        fclose(f);
+        atomic_fetch_add(&cache->misses, 1);
+        return -1;
+    }
+
+    data = mem_alloc(STAT_MEM_CONVERTED_PCM,
+                     (key->samples > 0 ? key->samples : 1) * sizeof(int16_t));
+    if (!data || fread(data, sizeof(int16_t), key->samples, f) != key->samples ||
+        fgetc(f) != EOF) {
+        mem_free(data);
+        fclose(f);
+        atomic_fetch_add(&cache->misses, 1);
+        return -1;
+    }
+
+    fclose(f);
+    *pcm = data;
+    *pcm_hash = header.pcm_hash;
+    atomic_fetch_add(&cache->hits, 1);
+    return 0;
+}
+
+void sample_cache_store(struct SampleCache *cache, const struct SampleCacheKey *key,
+                        const int16_t *pcm, uint64_t pcm_hash) {
+    struct SampleCacheHeader header;
+    char path[1024];
+    char tmp_path[1040];
+    FILE *f;
+    int fd;
+    int ok;
+
+    entry_path(cache, key, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+    fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return;
+    }
+    f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SAMPLE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SAMPLE_CACHE_VERSION;
+    header.key = *key;
+    header.pcm_hash = pcm_hash;
+
+    ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+         fwrite(pcm, sizeof(int16_t), key->samples, f) == key->samples;
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return;
+    }
+    atomic_fetch_add(&cache->stores, 1);
+}
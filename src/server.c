@@ -0,0 +1,417 @@
+/*
+ * server.c - Conversion daemon on a local UNIX socket
+ *
+ * Workers run on the thread pool, each accepting connections from the
+ * shared listening socket, whose backlog is the request queue. Worker
+ * threads keep their arenas between requests and the sample cache
+ * directory persists, so repeat conversions skip most of the work.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE      /* SCM_RIGHTS, MSG_NOSIGNAL */
+
+#include "../include/server.h"
+#include "../include/logging.h"
+#include "../include/sf2wfb.h"
+#include "../include/stats.h"
+#include "../include/threadpool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define REQUEST_MAX 4096             /* Longest request line */
+#define POLL_INTERVAL_MS 250         /* How often idle workers check for shutdown */
+#define CLIENT_TIMEOUT_MS 10000      /* Longest wait for a client's request bytes */
+
+/* Forward declarations */
+extern int is_valid_device_name(const char *name);
+extern const char *normalize_device_name(const char *name);
+
+static volatile sig_atomic_t stop_requested;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+struct Server {
+    int listen_fd;
+    const struct ConversionOptions *defaults;
+};
+
+/* One parsed request line */
+struct Request {
+    char *input;
+    char *output;
+    const char *device;
+    int threads;
+    int input_fd;                    /* Descriptor passed with the request, or -1 */
+};
+
+/* Write all of buf to a client, without dying on a closed connection */
+static int send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int send_error(int fd, int code, const char *message) {
+    char line[512];
+    int n = snprintf(line, sizeof(line), "error code=%d %s\n", code, message);
+
+    return send_all(fd, line, (size_t)(n < (int)sizeof(line) ? n : (int)sizeof(line) - 1));
+}
+
+/*
+ * Read the request line into buf, picking up a descriptor passed with its
+ * first bytes. Returns the line length without the newline, or -1.
+ */
+static int read_request(int fd, char *buf, size_t size, int *passed_fd) {
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    size_t len = 0;
+
+    *passed_fd = -1;
+    while (len < size - 1) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int waited = 0;
+        ssize_t n;
+
+        /* A silent client must not hold the worker, nor delay shutdown */
+        while (!stop_requested && waited < CLIENT_TIMEOUT_MS &&
+               poll(&pfd, 1, POLL_INTERVAL_MS) == 0) {
+            waited += POLL_INTERVAL_MS;
+        }
+        if (stop_requested || waited >= CLIENT_TIMEOUT_MS) {
+            return -1;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buf + len;
+        iov.iov_len = size - 1 - len;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.space;
+        msg.msg_controllen = sizeof(control.space);
+
+        n = recvmsg(fd, &msg, 0);
+        if (n < 0 && errno == EINTR && !stop_requested) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS &&
+                c->cmsg_len >= CMSG_LEN(sizeof(int))) {
+                int received;
+                memcpy(&received, CMSG_DATA(c), sizeof(int));
+                if (*passed_fd >= 0) {
+                    close(received);
+                } else {
+                    *passed_fd = received;
+                }
+            }
+        }
+
+        char *nl = memchr(buf + len, '\n', (size_t)n);
+        len += (size_t)n;
+        if (nl) {
+            *nl = '\0';
+            return (int)(nl - buf);
+        }
+    }
+    return -1;
+}
+
+/* Split "convert\tkey=value..." into req; message explains a rejection */
+static int parse_request(char *line, struct Request *req, const char **message) {
+    char *save = NULL;
+    char *field = strtok_r(line, "\t", &save);
+
+    if (!field || strcmp(field, "convert") != 0) {
+        *message = "Unknown request";
+        return -1;
+    }
+
+    while ((field = strtok_r(NULL, "\t", &save)) != NULL) {
+        char *eq = strchr(field, '=');
+        if (!eq) {
+            *message = "Malformed field";
+            return -1;
+        }
+        *eq = '\0';
+        const char *value = eq + 1;
+
+        if (strcmp(field, "input") == 0) {
+            req->input = eq + 1;
+        } else if (strcmp(field, "output") == 0) {
+            req->output = eq + 1;
+        } else if (strcmp(field, "device") == 0) {
+            if (!is_valid_device_name(value)) {
+                *message = "Invalid device name";
+                return -1;
+            }
+            req->device = normalize_device_name(value);
+        } else if (strcmp(field, "threads") == 0) {
+            req->threads = atoi(value);
+        } else {
+            *message = "Unknown field";
+            return -1;
+        }
+    }
+
+    if (!req->output || (!req->input && req->input_fd < 0)) {
+        *message = "Request needs an output and an input path or descriptor";
+        return -1;
+    }
+    return 0;
+}
+
+/* Sink writing WFB output to a file */
+static int file_sink(void *user, const void *data, size_t size) {
+    return fwrite(data, 1, size, user) == size ? 0 : -1;
+}
+
+/* Convert into output (written via a temporary file), or into a buffer for output=- */
+static int run_request(const struct Request *req, int input_fd,
+                       const struct SF2WFBOptions *opts, void **wfb, size_t *wfb_size,
+                       struct SF2WFBResult *result) {
+    char tmp_path[1100];
+    FILE *out;
+    int status;
+
+    if (strcmp(req->output, "-") == 0) {
+        return sf2wfb_convert_fd(input_fd, opts, wfb, wfb_size, result);
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", req->output);
+    out = fopen(tmp_path, "wb");
+    if (!out) {
+        memset(result, 0, sizeof(*result));
+        snprintf(result->message, sizeof(result->message),
+                 "Error: Cannot create '%s'", req->output);
+        return SF2WFB_E_IO;
+    }
+
+    status = sf2wfb_convert_fd_to_sink(input_fd, opts, file_sink, out, result);
+    if (fclose(out) != 0 && status == SF2WFB_OK) {
+        status = SF2WFB_E_IO;
+    }
+    if (status == SF2WFB_OK && rename(tmp_path, req->output) != 0) {
+        status = SF2WFB_E_IO;
+    }
+    if (status != SF2WFB_OK) {
+        unlink(tmp_path);
+    }
+    return status;
+}
+
+/* Serve one connection: read its request, convert, answer */
+static void serve_client(struct Server *server, int fd) {
+    char line[REQUEST_MAX];
+    char reply[512];
+    struct Request req;
+    struct SF2WFBOptions opts;
+    struct SF2WFBResult result;
+    struct ConversionStats stats;
+    const char *message = NULL;
+    void *wfb = NULL;
+    size_t wfb_size = 0;
+    int input_fd;
+    int status;
+
+    memset(&req, 0, sizeof(req));
+    if (read_request(fd, line, sizeof(line), &req.input_fd) < 0) {
+        send_error(fd, SF2WFB_E_INVALID, "Unreadable request");
+        if (req.input_fd >= 0) {
+            close(req.input_fd);
+        }
+        return;
+    }
+    req.device = server->defaults->device_name;
+    req.threads = server->defaults->threads;
+    if (parse_request(line, &req, &message) != 0) {
+        send_error(fd, SF2WFB_E_INVALID, message);
+        if (req.input_fd >= 0) {
+            close(req.input_fd);
+        }
+        return;
+    }
+
+    input_fd = req.input_fd;
+    if (input_fd < 0) {
+        input_fd = open(req.input, O_RDONLY);
+        if (input_fd < 0) {
+            snprintf(reply, sizeof(reply), "Error: Cannot open '%s'", req.input);
+            log_printf("%s: %s\n", req.input, reply);
+            send_error(fd, SF2WFB_E_IO, reply);
+            return;
+        }
+    }
+
+    opts.device = req.device;
+    opts.threads = req.threads;
+    opts.cache_dir = server->defaults->cache_dir;
+
+    stats_init(&stats);
+    stats_set_current(&stats);
+    long long start = stats_now_ns();
+    status = run_request(&req, input_fd, &opts, &wfb, &wfb_size, &result);
+    double ms = (stats_now_ns() - start) / 1e6;
+    stats_set_current(NULL);
+    close(input_fd);
+
+    const char *name = req.input ? req.input : "<fd>";
+    if (status != SF2WFB_OK) {
+        log_printf("%s: %s (%s)\n", name, sf2wfb_strerror(status), result.message);
+        send_error(fd, status, result.message[0] ? result.message : sf2wfb_strerror(status));
+        return;
+    }
+
+    log_printf("%s -> %s: %d programs, %d samples, %.1f ms\n",
+               name, req.output, result.program_count, result.sample_count, ms);
+    snprintf(reply, sizeof(reply),
+             "ok programs=%d patches=%d samples=%d aliases=%d resampled=%d drumkit=%d "
+             "memory=%u limit=%u bytes=%zu ms=%.1f mem_peak=%lld\n",
+             result.program_count, result.patch_count, result.sample_count,
+             result.alias_count, result.resampled_count, result.has_drumkit,
+             result.memory_required, result.memory_limit, result.wfb_size, ms,
+             (long long)atomic_load(&stats.mem_total_peak));
+    if (send_all(fd, reply, strlen(reply)) == 0 && wfb) {
+        send_all(fd, wfb, wfb_size);
+    }
+    sf2wfb_free(wfb);
+}
+
+/* Whether a server is still listening on the socket at addr */
+static int socket_in_use(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int in_use;
+
+    if (fd < 0) {
+        return 0;
+    }
+    in_use = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(fd);
+    return in_use;
+}
+
+/* Worker loop: accept and serve until shutdown */
+static void server_worker(void *arg, int index) {
+    struct Server *server = arg;
+    struct pollfd pfd;
+    (void)index;
+
+    pfd.fd = server->listen_fd;
+    pfd.events = POLLIN;
+    while (!stop_requested) {
+        int ready = poll(&pfd, 1, POLL_INTERVAL_MS);
+        if (ready <= 0) {
+            continue;
+        }
+
+        /* Non-blocking: a worker that loses the race sees EAGAIN */
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        serve_client(server, fd);
+        close(fd);
+    }
+}
+
+int server_run(const char *socket_path, const struct ConversionOptions *defaults, int workers) {
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct Server server;
+    struct stat st;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        log_errorf("Error: Socket path too long: '%s'\n", socket_path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_path, strlen(socket_path) + 1);
+
+    /* Replace only a stale socket from an earlier run, never another file */
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            log_errorf("Error: '%s' exists and is not a socket\n", socket_path);
+            return -1;
+        }
+        if (socket_in_use(&addr)) {
+            log_errorf("Error: '%s' is in use by another server\n", socket_path);
+            return -1;
+        }
+        unlink(socket_path);
+    } else if (errno != ENOENT) {
+        log_errorf("Error: Cannot use '%s': %s\n", socket_path, strerror(errno));
+        return -1;
+    }
+
+    server.defaults = defaults;
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.listen_fd < 0) {
+        log_errorf("Error: Cannot create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (bind(server.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server.listen_fd, SOMAXCONN) != 0) {
+        log_errorf("Error: Cannot listen on '%s': %s\n", socket_path, strerror(errno));
+        close(server.listen_fd);
+        return -1;
+    }
+    fcntl(server.listen_fd, F_SETFL, fcntl(server.listen_fd, F_GETFL) | O_NONBLOCK);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    log_printf("Serving on '%s' with %d worker(s)\n", socket_path, workers);
+    fflush(stdout);
+
+    struct ThreadPool *pool = threadpool_create(workers);
+    threadpool_parallel_for(pool, workers, server_worker, &server);
+    threadpool_destroy(pool);
+
+    close(server.listen_fd);
+    unlink(socket_path);
+    log_printf("Server stopped\n");
+    return 0;
+}
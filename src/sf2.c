@@ -2,7 +2,13 @@
  * sf2.c - SoundFont 2 file parser
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/arena.h"
 #include "../include/converter.h"
+#include "../include/logging.h"
+#include "../include/memtrack.h"
+#include "../include/stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -61,17 +67,28 @@ static int find_list_chunk(FILE *f, const char *list_type, uint32_t *size) {
     return -1;
 }
 
+/* Allocate bank data from its arena when it was opened with one */
+static void *bank_alloc(struct SF2Bank *bank, enum StatMemory category, size_t size) {
+    return bank->arena ? arena_alloc(bank->arena, category, size) : mem_alloc(category, size);
+}
+
+static void bank_free(struct SF2Bank *bank, void *ptr) {
+    if (!bank->arena) {
+        mem_free(ptr);
+    }
+}
+
 /* Helper macro to allocate and read a chunk with error checking */
 #define READ_CHUNK_DATA(ptr, size, count_field, struct_size) do { \
     (count_field) = (size) / sizeof(struct_size) - 1; \
-    (ptr) = malloc(size); \
+    (ptr) = bank_alloc(bank, STAT_MEM_HYDRA, size); \
     if (!(ptr)) { \
-        fprintf(stderr, "Error: Failed to allocate memory for chunk\n"); \
+        log_errorf("Error: Failed to allocate memory for chunk\n"); \
         return -1; \
     } \
     if (fread((ptr), (size), 1, f) != 1) { \
-        fprintf(stderr, "Error: Failed to read chunk data\n"); \
-        free(ptr); \
+        log_errorf("Error: Failed to read chunk data\n"); \
+        bank_free(bank, ptr); \
         (ptr) = NULL; \
         return -1; \
     } \
@@ -85,7 +102,7 @@ static int parse_hydra(FILE *f, struct SF2Bank *bank) {
 
     /* Find pdta LIST */
     if (find_list_chunk(f, "pdta", &pdta_size) != 0) {
-        fprintf(stderr, "Error: 'pdta' LIST chunk not found\n");
+        log_errorf("Error: 'pdta' LIST chunk not found\n");
         return -1;
     }
 
@@ -142,19 +159,21 @@ static int parse_hydra(FILE *f, struct SF2Bank *bank) {
         }
     }
 
+    stats_count(STAT_BYTES_READ, pdta_size);
+
     return 0;
 }
 
 #undef READ_CHUNK_DATA
 
-/* Parse the sdta (sample data) section */
-static int parse_sample_data(FILE *f, struct SF2Bank *bank) {
+/* Parse the sdta (sample data) section; with load == 0 only locate smpl */
+static int parse_sample_data(FILE *f, struct SF2Bank *bank, int load) {
     struct RIFFChunk chunk;
     uint32_t sdta_size;
 
     /* Find sdta LIST */
     if (find_list_chunk(f, "sdta", &sdta_size) != 0) {
-        fprintf(stderr, "Error: 'sdta' LIST chunk not found\n");
+        log_errorf("Error: 'sdta' LIST chunk not found\n");
         return -1;
     }
 
@@ -163,14 +182,18 @@ static int parse_sample_data(FILE *f, struct SF2Bank *bank) {
 
     if (memcmp(chunk.chunkID, "smpl", 4) == 0) {
         bank->sample_data_size = chunk.chunkSize;
-        bank->sample_data = malloc(chunk.chunkSize);
+        bank->sample_data_offset = ftell(f);
+        if (!load) {
+            return 0;
+        }
+        bank->sample_data = bank_alloc(bank, STAT_MEM_SOURCE_PCM, chunk.chunkSize);
         if (!bank->sample_data) {
-            fprintf(stderr, "Error: Failed to allocate sample data buffer\n");
+            log_errorf("Error: Failed to allocate sample data buffer\n");
             return -1;
         }
         if (fread(bank->sample_data, chunk.chunkSize, 1, f) != 1) {
-            fprintf(stderr, "Error: Failed to read sample data\n");
-            free(bank->sample_data);
+            log_errorf("Error: Failed to read sample data\n");
+            bank_free(bank, bank->sample_data);
             bank->sample_data = NULL;
             return -1;
         }
@@ -178,33 +201,47 @@ static int parse_sample_data(FILE *f, struct SF2Bank *bank) {
         if (chunk.chunkSize & 1) {
             fseek(f, 1, SEEK_CUR);
         }
+        stats_count(STAT_BYTES_READ, chunk.chunkSize);
     }
 
     return 0;
 }
 
-/* Open and parse an SF2 file */
-int sf2_open(const char *filename, struct SF2Bank *bank) {
+/* Open and parse an SF2 file, optionally leaving sample data on disk */
+int sf2_open_arena(const char *filename, struct SF2Bank *bank, struct Arena *arena,
+                   int load_samples) {
+    FILE *file = fopen(filename, "rb");
+
+    if (!file) {
+        memset(bank, 0, sizeof(*bank));
+        log_errorf("Error: Cannot open '%s'\n", filename);
+        return -1;
+    }
+    return sf2_open_stream(file, bank, arena, load_samples);
+}
+
+/*
+ * Parse an SF2 from an open, seekable stream (a file, fmemopen() buffer or
+ * fdopen() descriptor). The bank owns the stream from here on, even on
+ * failure; sf2_close() closes it.
+ */
+int sf2_open_stream(FILE *file, struct SF2Bank *bank, struct Arena *arena,
+                    int load_samples) {
     struct RIFFChunk riff;
     char form_type[4];
 
     memset(bank, 0, sizeof(*bank));
-
-    /* Open file */
-    bank->file = fopen(filename, "rb");
-    if (!bank->file) {
-        fprintf(stderr, "Error: Cannot open '%s'\n", filename);
-        return -1;
-    }
+    bank->arena = arena;
+    bank->file = file;
 
     /* Read RIFF header */
     if (read_chunk(bank->file, &riff) != 0) {
-        fprintf(stderr, "Error: Not a valid RIFF file\n");
+        log_errorf("Error: Not a valid RIFF file\n");
         goto error;
     }
 
     if (memcmp(riff.chunkID, "RIFF", 4) != 0) {
-        fprintf(stderr, "Error: Not a valid RIFF file\n");
+        log_errorf("Error: Not a valid RIFF file\n");
         goto error;
     }
 
@@ -214,7 +251,7 @@ int sf2_open(const char *filename, struct SF2Bank *bank) {
     }
 
     if (memcmp(form_type, "sfbk", 4) != 0) {
-        fprintf(stderr, "Error: Not a valid SF2 file\n");
+        log_errorf("Error: Not a valid SF2 file\n");
         goto error;
     }
 
@@ -222,15 +259,19 @@ int sf2_open(const char *filename, struct SF2Bank *bank) {
     fseek(bank->file, 12, SEEK_SET);
 
     /* Parse sample data first */
-    if (parse_sample_data(bank->file, bank) != 0) {
+    long long start = stats_phase_begin();
+    if (parse_sample_data(bank->file, bank, load_samples) != 0) {
         goto error;
     }
+    stats_phase_end(STAT_PARSE_SAMPLES, start);
 
     /* Rewind and parse hydra */
     fseek(bank->file, 12, SEEK_SET);
+    start = stats_phase_begin();
     if (parse_hydra(bank->file, bank) != 0) {
         goto error;
     }
+    stats_phase_end(STAT_PARSE_HYDRA, start);
 
     return 0;
 
@@ -239,27 +280,83 @@ error:
     return -1;
 }
 
-/* Close and free SF2 bank data */
+/* Open and parse an SF2 file */
+int sf2_open(const char *filename, struct SF2Bank *bank) {
+    return sf2_open_arena(filename, bank, NULL, 1);
+}
+
+/* Open an SF2 file and parse the hydra only (no PCM is read) */
+int sf2_open_hydra(const char *filename, struct SF2Bank *bank) {
+    return sf2_open_arena(filename, bank, NULL, 0);
+}
+
+/* Close and free SF2 bank data (arena-backed data goes with the arena's reset) */
 void sf2_close(struct SF2Bank *bank) {
     if (bank->file) {
         fclose(bank->file);
         bank->file = NULL;
     }
 
-    free(bank->presets);
-    free(bank->preset_bags);
-    free(bank->preset_mods);
-    free(bank->preset_gens);
-    free(bank->instruments);
-    free(bank->inst_bags);
-    free(bank->inst_mods);
-    free(bank->inst_gens);
-    free(bank->samples);
-    free(bank->sample_data);
+    bank_free(bank, bank->presets);
+    bank_free(bank, bank->preset_bags);
+    bank_free(bank, bank->preset_mods);
+    bank_free(bank, bank->preset_gens);
+    bank_free(bank, bank->instruments);
+    bank_free(bank, bank->inst_bags);
+    bank_free(bank, bank->inst_mods);
+    bank_free(bank, bank->inst_gens);
+    bank_free(bank, bank->samples);
+    bank_free(bank, bank->sample_data);
 
     memset(bank, 0, sizeof(*bank));
 }
 
+/* Copy a sample's PCM into dest, from memory or straight from the file */
+int sf2_read_sample_pcm(struct SF2Bank *bank, int sample_idx, int16_t *dest) {
+    struct sfSample *samp;
+    uint32_t frames;
+
+    if (sample_idx < 0 || sample_idx >= bank->sample_count) {
+        return -1;
+    }
+
+    samp = &bank->samples[sample_idx];
+    if (samp->dwEnd < samp->dwStart ||
+        samp->dwEnd > bank->sample_data_size / sizeof(int16_t)) {
+        return -1;
+    }
+
+    frames = samp->dwEnd - samp->dwStart;
+    if (frames == 0) {
+        return 0;
+    }
+
+    if (bank->sample_data) {
+        memcpy(dest, &bank->sample_data[samp->dwStart], frames * sizeof(int16_t));
+        return 0;
+    }
+
+    if (!bank->file) {
+        log_errorf("Error: Failed to read sample %d\n", sample_idx);
+        return -1;
+    }
+
+    /* Seek and read as one step; samples may be loaded from several threads */
+    int ok;
+    flockfile(bank->file);
+    ok = fseek(bank->file, bank->sample_data_offset + (long)samp->dwStart * 2, SEEK_SET) == 0 &&
+         fread(dest, sizeof(int16_t), frames, bank->file) == frames;
+    funlockfile(bank->file);
+    stats_count(STAT_BYTES_READ, (long long)frames * sizeof(int16_t));
+
+    if (!ok) {
+        log_errorf("Error: Failed to read sample %d\n", sample_idx);
+        return -1;
+    }
+
+    return 0;
+}
+
 /* Get preset by bank and program number */
 struct sfPresetHeader *sf2_get_preset(struct SF2Bank *bank, int bank_num, int preset_num) {
     int i;
@@ -0,0 +1,639 @@
+/*
+ * sf2_gen.c - Synthetic SoundFont generator for benchmarking
+ *
+ * Writes a valid SF2 file whose shape (preset count, zones, stereo pairs,
+ * sample lengths and rates, shared instruments, duplicate PCM) is set on
+ * the command line. Output depends only on the options and the seed, so
+ * the same invocation always reproduces the same workload.
+ */
+
+#include "../include/sf2_types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#define GEN_MAX_RATES 8
+#define GEN_SAMPLE_PAD 46            /* Zero frames after each sample (SF2 spec) */
+
+/* Workload description */
+struct GenOptions {
+    int presets;                     /* Melodic presets in bank 0 */
+    int zones;                       /* Maximum zones per instrument */
+    double stereo;                   /* Fraction of zones that are stereo pairs */
+    double share;                    /* Fraction of presets reusing an instrument */
+    double dup;                      /* Fraction of zones reusing earlier PCM */
+    double layered;                  /* Fraction of presets with a second instrument */
+    uint32_t min_length;             /* Sample length range in frames */
+    uint32_t max_length;
+    uint32_t rates[GEN_MAX_RATES];
+    int rate_count;
+    int kits;                        /* Drum kits in bank 128 */
+    uint32_t drum_min_length;        /* Drum sample length range in frames */
+    uint32_t drum_max_length;
+    uint64_t seed;
+};
+
+/* Growable byte buffer for one chunk */
+struct GenBuffer {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+};
+
+/* PCM already written, for duplicate-PCM zones */
+struct GenPcm {
+    uint32_t start;
+    uint32_t length;
+    uint32_t rate;
+};
+
+struct Generator {
+    struct GenOptions opts;
+    uint64_t rng;
+    struct GenBuffer smpl, phdr, pbag, pmod, pgen, inst, ibag, imod, igen, shdr;
+    struct GenPcm *pcm;
+    int pcm_count;
+    int pcm_capacity;
+    int *melodic_insts;
+    int melodic_inst_count;
+    int failed;
+};
+
+/* xorshift64*: fixed across platforms, unlike rand() */
+static uint64_t gen_next(struct Generator *g) {
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return g->rng * 2685821657736338717ULL;
+}
+
+static double gen_unit(struct Generator *g) {
+    return (gen_next(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t gen_range(struct Generator *g, uint32_t lo, uint32_t hi) {
+    return lo + (uint32_t)(gen_next(g) % ((uint64_t)hi - lo + 1));
+}
+
+static void buffer_append(struct Generator *g, struct GenBuffer *buf,
+                          const void *data, size_t size) {
+    if (buf->size + size > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        uint8_t *grown;
+
+        while (capacity < buf->size + size) {
+            capacity *= 2;
+        }
+        grown = realloc(buf->data, capacity);
+        if (!grown) {
+            g->failed = 1;
+            return;
+        }
+        buf->data = grown;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+/* Index of the next record appended to buf; records are counted in uint16 */
+static uint16_t record_index(struct Generator *g, const struct GenBuffer *buf,
+                             size_t record_size) {
+    size_t index = buf->size / record_size;
+
+    if (index > 0xFFFF) {
+        g->failed = 1;
+        return 0;
+    }
+    return (uint16_t)index;
+}
+
+static void add_gen(struct Generator *g, struct GenBuffer *buf, uint16_t oper, uint16_t amount) {
+    struct sfGenList gen;
+
+    gen.sfGenOper = oper;
+    gen.genAmount.wAmount = amount;
+    buffer_append(g, buf, &gen, sizeof(gen));
+}
+
+static void add_range_gen(struct Generator *g, struct GenBuffer *buf, uint16_t oper,
+                          uint8_t lo, uint8_t hi) {
+    struct sfGenList gen;
+
+    gen.sfGenOper = oper;
+    gen.genAmount.range.byLo = lo;
+    gen.genAmount.range.byHi = hi;
+    buffer_append(g, buf, &gen, sizeof(gen));
+}
+
+static void add_mod(struct Generator *g, struct GenBuffer *buf, uint16_t src,
+                    uint16_t dest, int16_t amount) {
+    struct sfModList mod;
+
+    memset(&mod, 0, sizeof(mod));
+    mod.sfModSrcOper = src;
+    mod.sfModDestOper = dest;
+    mod.modAmount = amount;
+    buffer_append(g, buf, &mod, sizeof(mod));
+}
+
+static void add_bag(struct Generator *g, struct GenBuffer *bags,
+                    const struct GenBuffer *gens, const struct GenBuffer *mods) {
+    struct sfPresetBag bag;
+
+    bag.wGenNdx = record_index(g, gens, sizeof(struct sfGenList));
+    bag.wModNdx = record_index(g, mods, sizeof(struct sfModList));
+    buffer_append(g, bags, &bag, sizeof(bag));
+}
+
+/* Append fresh PCM (a detuned sawtooth with noise) and return its entry */
+static struct GenPcm write_pcm(struct Generator *g, uint32_t length, uint32_t rate) {
+    struct GenPcm pcm;
+    double step = gen_unit(g) * 0.1;
+    int16_t pad[GEN_SAMPLE_PAD];
+
+    pcm.start = (uint32_t)(g->smpl.size / sizeof(int16_t));
+    pcm.length = length;
+    pcm.rate = rate;
+    for (uint32_t i = 0; i < length; i++) {
+        double phase = i * step;
+        int16_t frame = (int16_t)(8000.0 * (phase - 2.0 * (long)(phase / 2.0) - 1.0)) +
+                        (int16_t)gen_range(g, 0, 100) - 50;
+        buffer_append(g, &g->smpl, &frame, sizeof(frame));
+    }
+    memset(pad, 0, sizeof(pad));
+    buffer_append(g, &g->smpl, pad, sizeof(pad));
+    return pcm;
+}
+
+/* PCM for one zone: reused from an earlier zone or newly written */
+static struct GenPcm pick_pcm(struct Generator *g, uint32_t length) {
+    struct GenPcm pcm;
+
+    if (g->pcm_count > 0 && gen_unit(g) < g->opts.dup) {
+        return g->pcm[gen_range(g, 0, (uint32_t)g->pcm_count - 1)];
+    }
+
+    pcm = write_pcm(g, length, g->opts.rates[gen_range(g, 0, (uint32_t)g->opts.rate_count - 1)]);
+    if (g->pcm_count >= g->pcm_capacity) {
+        int capacity = g->pcm_capacity ? g->pcm_capacity * 2 : 256;
+        struct GenPcm *grown = realloc(g->pcm, (size_t)capacity * sizeof(*grown));
+        if (!grown) {
+            g->failed = 1;
+            return pcm;
+        }
+        g->pcm = grown;
+        g->pcm_capacity = capacity;
+    }
+    g->pcm[g->pcm_count++] = pcm;
+    return pcm;
+}
+
+/* Add a sample header over pcm; returns its shdr index */
+static uint16_t add_sample(struct Generator *g, const char *prefix, const struct GenPcm *pcm,
+                           uint16_t type, uint16_t link, int loop) {
+    struct sfSample sample;
+    uint16_t index = record_index(g, &g->shdr, sizeof(sample));
+
+    memset(&sample, 0, sizeof(sample));
+    snprintf(sample.achSampleName, sizeof(sample.achSampleName), "%s%u", prefix, index);
+    sample.dwStart = pcm->start;
+    sample.dwEnd = pcm->start + pcm->length;
+    sample.dwStartloop = loop ? pcm->start + pcm->length / 4 : pcm->start;
+    sample.dwEndloop = loop && pcm->length > 8 ? pcm->start + pcm->length - 8 : pcm->start;
+    sample.dwSampleRate = pcm->rate;
+    sample.byOriginalPitch = 60;
+    sample.wSampleLink = link;
+    sample.sfSampleType = type;
+    buffer_append(g, &g->shdr, &sample, sizeof(sample));
+    return index;
+}
+
+static void add_instrument_header(struct Generator *g, const char *name) {
+    struct sfInst inst;
+
+    memset(&inst, 0, sizeof(inst));
+    snprintf(inst.achInstName, sizeof(inst.achInstName), "%s", name);
+    inst.wInstBagNdx = record_index(g, &g->ibag, sizeof(struct sfInstBag));
+    buffer_append(g, &g->inst, &inst, sizeof(inst));
+}
+
+/* Add one instrument zone playing sample over lo..hi */
+static void add_zone(struct Generator *g, uint16_t sample, uint8_t lo, uint8_t hi,
+                     int vel_layer, int16_t pan) {
+    add_bag(g, &g->ibag, &g->igen, &g->imod);
+    add_range_gen(g, &g->igen, GEN_KEY_RANGE, lo, hi);
+    if (vel_layer) {
+        add_range_gen(g, &g->igen, GEN_VEL_RANGE, vel_layer == 1 ? 0 : 64,
+                      vel_layer == 1 ? 63 : 127);
+    }
+    add_gen(g, &g->igen, GEN_PAN, (uint16_t)pan);
+    add_gen(g, &g->igen, GEN_INITIAL_ATTENUATION, (uint16_t)gen_range(g, 0, 200));
+    add_gen(g, &g->igen, GEN_SAMPLE_ID, sample);
+}
+
+/* Melodic instrument with a global zone and up to opts.zones key splits */
+static uint16_t add_melodic_instrument(struct Generator *g, const char *name, int zone_count) {
+    uint16_t index = record_index(g, &g->inst, sizeof(struct sfInst));
+
+    add_instrument_header(g, name);
+    add_bag(g, &g->ibag, &g->igen, &g->imod);
+    add_gen(g, &g->igen, GEN_ATTACK_VOL_ENV, (uint16_t)(int16_t)-(int)gen_range(g, 2000, 8000));
+    add_mod(g, &g->imod, 0x81, GEN_INITIAL_FILTER_FC, 300);
+
+    for (int z = 0; z < zone_count; z++) {
+        uint8_t lo = (uint8_t)(z * 128 / zone_count);
+        uint8_t hi = (uint8_t)((z + 1) * 128 / zone_count - 1);
+        int vel_layer = gen_unit(g) < 0.3 ? (int)gen_range(g, 1, 2) : 0;
+        struct GenPcm pcm = pick_pcm(g, gen_range(g, g->opts.min_length, g->opts.max_length));
+
+        if (gen_unit(g) < g->opts.stereo) {
+            uint16_t left = record_index(g, &g->shdr, sizeof(struct sfSample));
+            add_sample(g, "L", &pcm, LEFT_SAMPLE, (uint16_t)(left + 1), 1);
+            add_sample(g, "R", &pcm, RIGHT_SAMPLE, left, 1);
+            add_zone(g, left, lo, hi, vel_layer, -500);
+            add_zone(g, (uint16_t)(left + 1), lo, hi, vel_layer, 500);
+        } else {
+            uint16_t mono = add_sample(g, "S", &pcm, MONO_SAMPLE, 0, 1);
+            add_zone(g, mono, lo, hi, vel_layer, (int16_t)(200 * (int)gen_range(g, 0, 2) - 200));
+        }
+    }
+    return index;
+}
+
+static void add_preset_header(struct Generator *g, const char *name, uint16_t program,
+                              uint16_t bank) {
+    struct sfPresetHeader preset;
+
+    memset(&preset, 0, sizeof(preset));
+    snprintf(preset.achPresetName, sizeof(preset.achPresetName), "%s", name);
+    preset.wPreset = program;
+    preset.wBank = bank;
+    preset.wPresetBagNdx = record_index(g, &g->pbag, sizeof(struct sfPresetBag));
+    buffer_append(g, &g->phdr, &preset, sizeof(preset));
+}
+
+static void add_melodic_preset(struct Generator *g, int program) {
+    char name[20];
+    uint16_t inst;
+
+    if (g->melodic_inst_count > 0 && gen_unit(g) < g->opts.share) {
+        inst = (uint16_t)g->melodic_insts[gen_range(g, 0, (uint32_t)g->melodic_inst_count - 1)];
+    } else {
+        snprintf(name, sizeof(name), "Inst%d", program);
+        inst = add_melodic_instrument(g, name, (int)gen_range(g, 1, (uint32_t)g->opts.zones));
+        g->melodic_insts[g->melodic_inst_count++] = inst;
+    }
+
+    snprintf(name, sizeof(name), "Preset%d", program);
+    add_preset_header(g, name, (uint16_t)(program % 128), (uint16_t)(program / 128));
+
+    /* Global zone, then the instrument zone(s) */
+    add_bag(g, &g->pbag, &g->pgen, &g->pmod);
+    add_gen(g, &g->pgen, GEN_COARSE_TUNE, (uint16_t)(int16_t)((int)gen_range(g, 0, 2) - 1));
+    add_bag(g, &g->pbag, &g->pgen, &g->pmod);
+    add_mod(g, &g->pmod, 2, GEN_INITIAL_ATTENUATION, 100);
+    add_gen(g, &g->pgen, GEN_INSTRUMENT, inst);
+
+    if (gen_unit(g) < g->opts.layered) {
+        snprintf(name, sizeof(name), "Layer%d", program);
+        inst = add_melodic_instrument(g, name, 2);
+        add_bag(g, &g->pbag, &g->pgen, &g->pmod);
+        add_gen(g, &g->pgen, GEN_REVERB_EFFECTS_SEND, 200);
+        add_gen(g, &g->pgen, GEN_INSTRUMENT, inst);
+    }
+}
+
+/* GM-range drum kit (keys 35-81), one short unlooped sample per key */
+static void add_drumkit(struct Generator *g, int program) {
+    uint16_t inst = record_index(g, &g->inst, sizeof(struct sfInst));
+    char name[20];
+
+    add_instrument_header(g, "Drums");
+    for (int key = 35; key <= 81; key++) {
+        struct GenPcm pcm = pick_pcm(g, gen_range(g, g->opts.drum_min_length,
+                                                  g->opts.drum_max_length));
+        uint16_t sample = add_sample(g, "D", &pcm, MONO_SAMPLE, 0, 0);
+
+        add_bag(g, &g->ibag, &g->igen, &g->imod);
+        add_range_gen(g, &g->igen, GEN_KEY_RANGE, (uint8_t)key, (uint8_t)key);
+        add_gen(g, &g->igen, GEN_EXCLUSIVE_CLASS, (uint16_t)(key % 3));
+        add_gen(g, &g->igen, GEN_SAMPLE_ID, sample);
+    }
+
+    snprintf(name, sizeof(name), program ? "Kit%d" : "Standard", program);
+    add_preset_header(g, name, (uint16_t)program, 128);
+    add_bag(g, &g->pbag, &g->pgen, &g->pmod);
+    add_gen(g, &g->pgen, GEN_INSTRUMENT, inst);
+}
+
+/* Terminal records every hydra list ends with */
+static void add_terminals(struct Generator *g) {
+    struct sfSample eos;
+
+    add_preset_header(g, "EOP", 0, 0);
+    add_bag(g, &g->pbag, &g->pgen, &g->pmod);
+    add_gen(g, &g->pgen, 0, 0);
+    add_mod(g, &g->pmod, 0, 0, 0);
+
+    add_instrument_header(g, "EOI");
+    add_bag(g, &g->ibag, &g->igen, &g->imod);
+    add_gen(g, &g->igen, 0, 0);
+    add_mod(g, &g->imod, 0, 0, 0);
+
+    memset(&eos, 0, sizeof(eos));
+    memcpy(eos.achSampleName, "EOS", 3);
+    buffer_append(g, &g->shdr, &eos, sizeof(eos));
+}
+
+static void write_u32(FILE *f, uint32_t value) {
+    uint8_t bytes[4] = { value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24 };
+    fwrite(bytes, 1, sizeof(bytes), f);
+}
+
+static size_t chunk_size(size_t data_size) {
+    return 8 + data_size + (data_size & 1);
+}
+
+static void write_chunk(FILE *f, const char *id, const void *data, size_t size) {
+    fwrite(id, 1, 4, f);
+    write_u32(f, (uint32_t)size);
+    fwrite(data, 1, size, f);
+    if (size & 1) {
+        fputc(0, f);
+    }
+}
+
+static int write_sf2(struct Generator *g, const char *path) {
+    static const uint8_t ifil[4] = { 2, 0, 1, 0 };
+    static const char inam[] = "Synthetic";
+    const struct { const char *id; struct GenBuffer *buf; } hydra[] = {
+        { "phdr", &g->phdr }, { "pbag", &g->pbag }, { "pmod", &g->pmod },
+        { "pgen", &g->pgen }, { "inst", &g->inst }, { "ibag", &g->ibag },
+        { "imod", &g->imod }, { "igen", &g->igen }, { "shdr", &g->shdr }
+    };
+    size_t info_size = 4 + chunk_size(sizeof(ifil)) + chunk_size(sizeof(inam));
+    size_t sdta_size = 4 + chunk_size(g->smpl.size);
+    size_t pdta_size = 4;
+    size_t riff_size;
+    FILE *f;
+    int ok;
+
+    for (size_t i = 0; i < sizeof(hydra) / sizeof(hydra[0]); i++) {
+        pdta_size += chunk_size(hydra[i].buf->size);
+    }
+    riff_size = 4 + chunk_size(info_size) + chunk_size(sdta_size) + chunk_size(pdta_size);
+    if (riff_size > 0xFFFFFFFFu) {
+        fprintf(stderr, "Error: Generated bank exceeds the 4 GB RIFF limit\n");
+        return -1;
+    }
+
+    f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot create '%s'\n", path);
+        return -1;
+    }
+
+    fwrite("RIFF", 1, 4, f);
+    write_u32(f, (uint32_t)riff_size);
+    fwrite("sfbk", 1, 4, f);
+
+    fwrite("LIST", 1, 4, f);
+    write_u32(f, (uint32_t)info_size);
+    fwrite("INFO", 1, 4, f);
+    write_chunk(f, "ifil", ifil, sizeof(ifil));
+    write_chunk(f, "INAM", inam, sizeof(inam));
+
+    fwrite("LIST", 1, 4, f);
+    write_u32(f, (uint32_t)sdta_size);
+    fwrite("sdta", 1, 4, f);
+    write_chunk(f, "smpl", g->smpl.data, g->smpl.size);
+
+    fwrite("LIST", 1, 4, f);
+    write_u32(f, (uint32_t)pdta_size);
+    fwrite("pdta", 1, 4, f);
+    for (size_t i = 0; i < sizeof(hydra) / sizeof(hydra[0]); i++) {
+        write_chunk(f, hydra[i].id, hydra[i].buf->data, hydra[i].buf->size);
+    }
+
+    ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write '%s'\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void free_generator(struct Generator *g) {
+    struct GenBuffer *buffers[] = {
+        &g->smpl, &g->phdr, &g->pbag, &g->pmod, &g->pgen,
+        &g->inst, &g->ibag, &g->imod, &g->igen, &g->shdr
+    };
+
+    for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+        free(buffers[i]->data);
+    }
+    free(g->pcm);
+    free(g->melodic_insts);
+}
+
+/* Parse a comma-separated rate list such as "22050,44100,96000" */
+static int parse_rates(const char *list, struct GenOptions *opts) {
+    const char *p = list;
+
+    opts->rate_count = 0;
+    while (*p) {
+        char *end;
+        unsigned long rate = strtoul(p, &end, 10);
+
+        if (end == p || rate == 0 || rate > 192000 || opts->rate_count >= GEN_MAX_RATES) {
+            return -1;
+        }
+        opts->rates[opts->rate_count++] = (uint32_t)rate;
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') {
+            return -1;
+        }
+    }
+    return opts->rate_count > 0 ? 0 : -1;
+}
+
+static int parse_ratio(const char *arg, double *out) {
+    char *end;
+    double value = strtod(arg, &end);
+
+    if (end == arg || *end || value < 0.0 || value > 1.0) {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+/* Parse a frame range such as "200:3000" */
+static int parse_length(const char *arg, uint32_t *min_length, uint32_t *max_length) {
+    unsigned long lo, hi;
+
+    if (sscanf(arg, "%lu:%lu", &lo, &hi) != 2 || lo < 1 || hi < lo || hi > 0x7FFFFFF) {
+        return -1;
+    }
+    *min_length = (uint32_t)lo;
+    *max_length = (uint32_t)hi;
+    return 0;
+}
+
+static void print_usage(const char *prog_name) {
+    printf("Usage: %s [options] -o <out.sf2>\n\n", prog_name);
+    printf("Options:\n");
+    printf("  -o, --output <path>      Output SF2 file (required)\n");
+    printf("  -n, --presets <count>    Melodic presets (default: 128)\n");
+    printf("  -z, --zones <count>      Maximum key zones per instrument (default: 6)\n");
+    printf("      --stereo <ratio>     Fraction of zones that are stereo (default: 0.3)\n");
+    printf("      --share <ratio>      Fraction of presets sharing an instrument (default: 0.2)\n");
+    printf("      --dup <ratio>        Fraction of zones reusing earlier PCM (default: 0.3)\n");
+    printf("      --layered <ratio>    Fraction of presets with a second layer (default: 0.3)\n");
+    printf("      --length <min>:<max> Sample length range in frames (default: 200:3000)\n");
+    printf("      --rates <list>       Comma-separated sample rates (default: 22050,44100,48000,96000)\n");
+    printf("      --kits <count>       Drum kits in bank 128 (default: 1)\n");
+    printf("      --drum-length <min>:<max> Drum sample length range (default: 100:800)\n");
+    printf("      --no-drums           Same as --kits 0\n");
+    printf("  -s, --seed <n>           Random seed (default: 1)\n");
+    printf("  -h, --help               Show this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct Generator g;
+    const char *output = NULL;
+    int opt;
+    int result;
+
+    static struct option long_options[] = {
+        {"output",   required_argument, 0, 'o'},
+        {"presets",  required_argument, 0, 'n'},
+        {"zones",    required_argument, 0, 'z'},
+        {"seed",     required_argument, 0, 's'},
+        {"help",     no_argument,       0, 'h'},
+        {"stereo",   required_argument, 0, 1000},
+        {"share",    required_argument, 0, 1001},
+        {"dup",      required_argument, 0, 1002},
+        {"layered",  required_argument, 0, 1003},
+        {"length",   required_argument, 0, 1004},
+        {"rates",    required_argument, 0, 1005},
+        {"no-drums", no_argument,       0, 1006},
+        {"kits",     required_argument, 0, 1007},
+        {"drum-length", required_argument, 0, 1008},
+        {0, 0, 0, 0}
+    };
+
+    memset(&g, 0, sizeof(g));
+    g.opts.presets = 128;
+    g.opts.zones = 6;
+    g.opts.stereo = 0.3;
+    g.opts.share = 0.2;
+    g.opts.dup = 0.3;
+    g.opts.layered = 0.3;
+    g.opts.min_length = 200;
+    g.opts.max_length = 3000;
+    parse_rates("22050,44100,48000,96000", &g.opts);
+    g.opts.kits = 1;
+    g.opts.drum_min_length = 100;
+    g.opts.drum_max_length = 800;
+    g.opts.seed = 1;
+
+    while ((opt = getopt_long(argc, argv, "o:n:z:s:h", long_options, NULL)) != -1) {
+        int bad = 0;
+
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'n':
+                g.opts.presets = atoi(optarg);
+                bad = g.opts.presets < 0 || g.opts.presets > 128 * 128;
+                break;
+            case 'z':
+                g.opts.zones = atoi(optarg);
+                bad = g.opts.zones < 1 || g.opts.zones > 128;
+                break;
+            case 's':
+                g.opts.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 1000:
+                bad = parse_ratio(optarg, &g.opts.stereo) != 0;
+                break;
+            case 1001:
+                bad = parse_ratio(optarg, &g.opts.share) != 0;
+                break;
+            case 1002:
+                bad = parse_ratio(optarg, &g.opts.dup) != 0;
+                break;
+            case 1003:
+                bad = parse_ratio(optarg, &g.opts.layered) != 0;
+                break;
+            case 1004:
+                bad = parse_length(optarg, &g.opts.min_length, &g.opts.max_length) != 0;
+                break;
+            case 1005:
+                bad = parse_rates(optarg, &g.opts) != 0;
+                break;
+            case 1006:
+                g.opts.kits = 0;
+                break;
+            case 1007:
+                g.opts.kits = atoi(optarg);
+                bad = g.opts.kits < 0 || g.opts.kits > 128;
+                break;
+            case 1008:
+                bad = parse_length(optarg, &g.opts.drum_min_length,
+                                   &g.opts.drum_max_length) != 0;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+        if (bad) {
+            fprintf(stderr, "Error: Invalid value '%s'\n", optarg);
+            return 1;
+        }
+    }
+
+    if (!output || optind != argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    /* Zero seeds would leave xorshift stuck at zero */
+    g.rng = g.opts.seed * 0x9E3779B97F4A7C15ULL + 1;
+    g.melodic_insts = malloc((size_t)(g.opts.presets > 0 ? g.opts.presets : 1) * sizeof(int));
+    if (!g.melodic_insts) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    for (int p = 0; p < g.opts.presets && !g.failed; p++) {
+        add_melodic_preset(&g, p);
+    }
+    for (int k = 0; k < g.opts.kits && !g.failed; k++) {
+        add_drumkit(&g, k);
+    }
+    add_terminals(&g);
+
+    if (g.failed) {
+        fprintf(stderr, "Error: Bank too large for SF2 (16-bit hydra indices) or out of memory\n");
+        free_generator(&g);
+        return 1;
+    }
+
+    result = write_sf2(&g, output);
+    if (result == 0) {
+        printf("Generated '%s': %d presets, %zu samples, %zu bytes of PCM\n", output,
+               g.opts.presets + g.opts.kits,
+               g.shdr.size / sizeof(struct sfSample) - 1, g.smpl.size);
+    }
+    free_generator(&g);
+    return result == 0 ? 0 : 1;
+}
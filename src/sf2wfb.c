@@ -0,0 +1,316 @@
+/*
+ * sf2wfb.c - Embeddable SF2 to WFB conversion (libsf2wfb)
+ *
+ * Wraps the file-based converter around memory and descriptor streams.
+ * Log output is captured per call so it never reaches the host's stdout.
+ */
+
+#ifdef __APPLE__
+#define _DARWIN_C_SOURCE     /* funopen() */
+#else
+#define _GNU_SOURCE          /* fopencookie() */
+#endif
+
+#include "../include/sf2wfb.h"
+#include "../include/converter.h"
+#include "../include/logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Forward declarations */
+extern void safe_string_copy(char *dest, const char *src, size_t dest_size);
+extern const char *normalize_device_name(const char *name);
+
+/* A caller's sink behind a FILE, counting what it accepts */
+struct SinkStream {
+    SF2WFBSink sink;
+    void *user;
+    size_t bytes;
+};
+
+#ifdef __APPLE__
+static int sink_write(void *cookie, const char *buf, int size) {
+    struct SinkStream *s = cookie;
+
+    if (s->sink(s->user, buf, (size_t)size) != 0) {
+        return -1;
+    }
+    s->bytes += (size_t)size;
+    return size;
+}
+
+static FILE *sink_open(struct SinkStream *s) {
+    return funopen(s, NULL, sink_write, NULL, NULL);
+}
+#else
+static ssize_t sink_write(void *cookie, const char *buf, size_t size) {
+    struct SinkStream *s = cookie;
+
+    if (s->sink(s->user, buf, size) != 0) {
+        return -1;
+    }
+    s->bytes += size;
+    return (ssize_t)size;
+}
+
+static FILE *sink_open(struct SinkStream *s) {
+    cookie_io_functions_t io = { NULL, sink_write, NULL, NULL };
+    return fopencookie(s, "w", io);
+}
+#endif
+
+/* The most telling line of a call's captured output */
+static void capture_message(const struct LogCapture *cap, char *dest, size_t dest_size) {
+    dest[0] = '\0';
+    if (!log_capture_last_line(cap, "Error:", dest, dest_size)) {
+        log_capture_last_line(cap, "Warning:", dest, dest_size);
+    }
+}
+
+/* Whether a stream starts with an SF2 RIFF header; leaves it rewound */
+static int looks_like_sf2(FILE *input) {
+    unsigned char head[12];
+    int ok = fread(head, 1, sizeof(head), input) == sizeof(head) &&
+             memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "sfbk", 4) == 0;
+
+    rewind(input);
+    return ok;
+}
+
+/* Convert input (taken over and closed) into output (flushed, left open) */
+static int convert_stream(FILE *input, const struct SF2WFBOptions *opts,
+                          FILE *output, struct SF2WFBResult *result) {
+    struct ConversionOptions conv;
+    struct LogCapture cap;
+    struct WFBBank wfb;
+    int captured;
+    int status = SF2WFB_OK;
+
+    memset(result, 0, sizeof(*result));
+    memset(&conv, 0, sizeof(conv));
+    conv.device_name = "Maui";
+    if (opts) {
+        if (opts->device) {
+            if (!is_valid_device_name(opts->device)) {
+                snprintf(result->message, sizeof(result->message),
+                         "Error: Invalid device name '%s'", opts->device);
+                fclose(input);
+                return SF2WFB_E_INVALID;
+            }
+            conv.device_name = normalize_device_name(opts->device);
+        }
+        conv.threads = opts->threads;
+        conv.cache_dir = opts->cache_dir;
+    }
+
+    if (!looks_like_sf2(input)) {
+        safe_string_copy(result->message, "Error: Not a valid SF2 file",
+                         sizeof(result->message));
+        fclose(input);
+        return SF2WFB_E_FORMAT;
+    }
+
+    captured = log_capture_begin(&cap) == 0;
+
+    if (convert_sf2_stream_to_bank(input, &conv, &wfb, &result->resampled_count) != 0) {
+        status = SF2WFB_E_CONVERT;
+    } else {
+        if (wfb_write_stream(output, &wfb) != 0 || fflush(output) != 0) {
+            status = SF2WFB_E_IO;
+        }
+        result->program_count = wfb.program_count;
+        result->patch_count = wfb.patch_count;
+        result->sample_count = wfb.sample_count;
+        result->alias_count = wfb.alias_count;
+        result->has_drumkit = wfb.has_drumkit;
+        result->memory_required = wfb.total_sample_memory;
+        result->memory_limit = get_device_memory_limit(wfb.header.szSynthName);
+        free_wfb_bank(&wfb);
+    }
+
+    if (captured) {
+        log_capture_end(&cap);
+        capture_message(&cap, result->message, sizeof(result->message));
+        free(cap.out);
+        free(cap.err);
+    }
+    if (status == SF2WFB_E_IO && result->message[0] == '\0') {
+        safe_string_copy(result->message, "Error: Failed to write WFB output",
+                         sizeof(result->message));
+    }
+    return status;
+}
+
+/* Convert into a malloc'ed buffer */
+static int convert_to_buffer(FILE *input, const struct SF2WFBOptions *opts,
+                             void **wfb_data, size_t *wfb_size,
+                             struct SF2WFBResult *result) {
+    struct SF2WFBResult local;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *output;
+    int status;
+
+    if (!result) {
+        result = &local;
+    }
+    output = open_memstream(&buf, &len);
+    if (!output) {
+        fclose(input);
+        return SF2WFB_E_NOMEM;
+    }
+
+    status = convert_stream(input, opts, output, result);
+    if (fclose(output) != 0 && status == SF2WFB_OK) {
+        status = SF2WFB_E_NOMEM;
+    }
+    if (status != SF2WFB_OK) {
+        free(buf);
+        return status;
+    }
+
+    result->wfb_size = len;
+    *wfb_data = buf;
+    *wfb_size = len;
+    return SF2WFB_OK;
+}
+
+/* Convert into the caller's sink */
+static int convert_to_sink(FILE *input, const struct SF2WFBOptions *opts,
+                           SF2WFBSink sink, void *user, struct SF2WFBResult *result) {
+    struct SF2WFBResult local;
+    struct SinkStream stream = { sink, user, 0 };
+    FILE *output;
+    int status;
+
+    if (!result) {
+        result = &local;
+    }
+    output = sink_open(&stream);
+    if (!output) {
+        fclose(input);
+        return SF2WFB_E_NOMEM;
+    }
+
+    status = convert_stream(input, opts, output, result);
+    if (fclose(output) != 0 && status == SF2WFB_OK) {
+        status = SF2WFB_E_IO;
+    }
+    result->wfb_size = stream.bytes;
+    return status;
+}
+
+/* Results of a call that fails before converting are all zero */
+static void clear_result(struct SF2WFBResult *result) {
+    if (result) {
+        memset(result, 0, sizeof(*result));
+    }
+}
+
+/* Read-only stream over a caller's buffer */
+static FILE *open_buffer(const void *sf2_data, size_t sf2_size) {
+    if (!sf2_data || sf2_size == 0) {
+        return NULL;
+    }
+    return fmemopen((void *)sf2_data, sf2_size, "rb");
+}
+
+/* Stream over a duplicate of a caller's descriptor, so closing it leaves theirs open */
+static FILE *open_fd(int fd) {
+    int copy = fd >= 0 ? dup(fd) : -1;
+    FILE *input;
+
+    if (copy < 0) {
+        return NULL;
+    }
+    input = fdopen(copy, "rb");
+    if (!input) {
+        close(copy);
+    }
+    return input;
+}
+
+int sf2wfb_convert_buffer(const void *sf2_data, size_t sf2_size,
+                          const struct SF2WFBOptions *opts,
+                          void **wfb_data, size_t *wfb_size,
+                          struct SF2WFBResult *result) {
+    FILE *input;
+
+    clear_result(result);
+    if (!wfb_data || !wfb_size) {
+        return SF2WFB_E_INVALID;
+    }
+    input = open_buffer(sf2_data, sf2_size);
+    if (!input) {
+        return sf2_data && sf2_size > 0 ? SF2WFB_E_NOMEM : SF2WFB_E_INVALID;
+    }
+    return convert_to_buffer(input, opts, wfb_data, wfb_size, result);
+}
+
+int sf2wfb_convert_buffer_to_sink(const void *sf2_data, size_t sf2_size,
+                                  const struct SF2WFBOptions *opts,
+                                  SF2WFBSink sink, void *user,
+                                  struct SF2WFBResult *result) {
+    FILE *input;
+
+    clear_result(result);
+    if (!sink) {
+        return SF2WFB_E_INVALID;
+    }
+    input = open_buffer(sf2_data, sf2_size);
+    if (!input) {
+        return sf2_data && sf2_size > 0 ? SF2WFB_E_NOMEM : SF2WFB_E_INVALID;
+    }
+    return convert_to_sink(input, opts, sink, user, result);
+}
+
+int sf2wfb_convert_fd(int fd, const struct SF2WFBOptions *opts,
+                      void **wfb_data, size_t *wfb_size,
+                      struct SF2WFBResult *result) {
+    FILE *input;
+
+    clear_result(result);
+    if (!wfb_data || !wfb_size) {
+        return SF2WFB_E_INVALID;
+    }
+    input = open_fd(fd);
+    if (!input) {
+        return SF2WFB_E_IO;
+    }
+    return convert_to_buffer(input, opts, wfb_data, wfb_size, result);
+}
+
+int sf2wfb_convert_fd_to_sink(int fd, const struct SF2WFBOptions *opts,
+                              SF2WFBSink sink, void *user,
+                              struct SF2WFBResult *result) {
+    FILE *input;
+
+    clear_result(result);
+    if (!sink) {
+        return SF2WFB_E_INVALID;
+    }
+    input = open_fd(fd);
+    if (!input) {
+        return SF2WFB_E_IO;
+    }
+    return convert_to_sink(input, opts, sink, user, result);
+}
+
+void sf2wfb_free(void *wfb_data) {
+    free(wfb_data);
+}
+
+const char *sf2wfb_strerror(int status) {
+    switch (status) {
+        case SF2WFB_OK:         return "Success";
+        case SF2WFB_E_INVALID:  return "Invalid argument";
+        case SF2WFB_E_NOMEM:    return "Out of memory";
+        case SF2WFB_E_IO:       return "I/O error";
+        case SF2WFB_E_FORMAT:   return "Not a valid SF2 file";
+        case SF2WFB_E_CONVERT:  return "Conversion failed";
+        default:                return "Unknown error";
+    }
+}
@@ -0,0 +1,193 @@
+/*
+ * stats.c - Phase timings and counters for --stats
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/stats.h"
+#include "../include/logging.h"
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static const char *phase_names[STAT_PHASE_COUNT] = {
+    "parse_sample_data",
+    "parse_hydra",
+    "assessment",
+    "presets",
+    "drumkit",
+    "sample_copy",
+    "sample_cache",
+    "sample_resample",
+    "sample_hash",
+    "sample_dedup",
+    "wfb_write"
+};
+
+static const char *counter_names[STAT_COUNTER_COUNT] = {
+    "bytes_read",
+    "bytes_written",
+    "dedup_hits",
+    "memcmp_calls",
+    "resample_frames"
+};
+
+static const char *memory_names[STAT_MEM_COUNT] = {
+    "hydra",
+    "source_pcm",
+    "converted_pcm",
+    "tables"
+};
+
+static _Thread_local struct ConversionStats *current_stats;
+
+void stats_init(struct ConversionStats *stats) {
+    for (int i = 0; i < STAT_PHASE_COUNT; i++) {
+        atomic_init(&stats->phase_ns[i], 0);
+        atomic_init(&stats->phase_calls[i], 0);
+    }
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        atomic_init(&stats->counters[i], 0);
+    }
+    for (int i = 0; i < STAT_MEM_COUNT; i++) {
+        atomic_init(&stats->mem_current[i], 0);
+        atomic_init(&stats->mem_peak[i], 0);
+    }
+    atomic_init(&stats->mem_total, 0);
+    atomic_init(&stats->mem_total_peak, 0);
+    stats->wall_ns = 0;
+    stats->peak_rss = 0;
+}
+
+void stats_set_current(struct ConversionStats *stats) {
+    current_stats = stats;
+}
+
+struct ConversionStats *stats_current(void) {
+    return current_stats;
+}
+
+long long stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long stats_phase_begin(void) {
+    return current_stats ? stats_now_ns() : 0;
+}
+
+void stats_phase_end(enum StatPhase phase, long long start) {
+    struct ConversionStats *stats = current_stats;
+
+    if (!stats || start == 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(&stats->phase_ns[phase], stats_now_ns() - start,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->phase_calls[phase], 1, memory_order_relaxed);
+}
+
+void stats_count(enum StatCounter counter, long long amount) {
+    struct ConversionStats *stats = current_stats;
+
+    if (stats) {
+        atomic_fetch_add_explicit(&stats->counters[counter], amount, memory_order_relaxed);
+    }
+}
+
+/* Raise *peak to at least value */
+static void update_peak(atomic_llong *peak, long long value) {
+    long long seen = atomic_load_explicit(peak, memory_order_relaxed);
+
+    while (value > seen &&
+           !atomic_compare_exchange_weak_explicit(peak, &seen, value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+void stats_mem_change(struct ConversionStats *stats, enum StatMemory category,
+                      long long delta) {
+    long long now;
+
+    if (!stats) {
+        return;
+    }
+    now = atomic_fetch_add_explicit(&stats->mem_current[category], delta,
+                                    memory_order_relaxed) + delta;
+    update_peak(&stats->mem_peak[category], now);
+    now = atomic_fetch_add_explicit(&stats->mem_total, delta, memory_order_relaxed) + delta;
+    update_peak(&stats->mem_total_peak, now);
+}
+
+long long stats_peak_rss(void) {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (long long)usage.ru_maxrss;          /* Bytes on macOS */
+#else
+    return (long long)usage.ru_maxrss * 1024;   /* Kilobytes elsewhere */
+#endif
+}
+
+/* Timings, counters and peak memory as JSON members (no enclosing braces) */
+void stats_print_json_fields(const struct ConversionStats *stats) {
+    int i;
+
+    log_printf("\"wall_ms\": %.3f, \"phases\": {", stats->wall_ns / 1e6);
+    for (i = 0; i < STAT_PHASE_COUNT; i++) {
+        log_printf("%s\"%s\": {\"ms\": %.3f, \"calls\": %lld}", i ? ", " : "",
+                   phase_names[i], atomic_load(&stats->phase_ns[i]) / 1e6,
+                   atomic_load(&stats->phase_calls[i]));
+    }
+    log_printf("}, \"counters\": {");
+    for (i = 0; i < STAT_COUNTER_COUNT; i++) {
+        log_printf("%s\"%s\": %lld", i ? ", " : "", counter_names[i],
+                   atomic_load(&stats->counters[i]));
+    }
+    log_printf("}, \"peak_memory\": {");
+    for (i = 0; i < STAT_MEM_COUNT; i++) {
+        log_printf("\"%s\": %lld, ", memory_names[i], atomic_load(&stats->mem_peak[i]));
+    }
+    log_printf("\"tracked_total\": %lld, \"process_rss\": %lld}",
+               atomic_load(&stats->mem_total_peak), stats->peak_rss);
+}
+
+void stats_print(const struct ConversionStats *stats, const char *label, int format) {
+    int i;
+
+    if (format == STATS_JSON) {
+        log_printf("{\"file\": ");
+        log_json_string(label);
+        log_printf(", ");
+        stats_print_json_fields(stats);
+        log_printf("}\n");
+        return;
+    }
+
+    log_printf("\n=== Stats: %s ===\n", label);
+    log_printf("%-20s %12s %10s\n", "Phase", "Time (ms)", "Calls");
+    for (i = 0; i < STAT_PHASE_COUNT; i++) {
+        long long calls = atomic_load(&stats->phase_calls[i]);
+        if (calls == 0) {
+            continue;
+        }
+        log_printf("%-20s %12.3f %10lld\n", phase_names[i],
+                   atomic_load(&stats->phase_ns[i]) / 1e6, calls);
+    }
+    log_printf("%-20s %12.3f\n", "total (wall)", stats->wall_ns / 1e6);
+    log_printf("\n");
+    for (i = 0; i < STAT_COUNTER_COUNT; i++) {
+        log_printf("%-20s %12lld\n", counter_names[i], atomic_load(&stats->counters[i]));
+    }
+    log_printf("\n%-20s %12s\n", "Peak memory", "KiB");
+    for (i = 0; i < STAT_MEM_COUNT; i++) {
+        log_printf("%-20s %12.1f\n", memory_names[i], atomic_load(&stats->mem_peak[i]) / 1024.0);
+    }
+    log_printf("%-20s %12.1f\n", "tracked total", atomic_load(&stats->mem_total_peak) / 1024.0);
+    log_printf("%-20s %12.1f\n", "process RSS", stats->peak_rss / 1024.0);
+}
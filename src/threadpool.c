@@ -0,0 +1,182 @@
+/*
+ * threadpool.c - Fixed-size worker pool for data-parallel loops
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/threadpool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define THREADPOOL_MAX_THREADS 256
+
+struct ThreadPool {
+    pthread_t *workers;
+    int worker_count;               /* Threads besides the caller */
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+
+    /* Current loop, published under lock */
+    parallel_fn fn;
+    void *arg;
+    int count;
+    atomic_int next_index;
+    unsigned long generation;       /* Bumped for every loop */
+    int busy_workers;
+    int shutting_down;
+};
+
+/* Claim and run indices until the loop is exhausted */
+static void run_indices(struct ThreadPool *pool, parallel_fn fn, void *arg, int count) {
+    for (;;) {
+        int i = atomic_fetch_add(&pool->next_index, 1);
+        if (i >= count) {
+            break;
+        }
+        fn(arg, i);
+    }
+}
+
+static void *worker_main(void *data) {
+    struct ThreadPool *pool = data;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutting_down && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutting_down) {
+            break;
+        }
+        seen = pool->generation;
+
+        parallel_fn fn = pool->fn;
+        void *arg = pool->arg;
+        int count = pool->count;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_indices(pool, fn, arg, count);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy_workers == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int threadpool_resolve_count(int requested) {
+    if (requested > 0) {
+        return requested > THREADPOOL_MAX_THREADS ? THREADPOOL_MAX_THREADS : requested;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    return cpus > THREADPOOL_MAX_THREADS ? THREADPOOL_MAX_THREADS : (int)cpus;
+}
+
+struct ThreadPool *threadpool_create(int threads) {
+    struct ThreadPool *pool = calloc(1, sizeof(*pool));
+    int i;
+
+    if (!pool) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    atomic_init(&pool->next_index, 0);
+
+    if (threads <= 1) {
+        return pool;
+    }
+    if (threads > THREADPOOL_MAX_THREADS) {
+        threads = THREADPOOL_MAX_THREADS;
+    }
+
+    pool->workers = calloc((size_t)(threads - 1), sizeof(pthread_t));
+    if (!pool->workers) {
+        return pool;  /* Degrade to inline execution */
+    }
+
+    for (i = 0; i < threads - 1; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+            break;
+        }
+        pool->worker_count++;
+    }
+
+    return pool;
+}
+
+void threadpool_destroy(struct ThreadPool *pool) {
+    int i;
+
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+int threadpool_size(const struct ThreadPool *pool) {
+    return pool ? pool->worker_count + 1 : 1;
+}
+
+void threadpool_parallel_for(struct ThreadPool *pool, int count,
+                             parallel_fn fn, void *arg) {
+    int i;
+
+    if (count <= 0) {
+        return;
+    }
+
+    /* Serial path: no pool, no workers, or nothing to share */
+    if (!pool || pool->worker_count == 0 || count == 1) {
+        for (i = 0; i < count; i++) {
+            fn(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->count = count;
+    atomic_store(&pool->next_index, 0);
+    pool->busy_workers = pool->worker_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* The caller works too, then waits for stragglers */
+    run_indices(pool, fn, arg, count);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_workers > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,153 @@
+/*
+ * trace.c - Chrome/Perfetto trace-event output for --trace
+ *
+ * Spans are kept in memory as complete ("X") events and written as a JSON
+ * trace at the end of the run; load it in chrome://tracing or Perfetto.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/trace.h"
+#include "../include/stats.h"
+#include "../include/logging.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_DETAIL_LENGTH 96
+
+struct TraceEvent {
+    const char *name;                /* Static string */
+    char detail[TRACE_DETAIL_LENGTH];  /* Already JSON-escaped */
+    long long start_ns;
+    long long dur_ns;
+    int tid;
+};
+
+static atomic_int trace_enabled;
+static const char *trace_path;
+static long long trace_origin_ns;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct TraceEvent *trace_events;
+static size_t trace_event_count;
+static size_t trace_event_capacity;
+static atomic_int trace_next_tid;
+static _Thread_local int trace_tid;
+
+int trace_open(const char *path) {
+    FILE *f = fopen(path, "w");
+
+    /* Fail early rather than after a long run */
+    if (!f) {
+        log_errorf("Error: Cannot create trace file '%s'\n", path);
+        return -1;
+    }
+    fclose(f);
+
+    trace_path = path;
+    trace_origin_ns = stats_now_ns();
+    atomic_store(&trace_enabled, 1);
+    return 0;
+}
+
+long long trace_begin(void) {
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return 0;
+    }
+    return stats_now_ns();
+}
+
+void trace_end(long long start, const char *name, const char *detail_fmt, ...) {
+    struct TraceEvent event;
+    char detail[512];
+    va_list args;
+
+    if (start == 0) {
+        return;
+    }
+
+    event.dur_ns = stats_now_ns() - start;
+    event.start_ns = start - trace_origin_ns;
+    event.name = name;
+    event.detail[0] = '\0';
+    if (detail_fmt) {
+        /* Escape before truncating, so no escape or character is cut in half */
+        va_start(args, detail_fmt);
+        vsnprintf(detail, sizeof(detail), detail_fmt, args);
+        va_end(args);
+        log_json_escape(detail, event.detail, sizeof(event.detail));
+    }
+    if (trace_tid == 0) {
+        trace_tid = atomic_fetch_add(&trace_next_tid, 1) + 1;
+    }
+    event.tid = trace_tid;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_event_count >= trace_event_capacity) {
+        size_t new_capacity = trace_event_capacity ? trace_event_capacity * 2 : 4096;
+        struct TraceEvent *grown = realloc(trace_events, new_capacity * sizeof(*grown));
+        if (!grown) {
+            pthread_mutex_unlock(&trace_lock);
+            return;  /* Drop the event rather than fail the conversion */
+        }
+        trace_events = grown;
+        trace_event_capacity = new_capacity;
+    }
+    trace_events[trace_event_count++] = event;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void write_json_string(FILE *f, const char *s) {
+    char escaped[256];
+
+    log_json_escape(s, escaped, sizeof(escaped));
+    fprintf(f, "\"%s\"", escaped);
+}
+
+int trace_close(void) {
+    FILE *f;
+    int ok;
+
+    if (!atomic_exchange(&trace_enabled, 0)) {
+        return 0;
+    }
+
+    f = fopen(trace_path, "w");
+    if (!f) {
+        log_errorf("Error: Cannot create trace file '%s'\n", trace_path);
+        return -1;
+    }
+
+    fprintf(f, "{\"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, "
+               "\"args\": {\"name\": \"sf2wfb\"}}");
+    for (size_t i = 0; i < trace_event_count; i++) {
+        const struct TraceEvent *e = &trace_events[i];
+        fprintf(f, ",\n{\"name\": ");
+        write_json_string(f, e->name);
+        fprintf(f, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                e->tid, e->start_ns / 1000.0, e->dur_ns / 1000.0);
+        if (e->detail[0]) {
+            fprintf(f, ", \"args\": {\"detail\": \"%s\"}", e->detail);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+
+    ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+
+    free(trace_events);
+    trace_events = NULL;
+    trace_event_count = 0;
+    trace_event_capacity = 0;
+
+    if (!ok) {
+        log_errorf("Error: Failed to write trace file '%s'\n", trace_path);
+        return -1;
+    }
+    return 0;
+}
@@ -3,6 +3,8 @@
  */
 
 #include "../include/converter.h"
+#include "../include/logging.h"
+#include "../include/memtrack.h"
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -25,9 +27,8 @@ int file_exists(const char *filename) {
     return stat(filename, &st) == 0;
 }
 
-/* Get auto-incremented filename if file exists */
-const char *get_auto_increment_filename(const char *base_path) {
-    static char result[512];
+/* Get auto-incremented filename if file exists (result written to buf) */
+const char *get_auto_increment_filename(const char *base_path, char *buf, size_t buf_size) {
     char base[512];
     char ext[32];
     const char *dot;
@@ -51,12 +52,12 @@ const char *get_auto_increment_filename(const char *base_path) {
 
     /* Find available filename */
     do {
-        snprintf(result, sizeof(result), "%s%d%s", base, counter, ext);
+        snprintf(buf, buf_size, "%s%d%s", base, counter, ext);
         counter++;
-    } while (file_exists(result));
+    } while (file_exists(buf));
 
-    printf("File '%s' exists. Saved as '%s'.\n", base_path, result);
-    return result;
+    log_printf("File '%s' exists. Saved as '%s'.\n", base_path, buf);
+    return buf;
 }
 
 /* Get device memory limit */
@@ -85,9 +86,8 @@ int is_valid_device_name(const char *name) {
             strcasecmp(name, "TBS-2001") == 0);  /* Accept all variants */
 }
 
-/* Normalize device name to proper case */
+/* Normalize device name to proper case; unknown names are returned as-is */
 const char *normalize_device_name(const char *name) {
-    static char result[32];
     if (strcasecmp(name, "rio") == 0) {
         return "Rio";
     } else if (strcasecmp(name, "maui") == 0) {
@@ -99,15 +99,35 @@ const char *normalize_device_name(const char *name) {
                strcasecmp(name, "tbs-2001") == 0) {
         return "TBS-2001";  /* Official model number (Tropez Plus) */
     }
-    strncpy(result, name, sizeof(result) - 1);
-    result[sizeof(result) - 1] = '\0';
-    return result;
+    return name;
 }
 
-/* Initialize WFB bank structure */
-void init_wfb_bank(struct WFBBank *bank, const char *device_name) {
+/* Zeroed bank table of count entries (at least one, so empty banks allocate) */
+static void *alloc_bank_table(int count, size_t size) {
+    return mem_calloc(STAT_MEM_TABLES, (size_t)(count > 0 ? count : 1), size);
+}
+
+/*
+ * Initialize WFB bank structure with tables for the given counts
+ * (clamped to the WaveFront limits). Returns -1 if allocation fails.
+ */
+int init_wfb_bank(struct WFBBank *bank, const char *device_name,
+                  int programs, int patches, int samples) {
     memset(bank, 0, sizeof(*bank));
 
+    bank->program_capacity = programs < WF_MAX_PROGRAMS ? programs : WF_MAX_PROGRAMS;
+    bank->patch_capacity = patches < WF_MAX_PATCHES ? patches : WF_MAX_PATCHES;
+    bank->sample_capacity = samples < WF_MAX_SAMPLES ? samples : WF_MAX_SAMPLES;
+    bank->programs = alloc_bank_table(bank->program_capacity, sizeof(*bank->programs));
+    bank->patches = alloc_bank_table(bank->patch_capacity, sizeof(*bank->patches));
+    bank->sample_keys = alloc_bank_table(bank->sample_capacity, sizeof(*bank->sample_keys));
+    bank->samples = alloc_bank_table(bank->sample_capacity, sizeof(*bank->samples));
+    if (!bank->programs || !bank->patches || !bank->sample_keys || !bank->samples) {
+        log_errorf("Error: Failed to allocate WFB bank tables\n");
+        free_wfb_bank(bank);
+        return -1;
+    }
+
     /* Initialize header */
     strncpy(bank->header.szSynthName, normalize_device_name(device_name), NAME_LENGTH - 1);
     strncpy(bank->header.szFileType, "Bank", NAME_LENGTH - 1);
@@ -117,6 +137,32 @@ void init_wfb_bank(struct WFBBank *bank, const char *device_name) {
     /* Set comment */
     snprintf(bank->header.szComment, MAX_COMMENT,
              "Generated by SF2WFB - SoundFont 2 to WaveFront Converter");
+    return 0;
+}
+
+/* Free WFB bank tables and the PCM they own */
+void free_wfb_bank(struct WFBBank *bank) {
+    if (bank->samples) {
+        uintptr_t map_start = (uintptr_t)bank->map;
+        for (int i = 0; i < bank->sample_count; i++) {
+            uintptr_t pcm = (uintptr_t)bank->samples[i].pcm_data;
+            /* PCM viewed in place from a mapped file is not ours to free */
+            if (!bank->map || pcm < map_start || pcm >= map_start + bank->map_size) {
+                mem_free(bank->samples[i].pcm_data);
+            }
+        }
+    }
+    mem_free(bank->programs);
+    mem_free(bank->patches);
+    mem_free(bank->sample_keys);
+    mem_free(bank->samples);
+    bank->programs = NULL;
+    bank->patches = NULL;
+    bank->sample_keys = NULL;
+    bank->samples = NULL;
+    bank->program_capacity = bank->patch_capacity = bank->sample_capacity = 0;
+    bank->program_count = bank->patch_count = bank->sample_count = 0;
+    wfb_unmap(bank);
 }
 
 /* Copy and truncate string */
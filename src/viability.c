@@ -4,6 +4,8 @@
 
 #include "../include/viability.h"
 #include "../include/converter.h"
+#include "../include/logging.h"
+#include "../include/memtrack.h"
 #include "../include/wfb_types.h"
 #include "../include/sf2_types.h"
 #include <stdio.h>
@@ -156,136 +158,95 @@ static void trace_sample_references(struct SF2Bank *sf2, struct ViabilityReport
     r->samples_unused = sf2->sample_count - referenced;
 }
 
-/* Simplified zone grouping simulation (doesn't need full conversion) */
-static int simulate_layer_truncation(struct SF2Bank *sf2, struct ViabilityReport *r,
-                                     uint8_t *sample_used_after_truncation) {
-    memset(sample_used_after_truncation, 0, sf2->sample_count);
-
+/* Run the converter's planning pass and resolve its dedup without PCM */
+static int analyze_conversion_plan(struct SF2Bank *sf2, struct ViabilityReport *r,
+                                   const struct ConversionOptions *opts) {
+    struct ConversionOptions defaults;
+    struct ConversionOptions plan_opts;
+    struct ConversionPlan *plan;
+    struct PlanEstimate est;
     int total_layers_before = 0;
     int total_layers_after = 0;
-    int programs_analyzed = 0;
-
-    r->programs_with_truncation = 0;
-    r->top_truncated_count = 0;
-
-    /* For each GM melodic program */
-    for (int prog_num = 0; prog_num < 128; prog_num++) {
-        struct sfPresetHeader *preset = sf2_get_preset(sf2, 0, prog_num);
-        if (!preset) continue;
-
-        programs_analyzed++;
-
-        /* Parse preset to count unique layer groups */
-        /* Simplified: count instrument zones as rough layer estimate */
-        int bag_start = preset->wPresetBagNdx;
-        int bag_end = (preset < &sf2->presets[sf2->preset_count - 1]) ?
-                     (preset + 1)->wPresetBagNdx : sf2->preset_bag_count;
 
-        int zone_count = 0;
-        int sample_indices[128];  /* Track samples for this program */
+    memset(&defaults, 0, sizeof(defaults));
+    plan_opts = opts ? *opts : defaults;
+    plan_opts.verbose = 0;  /* Per-program notices belong to the conversion */
 
-        for (int i = bag_start; i < bag_end; i++) {
-            struct sfPresetBag *bag = &sf2->preset_bags[i];
-            int gen_start = bag->wGenNdx;
-            int gen_end = (i + 1 < sf2->preset_bag_count) ?
-                         sf2->preset_bags[i + 1].wGenNdx : sf2->preset_gen_count;
-
-            /* Find instrument */
-            int instrument_idx = -1;
-            for (int j = gen_start; j < gen_end; j++) {
-                if (sf2->preset_gens[j].sfGenOper == GEN_INSTRUMENT) {
-                    instrument_idx = sf2->preset_gens[j].genAmount.wAmount;
-                    break;
-                }
-            }
-
-            if (instrument_idx < 0 || instrument_idx >= sf2->inst_count) {
-                continue;
-            }
-
-            /* Count instrument zones */
-            struct sfInst *inst = &sf2->instruments[instrument_idx];
-            int inst_bag_start = inst->wInstBagNdx;
-            int inst_bag_end = (instrument_idx + 1 < sf2->inst_count) ?
-                              sf2->instruments[instrument_idx + 1].wInstBagNdx :
-                              sf2->inst_bag_count;
-
-            for (int ib = inst_bag_start; ib < inst_bag_end; ib++) {
-                struct sfInstBag *inst_bag = &sf2->inst_bags[ib];
-                int inst_gen_start = inst_bag->wInstGenNdx;
-                int inst_gen_end = (ib + 1 < sf2->inst_bag_count) ?
-                                  sf2->inst_bags[ib + 1].wInstGenNdx :
-                                  sf2->inst_gen_count;
+    plan = mem_alloc(STAT_MEM_TABLES, sizeof(*plan));
+    if (!plan) {
+        return -1;
+    }
 
-                /* Check if this zone has a sample */
-                int has_sample = 0;
-                int sample_idx = -1;
-                for (int ig = inst_gen_start; ig < inst_gen_end; ig++) {
-                    if (sf2->inst_gens[ig].sfGenOper == GEN_SAMPLE_ID) {
-                        sample_idx = sf2->inst_gens[ig].genAmount.wAmount;
-                        has_sample = 1;
-                        break;
-                    }
-                }
+    if (plan_conversion(sf2, &plan_opts, plan) != 0 ||
+        estimate_plan(plan, sf2, &est) != 0) {
+        plan_release_sources(plan, sf2);
+        mem_free(plan);
+        return -1;
+    }
+    plan_release_sources(plan, sf2);
 
-                if (has_sample && sample_idx >= 0 && sample_idx < sf2->sample_count) {
-                    if (zone_count < 128) {
-                        sample_indices[zone_count] = sample_idx;
-                        zone_count++;
-                    }
-                }
-            }
-        }
+    r->programs_with_truncation = 0;
+    r->top_truncated_count = 0;
 
-        /* Rough estimate: each zone is a potential layer/group */
-        /* This is simplified - real converter groups by velocity/pan/etc */
-        int layers_before = zone_count;
-        int layers_after = (layers_before > NUM_LAYERS) ? NUM_LAYERS : layers_before;
+    for (int i = 0; i < plan->program_count; i++) {
+        const struct PlanProgramStats *stats = &plan->program_stats[i];
+        int layers_before = stats->layers_wanted;
+        int layers_after = stats->layers_used;
 
         total_layers_before += layers_before;
         total_layers_after += layers_after;
 
-        /* Mark samples from "first 4 layers" as used (simplified) */
-        int samples_to_keep = (zone_count > NUM_LAYERS) ? NUM_LAYERS : zone_count;
-        for (int z = 0; z < samples_to_keep; z++) {
-            sample_used_after_truncation[sample_indices[z]] = 1;
+        if (layers_after >= layers_before) {
+            continue;
         }
+        r->programs_with_truncation++;
 
-        /* Track truncation */
-        if (layers_before > NUM_LAYERS) {
-            r->programs_with_truncation++;
-
-            /* Add to top truncated list */
-            if (r->top_truncated_count < MAX_TOP_TRUNCATED) {
-                struct TopTruncated *t = &r->top_truncated[r->top_truncated_count];
-                t->program_num = prog_num;
-                strncpy(t->name, preset->achPresetName, 20);
-                t->name[19] = '\0';
-                t->layers_before = layers_before;
-                t->layers_after = layers_after;
-                t->layers_lost = layers_before - layers_after;
-                r->top_truncated_count++;
-            }
+        /* Keep the programs losing most layers, in program order on ties */
+        int pos = r->top_truncated_count;
+        while (pos > 0 &&
+               r->top_truncated[pos - 1].layers_lost < layers_before - layers_after) {
+            pos--;
         }
-    }
-
-    /* Calculate averages */
-    if (programs_analyzed > 0) {
-        r->avg_layers_before = (float)total_layers_before / programs_analyzed;
-        r->avg_layers_after = (float)total_layers_after / programs_analyzed;
-    }
-
-    r->total_programs = programs_analyzed;
-
-    /* Count samples after truncation */
-    int count = 0;
-    for (int i = 0; i < sf2->sample_count; i++) {
-        if (sample_used_after_truncation[i]) {
-            count++;
+        if (pos >= MAX_TOP_TRUNCATED) {
+            continue;
+        }
+        int last = r->top_truncated_count < MAX_TOP_TRUNCATED ?
+                   r->top_truncated_count : MAX_TOP_TRUNCATED - 1;
+        memmove(&r->top_truncated[pos + 1], &r->top_truncated[pos],
+                (size_t)(last - pos) * sizeof(r->top_truncated[0]));
+
+        struct TopTruncated *t = &r->top_truncated[pos];
+        t->program_num = plan->programs[i].nNumber;
+        strncpy(t->name, plan->programs[i].szName, 20);
+        t->name[19] = '\0';
+        t->layers_before = layers_before;
+        t->layers_after = layers_after;
+        t->layers_lost = layers_before - layers_after;
+        if (r->top_truncated_count < MAX_TOP_TRUNCATED) {
+            r->top_truncated_count++;
         }
     }
 
-    return count;
+    /* Calculate averages */
+    if (plan->program_count > 0) {
+        r->avg_layers_before = (float)total_layers_before / plan->program_count;
+        r->avg_layers_after = (float)total_layers_after / plan->program_count;
+    }
+
+    r->total_programs = plan->program_count;
+    r->planned_patches = est.patch_count;
+    r->planned_samples = est.sample_count;
+    r->planned_stored_samples = est.stored_samples;
+    r->planned_aliases = est.alias_count;
+    r->planned_multisamples = est.multisample_count;
+    r->samples_over_limit = plan->slots_refused;
+    r->samples_after_truncation = est.sample_count + plan->slots_refused;
+    r->memory_required = est.memory_required;
+    r->estimated_wfb_size = est.file_size;
+    r->estimated_ram_usage = est.memory_required;
+
+    mem_free(plan);
+    return 0;
 }
 
 /* Detect use of filter Q */
@@ -366,26 +327,7 @@ static void detect_filter_q_usage(struct SF2Bank *sf2, struct ViabilityReport *r
 }
 
 /* Calculate size estimates */
-static void calculate_size_estimates(struct SF2Bank *sf2, struct ViabilityReport *r,
-                                     uint8_t *sample_used_after_truncation) {
-    /* WFB header + patch table */
-    size_t header = 256;
-    size_t patch_table = WF_MAX_PATCHES * sizeof(struct PATCH);
-    size_t sample_table = r->samples_after_truncation * sizeof(struct SAMPLE);
-
-    /* Estimate PCM data size */
-    size_t pcm_data = 0;
-    for (int i = 0; i < sf2->sample_count; i++) {
-        if (sample_used_after_truncation[i]) {
-            struct sfSample *s = &sf2->samples[i];
-            uint32_t length = s->dwEnd - s->dwStart;
-            pcm_data += length * 2;  /* 16-bit samples */
-        }
-    }
-
-    r->estimated_wfb_size = header + patch_table + sample_table + pcm_data;
-    r->estimated_ram_usage = r->estimated_wfb_size;
-
+static void calculate_size_estimates(struct ViabilityReport *r) {
     if (r->sf2_size_bytes > 0) {
         r->size_reduction_pct = 100.0 * (1.0 - (float)r->estimated_wfb_size / r->sf2_size_bytes);
     }
@@ -505,8 +447,6 @@ int assess_sf2_viability(const char *sf2_path,
     struct SF2Bank sf2;
     struct stat st;
 
-    (void)config;  /* Currently unused, reserved for future options */
-
     memset(report, 0, sizeof(*report));
 
     /* Get file size */
@@ -523,32 +463,33 @@ int assess_sf2_viability(const char *sf2_path,
     }
     strncpy(report->filename, filename, sizeof(report->filename) - 1);
 
-    /* Open SF2 file */
-    if (sf2_open(sf2_path, &sf2) != 0) {
-        fprintf(stderr, "Error: Failed to open SF2 file\n");
+    /* Open SF2 hydra; PCM is only read to confirm duplicate samples */
+    if (sf2_open_hydra(sf2_path, &sf2) != 0) {
+        log_errorf("Error: Failed to open SF2 file\n");
         return -1;
     }
 
     report->total_samples_in_sf2 = sf2.sample_count;
 
-    /* Allocate sample tracking arrays */
-    uint8_t *sample_used = calloc(sf2.sample_count, 1);
-    uint8_t *sample_used_after_truncation = calloc(sf2.sample_count, 1);
-    if (!sample_used || !sample_used_after_truncation) {
-        fprintf(stderr, "Error: Failed to allocate memory\n");
+    /* Allocate sample tracking array */
+    uint8_t *sample_used = mem_calloc(STAT_MEM_TABLES, sf2.sample_count > 0 ? sf2.sample_count : 1, 1);
+    if (!sample_used) {
+        log_errorf("Error: Failed to allocate memory\n");
         sf2_close(&sf2);
-        free(sample_used);
-        free(sample_used_after_truncation);
         return -1;
     }
 
     /* Run assessments */
     analyze_presets(&sf2, report);
     trace_sample_references(&sf2, report, sample_used);
-    report->samples_after_truncation = simulate_layer_truncation(&sf2, report,
-                                                                 sample_used_after_truncation);
+    if (analyze_conversion_plan(&sf2, report, config ? config->conversion : NULL) != 0) {
+        log_errorf("Error: Failed to plan conversion\n");
+        mem_free(sample_used);
+        sf2_close(&sf2);
+        return -1;
+    }
     detect_filter_q_usage(&sf2, report);
-    calculate_size_estimates(&sf2, report, sample_used_after_truncation);
+    calculate_size_estimates(report);
 
     /* Calculate grade and generate suggestions */
     report->grade = calculate_grade(report);
@@ -583,8 +524,7 @@ int assess_sf2_viability(const char *sf2_path,
     }
 
     /* Cleanup */
-    free(sample_used);
-    free(sample_used_after_truncation);
+    mem_free(sample_used);
     sf2_close(&sf2);
 
     return 0;
@@ -600,73 +540,78 @@ void print_viability_summary(const struct ViabilityReport *r) {
         ['F'] = "Not recommended"
     };
 
-    printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-    printf(" SF2 Conversion Assessment: %s\n", r->filename);
-    printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
+    log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
+    log_printf(" SF2 Conversion Assessment: %s\n", r->filename);
+    log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
 
-    printf(" Overall Grade:     %c  (%s)\n\n", r->grade, grade_desc[(int)r->grade]);
+    log_printf(" Overall Grade:     %c  (%s)\n\n", r->grade, grade_desc[(int)r->grade]);
 
-    printf(" Bank 0 Presets:    %-3d / 128  (%d%%) %s\n",
-           r->bank0_presets, (r->bank0_presets * 100) / 128,
-           r->bank0_presets >= 120 ? "✓" : "⚠");
+    log_printf(" Bank 0 Presets:    %-3d / 128  (%d%%) %s\n",
+               r->bank0_presets, (r->bank0_presets * 100) / 128,
+               r->bank0_presets >= 120 ? "✓" : "⚠");
 
-    printf(" Bank 128 Presets:  %-3d / 1    (%d%%) %s\n",
-           r->bank128_presets, r->bank128_presets * 100,
-           r->bank128_presets > 0 ? "✓" : " ");
+    log_printf(" Bank 128 Presets:  %-3d / 1    (%d%%) %s\n",
+               r->bank128_presets, r->bank128_presets * 100,
+               r->bank128_presets > 0 ? "✓" : " ");
 
     if (r->other_bank_presets > 0) {
-        printf(" Unused Presets:    %d from other banks\n", r->other_bank_presets);
+        log_printf(" Unused Presets:    %d from other banks\n", r->other_bank_presets);
     }
 
-    printf("\n Sample Budget:     %-3d / %d  (%d%%)  %s\n",
-           r->samples_after_truncation, WF_MAX_SAMPLES,
-           (r->samples_after_truncation * 100) / WF_MAX_SAMPLES,
-           r->samples_after_truncation <= WF_MAX_SAMPLES ? "✓" : "✗");
+    log_printf("\n Sample Budget:     %-3d / %d  (%d%%)  %s\n",
+               r->samples_after_truncation, WF_MAX_SAMPLES,
+               (r->samples_after_truncation * 100) / WF_MAX_SAMPLES,
+               r->samples_after_truncation <= WF_MAX_SAMPLES ? "✓" : "✗");
 
     if (r->samples_after_truncation <= WF_MAX_SAMPLES) {
         int headroom = WF_MAX_SAMPLES - r->samples_after_truncation;
-        printf(" Sample Headroom:   %d samples available\n", headroom);
+        log_printf(" Sample Headroom:   %d samples available\n", headroom);
+    }
+
+    log_printf(" Patch Budget:      %-3d / %d\n", r->planned_patches, WF_MAX_PATCHES);
+    if (r->planned_aliases > 0) {
+        log_printf(" Deduped Samples:   %d aliases\n", r->planned_aliases);
     }
 
     if (r->programs_with_truncation > 0) {
-        printf("\n Layer Truncation:  %d programs affected       ⚠\n",
-               r->programs_with_truncation);
-        printf(" Avg Complexity:    %.1f → %.1f layers per prog\n",
-               r->avg_layers_before, r->avg_layers_after);
+        log_printf("\n Layer Truncation:  %d programs affected       ⚠\n",
+                   r->programs_with_truncation);
+        log_printf(" Avg Complexity:    %.1f → %.1f layers per prog\n",
+                   r->avg_layers_before, r->avg_layers_after);
     }
 
-    printf("\n Estimated Size:    %.1f MB (%.0f%% smaller)\n",
-           r->estimated_wfb_size / (1024.0 * 1024.0),
-           r->size_reduction_pct);
+    log_printf("\n Estimated Size:    %.1f MB (%.0f%% smaller)\n",
+               r->estimated_wfb_size / (1024.0 * 1024.0),
+               r->size_reduction_pct);
 
-    printf(" RAM Required:      %.1f MB (Tropez: %d%%, Rio: %d%%)\n",
-           r->estimated_ram_usage / (1024.0 * 1024.0),
-           (int)((r->estimated_ram_usage * 100) / (8 * 1024 * 1024)),
-           (int)((r->estimated_ram_usage * 100) / (4 * 1024 * 1024)));
+    log_printf(" RAM Required:      %.1f MB, %u bytes (Tropez: %d%%, Rio: %d%%)\n",
+               r->estimated_ram_usage / (1024.0 * 1024.0), r->memory_required,
+               (int)((r->estimated_ram_usage * 100) / (8 * 1024 * 1024)),
+               (int)((r->estimated_ram_usage * 100) / (4 * 1024 * 1024)));
 
     /* Warnings section */
     if (r->warning_count > 0) {
-        printf("\n━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-        printf(" WARNINGS\n");
-        printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
+        log_printf("\n━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
+        log_printf(" WARNINGS\n");
+        log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
 
         for (int i = 0; i < r->warning_count; i++) {
-            printf(" ⚠ %s\n", r->warnings[i]);
+            log_printf(" ⚠ %s\n", r->warnings[i]);
         }
     }
 
     /* Recommendations section */
     if (r->suggestion_count > 0) {
-        printf("\n━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-        printf(" RECOMMENDATIONS\n");
-        printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
+        log_printf("\n━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
+        log_printf(" RECOMMENDATIONS\n");
+        log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
 
         for (int i = 0; i < r->suggestion_count; i++) {
-            printf(" • %s\n", r->suggestions[i]);
+            log_printf(" • %s\n", r->suggestions[i]);
         }
     }
 
-    printf("\n");
+    log_printf("\n");
 }
 
 /* Print verbose report */
@@ -678,77 +623,83 @@ void print_viability_verbose(const struct ViabilityReport *r) {
 
     /* Layer truncation details */
     if (r->top_truncated_count > 0) {
-        printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-        printf(" LAYER TRUNCATION DETAILS\n");
-        printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
+        log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
+        log_printf(" LAYER TRUNCATION DETAILS\n");
+        log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
 
-        printf(" Programs losing most layers:\n\n");
+        log_printf(" Programs losing most layers:\n\n");
 
         int show_count = r->top_truncated_count < 10 ? r->top_truncated_count : 10;
         for (int i = 0; i < show_count; i++) {
             const struct TopTruncated *t = &r->top_truncated[i];
-            printf("   %-3d %-16s %2d → %d  (−%d)  ",
-                   t->program_num, t->name,
-                   t->layers_before, t->layers_after, t->layers_lost);
+            log_printf("   %-3d %-16s %2d → %d  (−%d)  ",
+                       t->program_num, t->name,
+                       t->layers_before, t->layers_after, t->layers_lost);
 
             /* Warning symbols based on severity */
             int loss_pct = (t->layers_lost * 100) / t->layers_before;
-            if (loss_pct > 66) printf("⚠⚠⚠\n");
-            else if (loss_pct > 33) printf("⚠⚠\n");
-            else printf("⚠\n");
+            if (loss_pct > 66) log_printf("⚠⚠⚠\n");
+            else if (loss_pct > 33) log_printf("⚠⚠\n");
+            else log_printf("⚠\n");
         }
 
         int unaffected = r->total_programs - r->programs_with_truncation;
-        printf("\n Programs unaffected: %d (already ≤%d layers) ✓\n",
-               unaffected, NUM_LAYERS);
+        log_printf("\n Programs unaffected: %d (already ≤%d layers) ✓\n",
+                   unaffected, NUM_LAYERS);
 
-        printf("\n");
+        log_printf("\n");
     }
 
     /* Feature compatibility details */
-    printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-    printf(" FEATURE COMPATIBILITY\n");
-    printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
+    log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
+    log_printf(" FEATURE COMPATIBILITY\n");
+    log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
 
     if (r->programs_using_filter_q > 0) {
-        printf(" Filter Q Usage:\n");
-        printf("   %d programs use filter resonance\n", r->programs_using_filter_q);
-        printf("   WaveFront ICS2115 has no resonance parameter\n");
-        printf("   Timbral character may change\n\n");
+        log_printf(" Filter Q Usage:\n");
+        log_printf("   %d programs use filter resonance\n", r->programs_using_filter_q);
+        log_printf("   WaveFront ICS2115 has no resonance parameter\n");
+        log_printf("   Timbral character may change\n\n");
     } else {
-        printf(" Filter Q: Not used ✓\n\n");
+        log_printf(" Filter Q: Not used ✓\n\n");
     }
 
     /* Sample analysis details */
-    printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
-    printf(" SAMPLE ANALYSIS\n");
-    printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
-
-    printf(" Total samples in SF2:       %d\n", r->total_samples_in_sf2);
-    printf(" Referenced by Bank 0/128:   %d  (%d%%)\n",
-           r->samples_referenced_by_gm,
-           (r->samples_referenced_by_gm * 100) / r->total_samples_in_sf2);
-    printf(" Unused/orphaned samples:    %d  (%d%%)\n\n",
-           r->samples_unused,
-           (r->samples_unused * 100) / r->total_samples_in_sf2);
-
-    printf(" After %d-layer truncation:   %d samples needed\n",
-           NUM_LAYERS, r->samples_after_truncation);
-    printf(" WaveFront limit:            %d samples\n", WF_MAX_SAMPLES);
-    printf(" Utilization:                %d%%\n",
-           (r->samples_after_truncation * 100) / WF_MAX_SAMPLES);
+    log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
+    log_printf(" SAMPLE ANALYSIS\n");
+    log_printf("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n\n");
+
+    log_printf(" Total samples in SF2:       %d\n", r->total_samples_in_sf2);
+    log_printf(" Referenced by Bank 0/128:   %d  (%d%%)\n",
+               r->samples_referenced_by_gm,
+               (r->samples_referenced_by_gm * 100) / r->total_samples_in_sf2);
+    log_printf(" Unused/orphaned samples:    %d  (%d%%)\n\n",
+               r->samples_unused,
+               (r->samples_unused * 100) / r->total_samples_in_sf2);
+
+    log_printf(" After %d-layer truncation:   %d samples needed\n",
+               NUM_LAYERS, r->samples_after_truncation);
+    log_printf("   PCM samples:              %d\n", r->planned_stored_samples);
+    log_printf("   Aliases (deduped):        %d\n", r->planned_aliases);
+    log_printf("   Multisample tables:       %d\n", r->planned_multisamples);
+    log_printf(" WaveFront limit:            %d samples\n", WF_MAX_SAMPLES);
+    log_printf(" Utilization:                %d%%\n",
+               (r->samples_after_truncation * 100) / WF_MAX_SAMPLES);
 
     if (r->samples_after_truncation <= WF_MAX_SAMPLES) {
         int headroom = WF_MAX_SAMPLES - r->samples_after_truncation;
-        printf(" Headroom:                   %d samples (%d%%)\n\n",
-               headroom, (headroom * 100) / WF_MAX_SAMPLES);
-        printf(" No sample overflow ✓\n");
+        log_printf(" Headroom:                   %d samples (%d%%)\n\n",
+                   headroom, (headroom * 100) / WF_MAX_SAMPLES);
+        log_printf(" No sample overflow ✓\n");
     } else {
         int overflow = r->samples_after_truncation - WF_MAX_SAMPLES;
-        printf(" OVERFLOW:                   +%d samples ✗\n", overflow);
+        log_printf(" OVERFLOW:                   +%d samples ✗\n", overflow);
     }
 
-    printf("\n");
+    log_printf("\n Memory required:            %u bytes (%.2f MB)\n",
+               r->memory_required, r->memory_required / (1024.0 * 1024.0));
+
+    log_printf("\n");
 }
 
 /* Prompt user to proceed */
@@ -757,7 +708,7 @@ int prompt_user_proceed(const struct ViabilityReport *report) {
         return 1;  /* No warnings, proceed automatically */
     }
 
-    printf("Proceed with conversion? [Y/n]: ");
+    log_printf("Proceed with conversion? [Y/n]: ");
     fflush(stdout);
 
     char response[10];
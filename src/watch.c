@@ -0,0 +1,205 @@
+/*
+ * watch.c - Convert files dropped into a directory (--watch)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/watch.h"
+#include "../include/logging.h"
+#include "../include/stats.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_IDLE_MS 1000           /* Longest poll while nothing is pending */
+
+static volatile sig_atomic_t stop_requested;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/* A file waiting for its writes to settle */
+struct PendingFile {
+    char *path;
+    long long due_ns;
+};
+
+struct PendingList {
+    struct PendingFile *files;
+    int count;
+    int capacity;
+};
+
+static int name_has_ext(const char *name, const char *ext) {
+    size_t len = strlen(name);
+    size_t ext_len = strlen(ext);
+
+    return len > ext_len && strcasecmp(name + len - ext_len, ext) == 0;
+}
+
+/* Queue dir/name, or push back its deadline if it is already queued */
+static int queue_file(struct PendingList *list, const char *dir, const char *name,
+                      long long due_ns) {
+    size_t len = strlen(dir) + 1 + strlen(name) + 1;
+    char *path = malloc(len);
+
+    if (!path) {
+        return -1;
+    }
+    snprintf(path, len, "%s/%s", dir, name);
+
+    for (int i = 0; i < list->count; i++) {
+        if (strcmp(list->files[i].path, path) == 0) {
+            list->files[i].due_ns = due_ns;
+            free(path);
+            return 0;
+        }
+    }
+
+    if (list->count >= list->capacity) {
+        int new_capacity = list->capacity ? list->capacity * 2 : 16;
+        struct PendingFile *grown = realloc(list->files,
+                                            (size_t)new_capacity * sizeof(*grown));
+        if (!grown) {
+            free(path);
+            return -1;
+        }
+        list->files = grown;
+        list->capacity = new_capacity;
+    }
+    list->files[list->count].path = path;
+    list->files[list->count].due_ns = due_ns;
+    list->count++;
+    return 0;
+}
+
+/* Milliseconds until the earliest deadline */
+static int next_timeout_ms(const struct PendingList *list, long long now) {
+    long long wait = (long long)WATCH_IDLE_MS * 1000000;
+
+    for (int i = 0; i < list->count; i++) {
+        long long left = list->files[i].due_ns - now;
+        if (left < wait) {
+            wait = left > 0 ? left : 0;
+        }
+    }
+    return (int)((wait + 999999) / 1000000);
+}
+
+/* Queue every settled-write event for a matching file */
+static void read_events(int fd, const char *dir, const char *ext, struct PendingList *list) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(fd, buf, sizeof(buf));
+    long long due = stats_now_ns() + (long long)WATCH_DEBOUNCE_MS * 1000000;
+
+    for (char *p = buf; len > 0 && p < buf + len; ) {
+        struct inotify_event *ev = (struct inotify_event *)p;
+
+        if (ev->mask & IN_Q_OVERFLOW) {
+            log_errorf("Warning: Watch events were dropped; resave files to convert them\n");
+        } else if (ev->len > 0 && name_has_ext(ev->name, ext) &&
+                   queue_file(list, dir, ev->name, due) != 0) {
+            log_errorf("Error: Failed to queue '%s'\n", ev->name);
+        }
+        p += sizeof(struct inotify_event) + ev->len;
+    }
+}
+
+/* Hand every file past its deadline to fn, in arrival order */
+static void dispatch_due(struct PendingList *list, watch_fn fn, void *arg) {
+    long long now = stats_now_ns();
+    char **due = malloc((size_t)(list->count > 0 ? list->count : 1) * sizeof(char *));
+    int due_count = 0;
+    int kept = 0;
+
+    if (!due) {
+        return;
+    }
+    for (int i = 0; i < list->count; i++) {
+        if (list->files[i].due_ns <= now) {
+            due[due_count++] = list->files[i].path;
+        } else {
+            list->files[kept++] = list->files[i];
+        }
+    }
+    list->count = kept;
+
+    if (due_count > 0) {
+        fn(arg, due, due_count);
+    }
+    for (int i = 0; i < due_count; i++) {
+        free(due[i]);
+    }
+    free(due);
+}
+
+int watch_directory(const char *dir, const char *ext, watch_fn fn, void *arg) {
+    struct PendingList list = { NULL, 0, 0 };
+    struct sigaction sa;
+    struct pollfd pfd;
+    int fd;
+
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        log_errorf("Error: Cannot start watching: %s\n", strerror(errno));
+        return -1;
+    }
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_errorf("Error: Cannot watch '%s': %s\n", dir, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    /* No SA_RESTART: a signal wakes the poll below */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    log_printf("Watching '%s' for *%s files\n", dir, ext);
+    fflush(stdout);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (!stop_requested) {
+        int ready = poll(&pfd, 1, next_timeout_ms(&list, stats_now_ns()));
+
+        if (ready > 0) {
+            read_events(fd, dir, ext, &list);
+        }
+        dispatch_due(&list, fn, arg);
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < list.count; i++) {
+        free(list.files[i].path);
+    }
+    free(list.files);
+    close(fd);
+    log_printf("Stopped watching '%s'\n", dir);
+    return 0;
+}
+
+#else
+
+int watch_directory(const char *dir, const char *ext, watch_fn fn, void *arg) {
+    (void)ext;
+    (void)fn;
+    (void)arg;
+    log_errorf("Error: Cannot watch '%s': --watch needs inotify (Linux)\n", dir);
+    return -1;
+}
+
+#endif
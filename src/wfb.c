@@ -2,27 +2,48 @@
  * wfb.c - WaveFront Bank file I/O
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "../include/converter.h"
+#include "../include/logging.h"
+#include "../include/stats.h"
+#include "../include/trace.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Forward declarations */
 extern uint16_t swap16(uint16_t val);
 extern void safe_string_copy(char *dest, const char *src, size_t dest_size);
 
-/* Write WFB file */
-int wfb_write(const char *filename, struct WFBBank *bank) {
-    FILE *f;
+/* Size of the type-specific struct that follows a sample's info */
+uint32_t wfb_sample_struct_size(int16_t type) {
+    switch (type) {
+        case WF_ST_SAMPLE:      return sizeof(struct SAMPLE);
+        case WF_ST_MULTISAMPLE: return sizeof(struct MULTISAMPLE);
+        case WF_ST_ALIAS:       return sizeof(struct ALIAS);
+        default:                return 0;
+    }
+}
+
+/* Copy the bank's counts and sample memory total into its header */
+void wfb_update_header(struct WFBBank *bank) {
+    bank->header.wProgramCount = bank->program_count;
+    bank->header.wPatchCount = bank->patch_count;
+    bank->header.wSampleCount = bank->sample_count;
+    bank->header.wDrumkitCount = bank->has_drumkit ? 1 : 0;
+    bank->header.dwMemoryRequired = bank->total_sample_memory;
+}
+
+/* Write a bank to an open stream (a file, memory buffer or caller's sink) */
+int wfb_write_stream(FILE *f, struct WFBBank *bank) {
     int i;
     uint32_t offset;
 
-    f = fopen(filename, "wb");
-    if (!f) {
-        fprintf(stderr, "Error: Cannot create '%s'\n", filename);
-        return -1;
-    }
-
     /* Calculate offsets */
     offset = sizeof(struct WaveFrontFileHeader);
 
@@ -41,8 +62,7 @@ int wfb_write(const char *filename, struct WFBBank *bank) {
 
     /* Write header */
     if (fwrite(&bank->header, sizeof(bank->header), 1, f) != 1) {
-        fprintf(stderr, "Error: Failed to write header\n");
-        fclose(f);
+        log_errorf("Error: Failed to write header\n");
         return -1;
     }
 
@@ -50,8 +70,7 @@ int wfb_write(const char *filename, struct WFBBank *bank) {
     if (bank->program_count > 0) {
         if (fwrite(bank->programs, sizeof(struct WaveFrontProgram),
                    bank->program_count, f) != (size_t)bank->program_count) {
-            fprintf(stderr, "Error: Failed to write programs\n");
-            fclose(f);
+            log_errorf("Error: Failed to write programs\n");
             return -1;
         }
     }
@@ -59,8 +78,7 @@ int wfb_write(const char *filename, struct WFBBank *bank) {
     /* Write drumkit */
     if (bank->has_drumkit) {
         if (fwrite(&bank->drumkit, sizeof(struct WaveFrontDrumkit), 1, f) != 1) {
-            fprintf(stderr, "Error: Failed to write drumkit\n");
-            fclose(f);
+            log_errorf("Error: Failed to write drumkit\n");
             return -1;
         }
     }
@@ -69,8 +87,7 @@ int wfb_write(const char *filename, struct WFBBank *bank) {
     if (bank->patch_count > 0) {
         if (fwrite(bank->patches, sizeof(struct WaveFrontPatch),
                    bank->patch_count, f) != (size_t)bank->patch_count) {
-            fprintf(stderr, "Error: Failed to write patches\n");
-            fclose(f);
+            log_errorf("Error: Failed to write patches\n");
             return -1;
         }
     }
@@ -79,21 +96,11 @@ int wfb_write(const char *filename, struct WFBBank *bank) {
     for (i = 0; i < bank->sample_count; i++) {
         struct WaveFrontExtendedSampleInfo *info = &bank->samples[i].info;
         char embedded_marker[MAX_PATH_LENGTH] = "EMBEDDED";
-        uint32_t sample_struct_size = 0;
+        uint32_t struct_size = wfb_sample_struct_size(info->nSampleType);
 
         /* Calculate size of this sample entry */
         info->dwSize = sizeof(struct WaveFrontExtendedSampleInfo);
-
-        /* Add appropriate struct size */
-        if (info->nSampleType == WF_ST_SAMPLE) {
-            sample_struct_size = sizeof(struct SAMPLE);
-        } else if (info->nSampleType == WF_ST_MULTISAMPLE) {
-            sample_struct_size = sizeof(struct MULTISAMPLE);
-        } else if (info->nSampleType == WF_ST_ALIAS) {
-            sample_struct_size = sizeof(struct ALIAS);
-        }
-
-        info->dwSize += sample_struct_size;
+        info->dwSize += struct_size;
         info->dwSize += MAX_PATH_LENGTH;  /* Filespec/marker */
 
         if (info->nSampleType == WF_ST_SAMPLE && bank->samples[i].pcm_data) {
@@ -102,176 +109,260 @@ int wfb_write(const char *filename, struct WFBBank *bank) {
 
         /* Write sample info header */
         if (fwrite(info, sizeof(*info), 1, f) != 1) {
-            fprintf(stderr, "Error: Failed to write sample %d info\n", i);
-            fclose(f);
+            log_errorf("Error: Failed to write sample %d info\n", i);
             return -1;
         }
 
         /* Write sample struct */
-        if (sample_struct_size > 0) {
-            if (fwrite(&bank->samples[i].data, sample_struct_size, 1, f) != 1) {
-                fprintf(stderr, "Error: Failed to write sample %d data struct\n", i);
-                fclose(f);
+        if (struct_size > 0) {
+            if (fwrite(&bank->samples[i].data, struct_size, 1, f) != 1) {
+                log_errorf("Error: Failed to write sample %d data struct\n", i);
                 return -1;
             }
         }
 
         /* Write filespec (always "EMBEDDED" for our purposes) */
         if (fwrite(embedded_marker, MAX_PATH_LENGTH, 1, f) != 1) {
-            fprintf(stderr, "Error: Failed to write sample %d filespec\n", i);
-            fclose(f);
+            log_errorf("Error: Failed to write sample %d filespec\n", i);
             return -1;
         }
 
         /* Write PCM data if embedded */
         if (info->nSampleType == WF_ST_SAMPLE && bank->samples[i].pcm_data) {
             if (fwrite(bank->samples[i].pcm_data, info->dwSizeInBytes, 1, f) != 1) {
-                fprintf(stderr, "Error: Failed to write sample %d PCM data\n", i);
-                fclose(f);
+                log_errorf("Error: Failed to write sample %d PCM data\n", i);
                 return -1;
             }
         }
     }
 
-    fclose(f);
     return 0;
 }
 
-/* Read WFB file */
-int wfb_read(const char *filename, struct WFBBank *bank) {
+/* Write WFB file */
+int wfb_write(const char *filename, struct WFBBank *bank) {
     FILE *f;
+    long long start = stats_phase_begin();
+    long long span = trace_begin();
+
+    f = fopen(filename, "wb");
+    if (!f) {
+        log_errorf("Error: Cannot create '%s'\n", filename);
+        return -1;
+    }
+
+    if (wfb_write_stream(f, bank) != 0) {
+        fclose(f);
+        return -1;
+    }
+
+    stats_count(STAT_BYTES_WRITTEN, ftell(f));
+    if (fclose(f) != 0) {
+        log_errorf("Error: Failed to write '%s'\n", filename);
+        return -1;
+    }
+    stats_phase_end(STAT_WRITE, start);
+    trace_end(span, "wfb_write", "%s", filename);
+    return 0;
+}
+
+/* Whether [offset, offset + len) lies inside a file of size bytes */
+static int in_file(size_t size, size_t offset, size_t len) {
+    return offset <= size && len <= size - offset;
+}
+
+/* Release the file mapping behind a bank read by wfb_read() */
+void wfb_unmap(struct WFBBank *bank) {
+    if (bank->map) {
+        munmap(bank->map, bank->map_size);
+        bank->map = NULL;
+        bank->map_size = 0;
+    }
+}
+
+/*
+ * Read WFB file. The file is mapped rather than read: every record is
+ * copied into the bank, but pcm_data points into the mapping, so sample
+ * data is only paged in when something touches it. The mapping is
+ * private, so writes to pcm_data never reach the file.
+ */
+int wfb_read(const char *filename, struct WFBBank *bank) {
+    struct WaveFrontFileHeader header;
+    const uint8_t *base;
+    struct stat st;
+    size_t size, pos;
+    void *map;
+    int fd;
     int i;
 
     memset(bank, 0, sizeof(*bank));
 
-    f = fopen(filename, "rb");
-    if (!f) {
-        fprintf(stderr, "Error: Cannot open '%s'\n", filename);
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        log_errorf("Error: Cannot open '%s'\n", filename);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)) {
+        log_errorf("Error: Failed to read header\n");
+        close(fd);
         return -1;
     }
+    size = (size_t)st.st_size;
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_errorf("Error: Cannot map '%s'\n", filename);
+        return -1;
+    }
+    base = map;
 
     /* Read header */
-    if (fread(&bank->header, sizeof(bank->header), 1, f) != 1) {
-        fprintf(stderr, "Error: Failed to read header\n");
-        fclose(f);
+    memcpy(&header, base, sizeof(header));
+
+    /* Size the bank's tables to the file */
+    if (header.wProgramCount > WF_MAX_PROGRAMS || header.wPatchCount > WF_MAX_PATCHES ||
+        header.wSampleCount > WF_MAX_SAMPLES) {
+        log_errorf("Error: '%s' has more programs, patches or samples than WaveFront allows\n",
+                   filename);
+        munmap(map, size);
         return -1;
     }
+    if (init_wfb_bank(bank, header.szSynthName, header.wProgramCount,
+                      header.wPatchCount, header.wSampleCount) != 0) {
+        munmap(map, size);
+        return -1;
+    }
+    bank->header = header;
+    bank->map = map;
+    bank->map_size = size;
 
     /* Validate */
     if (bank->header.wVersion != WF_VERSION) {
-        fprintf(stderr, "Warning: File version is %d, expected %d\n",
-                bank->header.wVersion, WF_VERSION);
+        log_errorf("Warning: File version is %d, expected %d\n",
+                   bank->header.wVersion, WF_VERSION);
     }
 
     bank->program_count = bank->header.wProgramCount;
     bank->patch_count = bank->header.wPatchCount;
-    bank->sample_count = bank->header.wSampleCount;
     bank->has_drumkit = bank->header.wDrumkitCount > 0;
 
     /* Read programs */
     if (bank->program_count > 0) {
-        fseek(f, bank->header.dwProgramOffset, SEEK_SET);
-        if (fread(bank->programs, sizeof(struct WaveFrontProgram),
-                  bank->program_count, f) != (size_t)bank->program_count) {
-            fprintf(stderr, "Error: Failed to read programs\n");
-            fclose(f);
-            return -1;
+        size_t bytes = (size_t)bank->program_count * sizeof(struct WaveFrontProgram);
+        if (!in_file(size, bank->header.dwProgramOffset, bytes)) {
+            log_errorf("Error: Failed to read programs\n");
+            goto error;
         }
+        memcpy(bank->programs, base + bank->header.dwProgramOffset, bytes);
     }
 
     /* Read drumkit */
     if (bank->has_drumkit) {
-        fseek(f, bank->header.dwDrumkitOffset, SEEK_SET);
-        if (fread(&bank->drumkit, sizeof(struct WaveFrontDrumkit), 1, f) != 1) {
-            fprintf(stderr, "Error: Failed to read drumkit\n");
-            fclose(f);
-            return -1;
+        if (!in_file(size, bank->header.dwDrumkitOffset, sizeof(struct WaveFrontDrumkit))) {
+            log_errorf("Error: Failed to read drumkit\n");
+            goto error;
         }
+        memcpy(&bank->drumkit, base + bank->header.dwDrumkitOffset,
+               sizeof(struct WaveFrontDrumkit));
     }
 
     /* Read patches */
     if (bank->patch_count > 0) {
-        fseek(f, bank->header.dwPatchOffset, SEEK_SET);
-        if (fread(bank->patches, sizeof(struct WaveFrontPatch),
-                  bank->patch_count, f) != (size_t)bank->patch_count) {
-            fprintf(stderr, "Error: Failed to read patches\n");
-            fclose(f);
-            return -1;
+        size_t bytes = (size_t)bank->patch_count * sizeof(struct WaveFrontPatch);
+        if (!in_file(size, bank->header.dwPatchOffset, bytes)) {
+            log_errorf("Error: Failed to read patches\n");
+            goto error;
         }
+        memcpy(bank->patches, base + bank->header.dwPatchOffset, bytes);
     }
 
-    /* Read samples (basic info only - skip PCM data for now) */
-    if (bank->sample_count > 0) {
-        fseek(f, bank->header.dwSampleOffset, SEEK_SET);
-        for (i = 0; i < bank->sample_count; i++) {
-            if (fread(&bank->samples[i].info, sizeof(struct WaveFrontExtendedSampleInfo),
-                      1, f) != 1) {
-                fprintf(stderr, "Error: Failed to read sample %d info\n", i);
-                break;
-            }
-            uint32_t struct_bytes = 0;
-            if (bank->samples[i].info.nSampleType == WF_ST_SAMPLE) {
-                if (fread(&bank->samples[i].data.sample, sizeof(struct SAMPLE), 1, f) != 1) {
-                    fprintf(stderr, "Error: Failed to read sample %d data struct\n", i);
-                    break;
-                }
-                struct_bytes = sizeof(struct SAMPLE);
-            } else if (bank->samples[i].info.nSampleType == WF_ST_MULTISAMPLE) {
-                struct_bytes = sizeof(struct MULTISAMPLE);
-            } else if (bank->samples[i].info.nSampleType == WF_ST_ALIAS) {
-                struct_bytes = sizeof(struct ALIAS);
-            }
-            if (struct_bytes > 0) {
-                fseek(f, struct_bytes + MAX_PATH_LENGTH, SEEK_CUR);
-            } else if (bank->samples[i].info.nSampleType == WF_ST_MULTISAMPLE) {
-                /* No-op */
-            }
-            /* Skip the rest of the sample data */
-            uint32_t skip_size = bank->samples[i].info.dwSize -
-                                 sizeof(struct WaveFrontExtendedSampleInfo);
-            if (skip_size > struct_bytes + MAX_PATH_LENGTH) {
-                fseek(f, skip_size - (struct_bytes + MAX_PATH_LENGTH), SEEK_CUR);
-            } else if (skip_size > 0) {
-                fseek(f, skip_size, SEEK_CUR);
+    /* Read samples: info, type-specific struct, filespec, then any PCM */
+    pos = bank->header.dwSampleOffset;
+    for (i = 0; i < bank->header.wSampleCount; i++) {
+        struct WFBSample *sample = &bank->samples[i];
+        struct WFBSampleKey *key = &bank->sample_keys[i];
+        size_t struct_bytes, head_bytes;
+
+        if (!in_file(size, pos, sizeof(sample->info))) {
+            log_errorf("Error: Failed to read sample %d info\n", i);
+            goto error;
+        }
+        memcpy(&sample->info, base + pos, sizeof(sample->info));
+
+        struct_bytes = wfb_sample_struct_size(sample->info.nSampleType);
+        head_bytes = sizeof(sample->info) + struct_bytes + MAX_PATH_LENGTH;
+        if (sample->info.dwSize < head_bytes || !in_file(size, pos, sample->info.dwSize)) {
+            log_errorf("Error: Sample %d record is truncated\n", i);
+            goto error;
+        }
+        memcpy(&sample->data, base + pos + sizeof(sample->info), struct_bytes);
+
+        key->type = (uint16_t)sample->info.nSampleType;
+        key->rate = sample->info.dwSampleRate;
+        key->frames = sample->info.dwSizeInSamples;
+        key->channel = (uint16_t)sample->info.nChannel;
+
+        if (sample->info.nSampleType == WF_ST_SAMPLE &&
+            sample->info.dwSize > head_bytes) {
+            if (sample->info.dwSize - head_bytes < sample->info.dwSizeInBytes) {
+                log_errorf("Error: Sample %d PCM data is truncated\n", i);
+                goto error;
             }
+            sample->pcm_data = (int16_t *)((uint8_t *)bank->map + pos + head_bytes);
+            bank->total_sample_memory += sample->info.dwSizeInBytes;
+        } else if (sample->info.nSampleType == WF_ST_ALIAS) {
+            bank->alias_count++;
         }
+
+        bank->sample_count++;
+        pos += sample->info.dwSize;
     }
 
-    fclose(f);
     return 0;
+
+error:
+    free_wfb_bank(bank);
+    return -1;
 }
 
 /* Print WFB file information */
 void wfb_print_info(struct WFBBank *bank) {
-    printf("\n=== WaveFront Bank Information ===\n");
-    printf("Synth Name:      %s\n", bank->header.szSynthName);
-    printf("File Type:       %s\n", bank->header.szFileType);
-    printf("Version:         %.2f\n", bank->header.wVersion / 100.0);
-    printf("\n--- Counts ---\n");
-    printf("Programs:        %d\n", bank->header.wProgramCount);
-    printf("Patches:         %d\n", bank->header.wPatchCount);
-    printf("Samples:         %d\n", bank->header.wSampleCount);
-    printf("Drumkits:        %d\n", bank->header.wDrumkitCount);
-    printf("\n--- Memory ---\n");
-    printf("RAM Required:    %u bytes (%.2f MB)\n",
-           bank->header.dwMemoryRequired,
-           bank->header.dwMemoryRequired / (1024.0 * 1024.0));
-    printf("Embedded:        %s\n", bank->header.bEmbeddedSamples ? "Yes" : "No");
-    printf("\n--- Offsets ---\n");
-    printf("Programs:        0x%08X\n", bank->header.dwProgramOffset);
-    printf("Drumkit:         0x%08X\n", bank->header.dwDrumkitOffset);
-    printf("Patches:         0x%08X\n", bank->header.dwPatchOffset);
-    printf("Samples:         0x%08X\n", bank->header.dwSampleOffset);
+    log_printf("\n=== WaveFront Bank Information ===\n");
+    log_printf("Synth Name:      %s\n", bank->header.szSynthName);
+    log_printf("File Type:       %s\n", bank->header.szFileType);
+    log_printf("Version:         %.2f\n", bank->header.wVersion / 100.0);
+    log_printf("\n--- Counts ---\n");
+    log_printf("Programs:        %d\n", bank->header.wProgramCount);
+    log_printf("Patches:         %d\n", bank->header.wPatchCount);
+    log_printf("Samples:         %d\n", bank->header.wSampleCount);
+    log_printf("Drumkits:        %d\n", bank->header.wDrumkitCount);
+    log_printf("\n--- Memory ---\n");
+    log_printf("RAM Required:    %u bytes (%.2f MB)\n",
+               bank->header.dwMemoryRequired,
+               bank->header.dwMemoryRequired / (1024.0 * 1024.0));
+    log_printf("Embedded:        %s\n", bank->header.bEmbeddedSamples ? "Yes" : "No");
+    log_printf("\n--- Offsets ---\n");
+    log_printf("Programs:        0x%08X\n", bank->header.dwProgramOffset);
+    log_printf("Drumkit:         0x%08X\n", bank->header.dwDrumkitOffset);
+    log_printf("Patches:         0x%08X\n", bank->header.dwPatchOffset);
+    log_printf("Samples:         0x%08X\n", bank->header.dwSampleOffset);
 
     if (bank->header.szComment[0]) {
-        printf("\n--- Comment ---\n%s\n", bank->header.szComment);
+        log_printf("\n--- Comment ---\n%s\n", bank->header.szComment);
     }
-    printf("==================================\n\n");
+    log_printf("==================================\n\n");
 }
 
 /* Update device name in existing WFB file */
 int wfb_retarget(const char *filename, const char *new_device) {
     struct WFBBank bank;
+    char temp[1024];
+
+    /* The bank's PCM is mapped from the file, so write beside it and rename */
+    if (snprintf(temp, sizeof(temp), "%s.tmp", filename) >= (int)sizeof(temp)) {
+        log_errorf("Error: Path too long '%s'\n", filename);
+        return -1;
+    }
 
     if (wfb_read(filename, &bank) != 0) {
         return -1;
@@ -279,10 +370,19 @@ int wfb_retarget(const char *filename, const char *new_device) {
 
     safe_string_copy(bank.header.szSynthName, new_device, NAME_LENGTH);
 
-    if (wfb_write(filename, &bank) != 0) {
+    if (wfb_write(temp, &bank) != 0) {
+        free_wfb_bank(&bank);
+        remove(temp);
+        return -1;
+    }
+    free_wfb_bank(&bank);
+
+    if (rename(temp, filename) != 0) {
+        log_errorf("Error: Cannot replace '%s'\n", filename);
+        remove(temp);
         return -1;
     }
 
-    printf("Updated '%s' target device to '%s'.\n", filename, new_device);
+    log_printf("Updated '%s' target device to '%s'.\n", filename, new_device);
     return 0;
 }
@@ -0,0 +1,298 @@
+/*
+ * wfb_index.c - Record offset index for WFB files
+ *
+ * Sidecar layout, native byte order (it is a local cache, rebuilt freely):
+ *
+ *   WFBIndexFileHeader
+ *   WaveFrontFileHeader             copy of the indexed file's header
+ *   uint32_t offsets[sample_count]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/wfb_index.h"
+#include "../include/logging.h"
+#include "../include/memtrack.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define WFB_INDEX_MAGIC "WFBI"
+#define WFB_INDEX_VERSION 1
+
+struct WFBIndexFileHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t source_size;
+    int64_t source_mtime_ns;
+    uint32_t sample_count;
+    uint32_t reserved;
+};
+
+static int stat_source(const char *filename, long long *size, long long *mtime_ns) {
+    struct stat st;
+
+    if (stat(filename, &st) != 0) {
+        return -1;
+    }
+    *size = (long long)st.st_size;
+    *mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+static int sidecar_path(const char *filename, char *path, size_t size) {
+    return snprintf(path, size, "%s.idx", filename) < (int)size ? 0 : -1;
+}
+
+int wfb_index_build(const char *filename, struct WFBIndex *index) {
+    FILE *f;
+    long pos;
+
+    memset(index, 0, sizeof(*index));
+    if (stat_source(filename, &index->source_size, &index->source_mtime_ns) != 0) {
+        log_errorf("Error: Cannot open '%s'\n", filename);
+        return -1;
+    }
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        log_errorf("Error: Cannot open '%s'\n", filename);
+        return -1;
+    }
+    if (fread(&index->header, sizeof(index->header), 1, f) != 1) {
+        log_errorf("Error: Failed to read header\n");
+        fclose(f);
+        return -1;
+    }
+    if (index->header.wSampleCount > WF_MAX_SAMPLES) {
+        log_errorf("Error: '%s' has more samples than WaveFront allows\n", filename);
+        fclose(f);
+        return -1;
+    }
+
+    index->sample_offsets = mem_calloc(STAT_MEM_TABLES, index->header.wSampleCount + 1u,
+                                       sizeof(uint32_t));
+    if (!index->sample_offsets) {
+        log_errorf("Error: Failed to allocate WFB index\n");
+        fclose(f);
+        return -1;
+    }
+
+    /* Each record starts with its info, whose dwSize leads to the next */
+    pos = index->header.dwSampleOffset;
+    for (int i = 0; i < index->header.wSampleCount; i++) {
+        struct WaveFrontExtendedSampleInfo info;
+
+        if (fseek(f, pos, SEEK_SET) != 0 || fread(&info, sizeof(info), 1, f) != 1 ||
+            info.dwSize < sizeof(info) || pos + (long long)info.dwSize > index->source_size) {
+            log_errorf("Error: Failed to read sample %d info\n", i);
+            fclose(f);
+            wfb_index_free(index);
+            return -1;
+        }
+        index->sample_offsets[i] = (uint32_t)pos;
+        index->sample_count++;
+        pos += info.dwSize;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int wfb_index_load(const char *filename, struct WFBIndex *index) {
+    struct WFBIndexFileHeader file_header;
+    long long size, mtime_ns;
+    char path[1024];
+    FILE *f;
+
+    memset(index, 0, sizeof(*index));
+    if (sidecar_path(filename, path, sizeof(path)) != 0 ||
+        stat_source(filename, &size, &mtime_ns) != 0) {
+        return -1;
+    }
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return -1;
+    }
+    if (fread(&file_header, sizeof(file_header), 1, f) != 1 ||
+        memcmp(file_header.magic, WFB_INDEX_MAGIC, 4) != 0 ||
+        file_header.version != WFB_INDEX_VERSION ||
+        file_header.source_size != size || file_header.source_mtime_ns != mtime_ns ||
+        fread(&index->header, sizeof(index->header), 1, f) != 1 ||
+        file_header.sample_count != index->header.wSampleCount ||
+        file_header.sample_count > WF_MAX_SAMPLES) {
+        fclose(f);
+        return -1;
+    }
+
+    index->sample_offsets = mem_calloc(STAT_MEM_TABLES, file_header.sample_count + 1u,
+                                       sizeof(uint32_t));
+    if (!index->sample_offsets ||
+        fread(index->sample_offsets, sizeof(uint32_t), file_header.sample_count, f) !=
+        file_header.sample_count) {
+        fclose(f);
+        wfb_index_free(index);
+        return -1;
+    }
+    fclose(f);
+
+    index->sample_count = (int)file_header.sample_count;
+    index->source_size = size;
+    index->source_mtime_ns = mtime_ns;
+    return 0;
+}
+
+int wfb_index_save(const char *filename, const struct WFBIndex *index) {
+    struct WFBIndexFileHeader file_header;
+    char path[1024];
+    char tmp_path[1040];
+    FILE *f;
+    int ok;
+
+    if (sidecar_path(filename, path, sizeof(path)) != 0) {
+        log_errorf("Error: Path too long '%s'\n", filename);
+        return -1;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    memset(&file_header, 0, sizeof(file_header));
+    memcpy(file_header.magic, WFB_INDEX_MAGIC, 4);
+    file_header.version = WFB_INDEX_VERSION;
+    file_header.source_size = index->source_size;
+    file_header.source_mtime_ns = index->source_mtime_ns;
+    file_header.sample_count = (uint32_t)index->sample_count;
+
+    f = fopen(tmp_path, "wb");
+    if (!f) {
+        log_errorf("Error: Cannot write index '%s'\n", tmp_path);
+        return -1;
+    }
+    ok = fwrite(&file_header, sizeof(file_header), 1, f) == 1 &&
+         fwrite(&index->header, sizeof(index->header), 1, f) == 1 &&
+         fwrite(index->sample_offsets, sizeof(uint32_t), (size_t)index->sample_count, f) ==
+         (size_t)index->sample_count;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        log_errorf("Error: Failed to write index '%s'\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int wfb_index_open(const char *filename, struct WFBIndex *index, int save_sidecar) {
+    if (wfb_index_load(filename, index) == 0) {
+        return 0;
+    }
+    if (wfb_index_build(filename, index) != 0) {
+        return -1;
+    }
+    if (save_sidecar) {
+        wfb_index_save(filename, index);
+    }
+    return 0;
+}
+
+void wfb_index_free(struct WFBIndex *index) {
+    mem_free(index->sample_offsets);
+    index->sample_offsets = NULL;
+    index->sample_count = 0;
+}
+
+uint32_t wfb_index_program_offset(const struct WFBIndex *index, int n) {
+    if (n < 0 || n >= index->header.wProgramCount) {
+        return 0;
+    }
+    return index->header.dwProgramOffset + (uint32_t)n * sizeof(struct WaveFrontProgram);
+}
+
+uint32_t wfb_index_patch_offset(const struct WFBIndex *index, int n) {
+    if (n < 0 || n >= index->header.wPatchCount) {
+        return 0;
+    }
+    return index->header.dwPatchOffset + (uint32_t)n * sizeof(struct WaveFrontPatch);
+}
+
+uint32_t wfb_index_sample_offset(const struct WFBIndex *index, int n) {
+    if (n < 0 || n >= index->sample_count) {
+        return 0;
+    }
+    return index->sample_offsets[n];
+}
+
+/* Seek to offset and read one record of size bytes */
+static int read_at(FILE *f, uint32_t offset, void *dest, size_t size) {
+    return offset != 0 && fseek(f, (long)offset, SEEK_SET) == 0 &&
+           fread(dest, size, 1, f) == 1 ? 0 : -1;
+}
+
+int wfb_index_read_program(FILE *f, const struct WFBIndex *index, int n,
+                           struct WaveFrontProgram *program) {
+    if (read_at(f, wfb_index_program_offset(index, n), program, sizeof(*program)) != 0) {
+        log_errorf("Error: Failed to read program %d\n", n);
+        return -1;
+    }
+    return 0;
+}
+
+int wfb_index_read_patch(FILE *f, const struct WFBIndex *index, int n,
+                         struct WaveFrontPatch *patch) {
+    if (read_at(f, wfb_index_patch_offset(index, n), patch, sizeof(*patch)) != 0) {
+        log_errorf("Error: Failed to read patch %d\n", n);
+        return -1;
+    }
+    return 0;
+}
+
+int wfb_index_read_drumkit(FILE *f, const struct WFBIndex *index,
+                           struct WaveFrontDrumkit *drumkit) {
+    if (index->header.wDrumkitCount == 0 ||
+        read_at(f, index->header.dwDrumkitOffset, drumkit, sizeof(*drumkit)) != 0) {
+        log_errorf("Error: Failed to read drumkit\n");
+        return -1;
+    }
+    return 0;
+}
+
+int wfb_index_read_sample(FILE *f, const struct WFBIndex *index, int n,
+                          struct WFBSample *sample) {
+    uint32_t struct_bytes, head_bytes;
+
+    memset(sample, 0, sizeof(*sample));
+    if (read_at(f, wfb_index_sample_offset(index, n), &sample->info,
+                sizeof(sample->info)) != 0) {
+        log_errorf("Error: Failed to read sample %d info\n", n);
+        return -1;
+    }
+
+    struct_bytes = wfb_sample_struct_size(sample->info.nSampleType);
+    head_bytes = sizeof(sample->info) + struct_bytes + MAX_PATH_LENGTH;
+    if (sample->info.dwSize < head_bytes ||
+        (struct_bytes > 0 && fread(&sample->data, struct_bytes, 1, f) != 1)) {
+        log_errorf("Error: Failed to read sample %d data struct\n", n);
+        return -1;
+    }
+
+    /* Embedded PCM follows the filespec */
+    if (sample->info.nSampleType == WF_ST_SAMPLE && sample->info.dwSize > head_bytes &&
+        sample->info.dwSizeInBytes > 0) {
+        if (sample->info.dwSize - head_bytes < sample->info.dwSizeInBytes) {
+            log_errorf("Error: Sample %d PCM data is truncated\n", n);
+            return -1;
+        }
+        sample->pcm_data = mem_alloc(STAT_MEM_CONVERTED_PCM, sample->info.dwSizeInBytes);
+        if (!sample->pcm_data) {
+            log_errorf("Error: Failed to allocate sample %d PCM data\n", n);
+            return -1;
+        }
+        if (fseek(f, MAX_PATH_LENGTH, SEEK_CUR) != 0 ||
+            fread(sample->pcm_data, sample->info.dwSizeInBytes, 1, f) != 1) {
+            log_errorf("Error: Failed to read sample %d PCM data\n", n);
+            mem_free(sample->pcm_data);
+            sample->pcm_data = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,402 @@
+/*
+ * wfb_verify.c - Deep consistency check of WFB files
+ *
+ * Loads a bank through the mapped reader, which already rejects records
+ * outside the file, then checks what the reader takes on trust: that
+ * every reference resolves to a record of a usable type, that the tables
+ * do not overlap, and that the header's totals match the samples.
+ */
+
+#include "../include/wfb_verify.h"
+#include "../include/converter.h"
+#include "../include/logging.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Verification state for one file */
+struct Verifier {
+    const char *filename;
+    const struct WFBBank *bank;
+    struct WFBVerifyReport *report;
+    int verbose;
+};
+
+__attribute__((format(printf, 2, 3)))
+static void verify_error(struct Verifier *v, const char *fmt, ...) {
+    char msg[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    v->report->errors++;
+    log_printf("  %s: error: %s\n", v->filename, msg);
+}
+
+__attribute__((format(printf, 2, 3)))
+static void verify_warning(struct Verifier *v, const char *fmt, ...) {
+    char msg[256];
+    va_list ap;
+
+    v->report->warnings++;
+    if (!v->verbose) {
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    log_printf("  %s: warning: %s\n", v->filename, msg);
+}
+
+/* One table of the file, for the overlap check */
+struct Section {
+    const char *name;
+    uint32_t offset;
+    uint64_t size;
+};
+
+static int compare_sections(const void *a, const void *b) {
+    const struct Section *sa = a;
+    const struct Section *sb = b;
+    return (sa->offset > sb->offset) - (sa->offset < sb->offset);
+}
+
+/* Tables must follow the header without overlapping; records must end the file */
+static void verify_layout(struct Verifier *v) {
+    const struct WFBBank *bank = v->bank;
+    const struct WaveFrontFileHeader *h = &bank->header;
+    struct Section sections[4];
+    uint64_t sample_bytes = 0;
+    int count = 0;
+
+    for (int i = 0; i < bank->sample_count; i++) {
+        sample_bytes += bank->samples[i].info.dwSize;
+    }
+
+    if (bank->program_count > 0) {
+        sections[count++] = (struct Section){ "programs", h->dwProgramOffset,
+            (uint64_t)bank->program_count * sizeof(struct WaveFrontProgram) };
+    }
+    if (bank->has_drumkit) {
+        sections[count++] = (struct Section){ "drumkit", h->dwDrumkitOffset,
+            sizeof(struct WaveFrontDrumkit) };
+    }
+    if (bank->patch_count > 0) {
+        sections[count++] = (struct Section){ "patches", h->dwPatchOffset,
+            (uint64_t)bank->patch_count * sizeof(struct WaveFrontPatch) };
+    }
+    if (bank->sample_count > 0) {
+        sections[count++] = (struct Section){ "samples", h->dwSampleOffset, sample_bytes };
+    }
+    qsort(sections, (size_t)count, sizeof(sections[0]), compare_sections);
+
+    for (int i = 0; i < count; i++) {
+        if (sections[i].offset < sizeof(struct WaveFrontFileHeader)) {
+            verify_error(v, "%s table at 0x%08X overlaps the header",
+                         sections[i].name, sections[i].offset);
+        }
+        if (i > 0 && (uint64_t)sections[i - 1].offset + sections[i - 1].size > sections[i].offset) {
+            verify_error(v, "%s table overlaps %s table", sections[i - 1].name, sections[i].name);
+        }
+    }
+
+    if (bank->sample_count > 0 &&
+        (uint64_t)h->dwSampleOffset + sample_bytes < bank->map_size) {
+        verify_warning(v, "%llu trailing byte(s) after the last sample record",
+                       (unsigned long long)(bank->map_size - h->dwSampleOffset - sample_bytes));
+    }
+    if (h->wDrumkitCount > 1) {
+        verify_warning(v, "header claims %u drum kits; only one is read", h->wDrumkitCount);
+    }
+}
+
+/* A sample reference must name a record that holds or leads to PCM */
+static int sample_ref_ok(const struct WFBBank *bank, int ref, int allow_multisample) {
+    int type;
+
+    if (ref < 0 || ref >= bank->sample_count) {
+        return 0;
+    }
+    type = bank->samples[ref].info.nSampleType;
+    return type == WF_ST_SAMPLE || type == WF_ST_ALIAS ||
+           (allow_multisample && type == WF_ST_MULTISAMPLE);
+}
+
+static void verify_sample_offsets(struct Verifier *v, int i, const struct SAMPLE *s) {
+    uint32_t frames = v->bank->samples[i].info.dwSizeInSamples;
+
+    if (s->sampleEndOffset.fInteger > frames) {
+        verify_error(v, "sample %d ends at frame %u, past its %u frames",
+                     i, (unsigned)s->sampleEndOffset.fInteger, frames);
+    }
+    if (s->sampleStartOffset.fInteger > s->sampleEndOffset.fInteger) {
+        verify_warning(v, "sample %d starts after its end", i);
+    }
+    if (s->fLoop && (s->loopStartOffset.fInteger > s->loopEndOffset.fInteger ||
+                     s->loopEndOffset.fInteger > s->sampleEndOffset.fInteger)) {
+        verify_warning(v, "sample %d loop lies outside the sample", i);
+    }
+}
+
+/* Sample records: types, PCM presence, alias and multisample targets */
+static void verify_samples(struct Verifier *v, uint8_t *sample_used) {
+    const struct WFBBank *bank = v->bank;
+
+    for (int i = 0; i < bank->sample_count; i++) {
+        const struct WFBSample *sample = &bank->samples[i];
+        const struct WaveFrontExtendedSampleInfo *info = &sample->info;
+
+        if (info->nNumber != i) {
+            verify_warning(v, "sample %d is numbered %d", i, info->nNumber);
+        }
+
+        switch (info->nSampleType) {
+            case WF_ST_SAMPLE:
+                if (bank->header.bEmbeddedSamples && !sample->pcm_data) {
+                    verify_error(v, "sample %d (\"%.32s\") has no embedded PCM", i, info->szName);
+                }
+                if (info->dwSizeInBytes != info->dwSizeInSamples * sizeof(int16_t)) {
+                    verify_warning(v, "sample %d is %u bytes for %u frames",
+                                   i, info->dwSizeInBytes, info->dwSizeInSamples);
+                }
+                verify_sample_offsets(v, i, &sample->data.sample);
+                v->report->memory_required += info->dwSizeInBytes;
+                break;
+
+            case WF_ST_ALIAS: {
+                int target = sample->data.alias.nOriginalSample;
+                if (target < 0 || target >= bank->sample_count ||
+                    bank->samples[target].info.nSampleType != WF_ST_SAMPLE) {
+                    verify_error(v, "alias %d points at %d, which is not a stored sample",
+                                 i, target);
+                } else {
+                    sample_used[target] = 1;
+                }
+                break;
+            }
+
+            case WF_ST_MULTISAMPLE: {
+                const struct MULTISAMPLE *ms = &sample->data.multisample;
+                uint8_t seen[WF_MAX_SAMPLES] = { 0 };
+                int unique = 0;
+
+                for (int k = 0; k < NUM_MIDIKEYS; k++) {
+                    int ref = ms->nSampleNumber[k];
+                    if (ref < 0) {
+                        continue;            /* Key not mapped */
+                    }
+                    if (!sample_ref_ok(bank, ref, 0)) {
+                        verify_error(v, "multisample %d key %d points at invalid sample %d",
+                                     i, k, ref);
+                        continue;
+                    }
+                    sample_used[ref] = 1;
+                    if (!seen[ref]) {
+                        seen[ref] = 1;
+                        unique++;
+                    }
+                }
+                if (ms->nNumberOfSamples != unique) {
+                    verify_warning(v, "multisample %d claims %d samples, maps %d",
+                                   i, ms->nNumberOfSamples, unique);
+                }
+                break;
+            }
+
+            case WF_ST_EMPTY:
+                break;
+
+            default:
+                verify_error(v, "sample %d has unknown type %d", i, info->nSampleType);
+                break;
+        }
+    }
+}
+
+/* Programs and the drum kit to patches, patches to samples */
+static void verify_references(struct Verifier *v, uint8_t *sample_used) {
+    const struct WFBBank *bank = v->bank;
+    uint8_t patch_used[WF_MAX_PATCHES] = { 0 };
+
+    for (int p = 0; p < bank->program_count; p++) {
+        for (int l = 0; l < NUM_LAYERS; l++) {
+            const struct LAYER *layer = &bank->programs[p].base.layer[l];
+            if (!layer->fUnmute) {
+                continue;
+            }
+            if (layer->byPatchNumber >= bank->patch_count) {
+                verify_error(v, "program %d layer %d points at missing patch %d",
+                             bank->programs[p].nNumber, l, layer->byPatchNumber);
+            } else {
+                patch_used[layer->byPatchNumber] = 1;
+            }
+        }
+    }
+
+    if (bank->has_drumkit) {
+        for (int k = 0; k < NUM_MIDIKEYS; k++) {
+            const struct DRUM *drum = &bank->drumkit.base.drum[k];
+            if (!drum->fUnmute) {
+                continue;
+            }
+            if (drum->byPatchNumber >= bank->patch_count) {
+                verify_error(v, "drum key %d points at missing patch %d", k, drum->byPatchNumber);
+            } else {
+                patch_used[drum->byPatchNumber] = 1;
+            }
+        }
+    }
+
+    for (int p = 0; p < bank->patch_count; p++) {
+        const struct PATCH *patch = &bank->patches[p].base;
+        int ref = get_patch_sample(patch);
+
+        if (!patch_used[p]) {
+            verify_warning(v, "patch %d is not used by any program or drum", p);
+            continue;
+        }
+        if (!sample_ref_ok(bank, ref, 1)) {
+            verify_error(v, "patch %d (\"%.32s\") points at invalid sample %d",
+                         p, bank->patches[p].szName, ref);
+        } else {
+            sample_used[ref] = 1;
+        }
+    }
+}
+
+int wfb_verify(const char *filename, struct WFBVerifyReport *report, int verbose) {
+    struct WFBBank bank;
+    struct Verifier v;
+    uint8_t sample_used[WF_MAX_SAMPLES] = { 0 };
+
+    memset(report, 0, sizeof(*report));
+    if (wfb_read(filename, &bank) != 0) {
+        report->errors++;
+        return -1;
+    }
+    report->readable = 1;
+
+    v.filename = filename;
+    v.bank = &bank;
+    v.report = report;
+    v.verbose = verbose;
+    report->program_count = bank.program_count;
+    report->patch_count = bank.patch_count;
+    report->sample_count = bank.sample_count;
+
+    verify_layout(&v);
+    verify_samples(&v, sample_used);
+    verify_references(&v, sample_used);
+
+    /* Multisample entries used by patches have now marked their samples */
+    for (int i = 0; i < bank.sample_count; i++) {
+        if (!sample_used[i] && bank.samples[i].info.nSampleType == WF_ST_SAMPLE) {
+            verify_warning(&v, "sample %d (\"%.32s\") is not referenced",
+                           i, bank.samples[i].info.szName);
+        }
+    }
+
+    if (report->memory_required != bank.header.dwMemoryRequired) {
+        verify_error(&v, "header claims %u bytes of sample memory, samples need %u",
+                     bank.header.dwMemoryRequired, report->memory_required);
+    }
+    if (report->memory_required > get_device_memory_limit(bank.header.szSynthName)) {
+        verify_warning(&v, "samples need %u bytes, more than %s holds",
+                       report->memory_required, bank.header.szSynthName);
+    }
+
+    free_wfb_bank(&bank);
+    return report->errors > 0 ? -1 : 0;
+}
+
+void wfb_verify_summary_init(struct WFBVerifySummary *summary) {
+    summary->results = NULL;
+    summary->count = 0;
+    summary->capacity = 0;
+    pthread_mutex_init(&summary->lock, NULL);
+}
+
+void wfb_verify_summary_add(struct WFBVerifySummary *summary, const char *path,
+                            const struct WFBVerifyReport *report) {
+    size_t len = strlen(path) + 1;
+    char *copy = malloc(len);
+
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, path, len);
+
+    pthread_mutex_lock(&summary->lock);
+    if (summary->count >= summary->capacity) {
+        int new_capacity = summary->capacity ? summary->capacity * 2 : 64;
+        struct WFBVerifyResult *grown = realloc(summary->results,
+                                                (size_t)new_capacity * sizeof(*grown));
+        if (!grown) {
+            pthread_mutex_unlock(&summary->lock);
+            free(copy);
+            return;
+        }
+        summary->results = grown;
+        summary->capacity = new_capacity;
+    }
+    summary->results[summary->count].path = copy;
+    summary->results[summary->count].report = *report;
+    summary->count++;
+    pthread_mutex_unlock(&summary->lock);
+}
+
+static int compare_results(const void *a, const void *b) {
+    return strcmp(((const struct WFBVerifyResult *)a)->path,
+                  ((const struct WFBVerifyResult *)b)->path);
+}
+
+void wfb_verify_summary_print(struct WFBVerifySummary *summary, int verbose) {
+    int clean = 0, warned = 0, failed = 0;
+    int shown = 0;
+
+    /* Files finish in any order on the pool; list them by path */
+    qsort(summary->results, (size_t)summary->count, sizeof(*summary->results),
+          compare_results);
+
+    printf("\n=== Verification ===\n");
+    for (int i = 0; i < summary->count; i++) {
+        const struct WFBVerifyResult *r = &summary->results[i];
+
+        if (r->report.errors > 0) {
+            failed++;
+        } else if (r->report.warnings > 0) {
+            warned++;
+        } else {
+            clean++;
+        }
+        if (!verbose && r->report.errors == 0 && r->report.warnings == 0) {
+            continue;
+        }
+        if (shown++ == 0) {
+            printf("%-40s %7s %7s %12s %6s %8s\n",
+                   "File", "Patches", "Samples", "Memory", "Errors", "Warnings");
+        }
+        if (!r->report.readable) {
+            printf("%-40s %7s %7s %12s %6d %8s\n", r->path, "-", "-", "unreadable",
+                   r->report.errors, "-");
+            continue;
+        }
+        printf("%-40s %7d %7d %12u %6d %8d\n", r->path, r->report.patch_count,
+               r->report.sample_count, r->report.memory_required,
+               r->report.errors, r->report.warnings);
+    }
+    printf("Verified %d bank(s): %d clean, %d with warnings, %d failed\n",
+           summary->count, clean, warned, failed);
+}
+
+void wfb_verify_summary_free(struct WFBVerifySummary *summary) {
+    for (int i = 0; i < summary->count; i++) {
+        free(summary->results[i].path);
+    }
+    free(summary->results);
+    summary->results = NULL;
+    summary->count = summary->capacity = 0;
+    pthread_mutex_destroy(&summary->lock);
+}